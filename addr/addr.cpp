@@ -1,42 +1,161 @@
 struct Addr {
 	enum Type {
-		Error, IPv4, IPv6,
+		Error, IPv4, IPv6, Unresolved,
 	};
 
-	Type type = Type::Error;
-	const char* name = nullptr;
-	union {
+	union IP {
 		struct in_addr v4;
 		struct in6_addr v6;
-	} ip;
+	};
+
+	struct Endpoint {
+		Type type;
+		IP ip;
+	};
+
+	constexpr static size_t max_endpoints = 8;
+
+	Type type = Type::Error;
+	const char* name = nullptr;
+	IP ip;
 	u16 port;
+	// Every address the name resolved to, in the order they should be tried (RFC 8305: families
+	// alternate, starting with the one getaddrinfo preferred). type and ip are endpoints[0].
+	Endpoint endpoints[max_endpoints];
+	size_t endpoint_count = 0;
 
 	static Addr make_ipv4(in_addr_t ipv4, u16 port) {
 		Addr addr;
 		addr.type = Addr::Type::IPv4;
 		addr.ip.v4.s_addr = ipv4;
 		addr.port = port;
+		addr.endpoints[0] = Endpoint(addr.type, addr.ip);
+		addr.endpoint_count = 1;
 		return addr;
 	}
 
 	static Addr make_ipv6(struct in6_addr ipv6, u16 port) {
 		Addr addr;
-		addr.type = Addr::Type::IPv4;
+		addr.type = Addr::Type::IPv6;
 		addr.ip.v6 = ipv6;
 		addr.port = port;
+		addr.endpoints[0] = Endpoint(addr.type, addr.ip);
+		addr.endpoint_count = 1;
 		return addr;
 	}
 
+	// For peers returned by accept, IPv4-mapped IPv6 addresses from dual-stack sockets become IPv4.
+	static Addr make_sockaddr(const struct sockaddr_storage* storage) {
+		if (storage->ss_family == AF_INET) {
+			const struct sockaddr_in* v4 = (const struct sockaddr_in*)storage;
+			return Addr::make_ipv4(v4->sin_addr.s_addr, ::ntohs(v4->sin_port));
+		}
+		if (storage->ss_family == AF_INET6) {
+			const struct sockaddr_in6* v6 = (const struct sockaddr_in6*)storage;
+			if (IN6_IS_ADDR_V4MAPPED(&v6->sin6_addr)) {
+				in_addr_t ipv4;
+				std::memcpy(&ipv4, &v6->sin6_addr.s6_addr[12], sizeof(ipv4));
+				return Addr::make_ipv4(ipv4, ::ntohs(v6->sin6_port));
+			}
+			return Addr::make_ipv6(v6->sin6_addr, ::ntohs(v6->sin6_port));
+		}
+		return Addr();
+	}
+
+	// Only a host name, HTTP resolves it asynchronously when a request for it is pushed.
+	static Addr make_unresolved(const char* name, u16 port) {
+		Addr addr;
+		addr.type = Addr::Type::Unresolved;
+		addr.name = name;
+		addr.port = port;
+		return addr;
+	}
+
+	// Blocking, safe to call from any thread.
 	static Addr resolve(const char* name, u16 port) {
-		struct hostent* host_ent = ::gethostbyname(name); // TODO: deprecated, use ::getaddrinfo
+		struct addrinfo hints = {};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_ADDRCONFIG;
+		struct addrinfo* result = nullptr;
+		Addr addr;
+		if (::getaddrinfo(name, nullptr, &hints, &result) != 0) {
+			return addr;
+		}
+		Endpoint v4[max_endpoints];
+		Endpoint v6[max_endpoints];
+		size_t v4_count = 0;
+		size_t v6_count = 0;
+		Type first_type = Type::Error;
+		for (struct addrinfo* info = result; info != nullptr; info = info->ai_next) {
+			Endpoint endpoint;
+			if (info->ai_family == AF_INET) {
+				endpoint.type = Type::IPv4;
+				endpoint.ip.v4 = ((struct sockaddr_in*)info->ai_addr)->sin_addr;
+				if (contains_endpoint(v4, v4_count, endpoint) == false && v4_count < max_endpoints) {
+					v4[v4_count] = endpoint;
+					v4_count += 1;
+				}
+			} else if (info->ai_family == AF_INET6) {
+				endpoint.type = Type::IPv6;
+				endpoint.ip.v6 = ((struct sockaddr_in6*)info->ai_addr)->sin6_addr;
+				if (contains_endpoint(v6, v6_count, endpoint) == false && v6_count < max_endpoints) {
+					v6[v6_count] = endpoint;
+					v6_count += 1;
+				}
+			} else {
+				continue;
+			}
+			if (first_type == Type::Error) {
+				first_type = endpoint.type;
+			}
+		}
+		::freeaddrinfo(result);
+		if (first_type == Type::Error) {
+			return addr;
+		}
+		Endpoint* first = first_type == Type::IPv6 ? v6 : v4;
+		Endpoint* second = first_type == Type::IPv6 ? v4 : v6;
+		size_t first_count = first_type == Type::IPv6 ? v6_count : v4_count;
+		size_t second_count = first_type == Type::IPv6 ? v4_count : v6_count;
+		for (size_t a = 0; a < max_endpoints && addr.endpoint_count < max_endpoints; ++a) {
+			if (a < first_count) {
+				addr.endpoints[addr.endpoint_count] = first[a];
+				addr.endpoint_count += 1;
+			}
+			if (a < second_count && addr.endpoint_count < max_endpoints) {
+				addr.endpoints[addr.endpoint_count] = second[a];
+				addr.endpoint_count += 1;
+			}
+		}
+		addr.type = addr.endpoints[0].type;
+		addr.ip = addr.endpoints[0].ip;
+		addr.name = name;
+		addr.port = port;
+		return addr;
+	}
+
+	static bool contains_endpoint(const Endpoint* endpoints, size_t count, Endpoint endpoint) {
+		for (size_t a = 0; a < count; ++a) {
+			if (endpoint.type == Type::IPv4 && endpoints[a].ip.v4.s_addr == endpoint.ip.v4.s_addr) {
+				return true;
+			}
+			if (endpoint.type == Type::IPv6 && std::memcmp(&endpoints[a].ip.v6, &endpoint.ip.v6, sizeof(endpoint.ip.v6)) == 0) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// A single-address Addr for one of the resolved endpoints.
+	Addr get_endpoint(this const auto& self, size_t index) {
 		Addr addr;
-		if (host_ent != nullptr && (host_ent->h_addrtype == AF_INET || host_ent->h_addrtype == AF_INET6)) {
-			addr.name = name;
-			bool ipv4 = host_ent->h_addrtype == AF_INET;
-			addr.type = ipv4 ? Addr::Type::IPv4 : Addr::Type::IPv6;
-			std::memcpy(&addr.ip, host_ent->h_addr, host_ent->h_length);
-			addr.port = port;
+		if (self.endpoints[index].type == Type::IPv4) {
+			addr = Addr::make_ipv4(self.endpoints[index].ip.v4.s_addr, self.port);
+		} else {
+			addr = Addr::make_ipv6(self.endpoints[index].ip.v6, self.port);
 		}
+		addr.name = self.name;
 		return addr;
 	}
 };
\ No newline at end of file
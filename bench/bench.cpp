@@ -0,0 +1,430 @@
+// Microbenchmarks for the parsers and framers on generated corpora: JSON::parse and
+// JSON::parse_document, WebsocketClient::handle_frame and HTTP::Request::try_recv. JSON files
+// given on the command line are benchmarked as extra corpora.
+
+#include "../mod.cpp"
+
+using namespace wtk;
+
+#include "common.cpp"
+
+// One run handles ops operations on bytes bytes. func returns the time spent on the measured part,
+// so per run setup stays out of the numbers.
+struct Benchmark {
+	const char* name;
+	size_t ops;
+	size_t bytes;
+	void* user;
+	u64 (*func)(void* user);
+};
+
+constexpr u64 min_benchmark_ns = 500000000;
+constexpr size_t min_benchmark_runs = 20;
+constexpr size_t warmup_runs = 3;
+
+void run_benchmark(Benchmark benchmark) {
+	for (size_t a = 0; a < warmup_runs; ++a) {
+		benchmark.func(benchmark.user);
+	}
+	Latencies latencies;
+	latencies.create();
+	u64 measured_ns = 0;
+	size_t runs = 0;
+	u64 start_ns = now_ns();
+	while (runs < min_benchmark_runs || now_ns() - start_ns < min_benchmark_ns) {
+		u64 run_ns = benchmark.func(benchmark.user);
+		latencies.push(run_ns / benchmark.ops);
+		measured_ns += run_ns;
+		runs += 1;
+	}
+	latencies.report(benchmark.name, measured_ns, runs * benchmark.ops, runs * benchmark.bytes);
+	latencies.destroy();
+}
+
+// JSON
+
+void push_format(ctk::gar<u8>* out, const char* format, ...) {
+	char buffer[512];
+	va_list args;
+	va_start(args, format);
+	int len = std::vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+	out->push_many((const u8*)buffer, len);
+}
+
+// Objects like a typical REST listing: ids, short strings, flags, floats, a nested object and an array.
+ctk::gar<u8> make_api_corpus(size_t count) {
+	ctk::gar<u8> out;
+	out.create_auto();
+	push_format(&out, "{\"total\":%zu,\"page\":1,\"items\":[", count);
+	for (size_t a = 0; a < count; ++a) {
+		push_format(&out, "%s{\"id\":%zu,\"name\":\"user_%zu\",\"email\":\"user_%zu@example.com\",\"active\":%s,\"score\":%.3f,", a == 0 ? "" : ",", 100000 + a, a, a, a % 3 == 0 ? "false" : "true", (double)(a * 37 % 1000) / 7.0);
+		push_format(&out, "\"created_at\":\"2024-%02zu-%02zuT12:%02zu:00Z\",\"tags\":[\"t%zu\",\"group_%zu\"],\"address\":{\"city\":\"City %zu\",\"zip\":\"%05zu\",\"geo\":[%.6f,%.6f]},\"manager\":null}", a % 12 + 1, a % 28 + 1, a % 60, a % 10, a % 4, a % 50, a * 7 % 100000, 48.0 + (double)a / 1e4, 11.0 - (double)a / 1e4);
+	}
+	push_format(&out, "]}");
+	return out;
+}
+
+ctk::gar<u8> make_numbers_corpus(size_t count) {
+	ctk::gar<u8> out;
+	out.create_auto();
+	out.push('[');
+	for (size_t a = 0; a < count; ++a) {
+		if (a % 3 == 0) {
+			push_format(&out, "%s%zu", a == 0 ? "" : ",", a * 2654435761u % 1000000007u);
+		} else if (a % 3 == 1) {
+			push_format(&out, ",%.9g", (double)a * -1.0001e-3);
+		} else {
+			push_format(&out, ",%.17g", 1.0 / (double)(a + 1));
+		}
+	}
+	out.push(']');
+	return out;
+}
+
+// Text with quotes, newlines and \u escapes (including surrogate pairs) in every string.
+ctk::gar<u8> make_escaped_corpus(size_t count) {
+	ctk::gar<u8> out;
+	out.create_auto();
+	out.push('[');
+	for (size_t a = 0; a < count; ++a) {
+		push_format(&out, "%s\"line %zu said \\\"hi\\\"\\nthen \\u00e9t\\u00e9 \\ud83d\\ude00 and a tab\\there, path C:\\\\tmp\\\\%zu\"", a == 0 ? "" : ",", a, a);
+	}
+	out.push(']');
+	return out;
+}
+
+// count values nested depth levels deep, alternating objects and arrays around a number.
+ctk::gar<u8> make_nested_corpus(size_t count, size_t depth) {
+	ctk::gar<u8> out;
+	out.create_auto();
+	out.push('[');
+	for (size_t a = 0; a < count; ++a) {
+		if (a > 0) {
+			out.push(',');
+		}
+		for (size_t b = 0; b < depth; ++b) {
+			if (b % 2 == 0) {
+				push_format(&out, "{\"k%zu\":", b % 10);
+			} else {
+				out.push('[');
+			}
+		}
+		push_format(&out, "%zu", a);
+		for (size_t b = depth; b > 0; --b) {
+			out.push((b - 1) % 2 == 0 ? '}' : ']');
+		}
+	}
+	out.push(']');
+	return out;
+}
+
+// Empty and barely filled containers, where opening and closing a level is all the work there is.
+ctk::gar<u8> make_empty_containers_corpus(size_t count) {
+	ctk::gar<u8> out;
+	out.create_auto();
+	out.push('[');
+	for (size_t a = 0; a < count; ++a) {
+		constexpr const char* values[] = {"[]", "{}", "[[]]", "[{}]", "{\"a\":[]}", "[[],[]]"};
+		push_format(&out, "%s%s", a == 0 ? "" : ",", values[a % 6]);
+	}
+	out.push(']');
+	return out;
+}
+
+struct JSONBenchmark {
+	ctk::ar<const u8> data;
+	bool use_document;
+	JSON::Backend backend;
+};
+
+u64 bench_json(void* user) {
+	JSONBenchmark* benchmark = (JSONBenchmark*)user;
+	JSON::Options options;
+	options.backend = benchmark->backend;
+	u64 start_ns = now_ns();
+	if (benchmark->use_document) {
+		JSON::Document document = JSON::parse_document(benchmark->data, options);
+		u64 elapsed_ns = now_ns() - start_ns;
+		if (document.root.type == JSON::Value::Type::Error) {
+			WTK_PANIC("JSON::parse_document failed");
+		}
+		document.destroy();
+		return elapsed_ns;
+	}
+	JSON::Value value = JSON::parse(benchmark->data, options);
+	u64 elapsed_ns = now_ns() - start_ns;
+	if (value.type == JSON::Value::Type::Error) {
+		WTK_PANIC("JSON::parse failed");
+	}
+	value.destroy();
+	return elapsed_ns;
+}
+
+// Every corpus goes through Auto and through each backend forced, so a change to one of them
+// shows up even where Auto would pick the other.
+void run_json_benchmarks(const char* corpus_name, ctk::ar<const u8> data) {
+	constexpr JSON::Backend backends[] = {JSON::Backend::Auto, JSON::Backend::Recursive, JSON::Backend::Structural};
+	constexpr const char* backend_names[] = {"auto", "recursive", "structural"};
+	char name[64];
+	for (size_t a = 0; a < 3; ++a) {
+		JSONBenchmark tree = JSONBenchmark(data, false, backends[a]);
+		std::snprintf(name, sizeof(name), "json parse %s %s", backend_names[a], corpus_name);
+		run_benchmark(Benchmark(name, 1, data.len, &tree, bench_json));
+		JSONBenchmark document = JSONBenchmark(data, true, backends[a]);
+		std::snprintf(name, sizeof(name), "json parse_document %s %s", backend_names[a], corpus_name);
+		run_benchmark(Benchmark(name, 1, data.len, &document, bench_json));
+	}
+}
+
+// WebSocket frames
+
+// Masked binary frames as a browser sends them, payload_len bytes each.
+ctk::gar<u8> make_frames(size_t payload_len, size_t count) {
+	ctk::gar<u8> out;
+	out.create_auto();
+	for (size_t a = 0; a < count; ++a) {
+		out.push(0x82);
+		if (payload_len > 65535) {
+			out.push(0x80 | 127);
+			for (size_t b = 0; b < 8; ++b) {
+				out.push((payload_len >> ((7 - b) * 8)) & 0xff);
+			}
+		} else if (payload_len > 125) {
+			out.push(0x80 | 126);
+			out.push((payload_len >> 8) & 0xff);
+			out.push(payload_len & 0xff);
+		} else {
+			out.push(0x80 | payload_len);
+		}
+		u8 masking_key[4] = {0x12, 0x34, (u8)a, 0x78};
+		out.push_many(masking_key, 4);
+		for (size_t b = 0; b < payload_len; ++b) {
+			out.push((u8)(b * 31 + a) ^ masking_key[b & 3]);
+		}
+	}
+	return out;
+}
+
+struct FrameBenchmark {
+	ctk::ar<const u8> frames;
+	size_t payload_len;
+	size_t count;
+	SocketServer::Client client;
+	WebsocketClient websocket;
+};
+
+u64 bench_frames(void* user) {
+	FrameBenchmark* benchmark = (FrameBenchmark*)user;
+	// handle_frame unmasks in place, so every run starts from a fresh copy
+	benchmark->client.buffer.len = 0;
+	benchmark->client.buffer.push_many(benchmark->frames.buf, benchmark->frames.len);
+	size_t payload_bytes = 0;
+	u64 start_ns = now_ns();
+	while (benchmark->client.buffer.len > 0) {
+		if (benchmark->websocket.handle_frame() == SocketServer::Client::Result::Fail) {
+			WTK_PANIC("WebsocketClient::handle_frame failed");
+		}
+		if (benchmark->websocket.consume_payload()) {
+			payload_bytes += benchmark->websocket.payload_buffer.len;
+			benchmark->websocket.payload_buffer.len = 0;
+		}
+	}
+	u64 elapsed_ns = now_ns() - start_ns;
+	if (payload_bytes != benchmark->count * benchmark->payload_len) {
+		WTK_PANIC("WebsocketClient::handle_frame lost payload bytes");
+	}
+	return elapsed_ns;
+}
+
+void run_frame_benchmark(size_t payload_len) {
+	// about what a burst of reads leaves in the buffer, handle_frame moves the rest down per frame
+	size_t count = std::max<size_t>(1, (64 * 1024) / (payload_len + 14));
+	ctk::gar<u8> frames = make_frames(payload_len, count);
+	FrameBenchmark* benchmark = (FrameBenchmark*)std::calloc(1, sizeof(FrameBenchmark));
+	benchmark->frames = ctk::ar<const u8>(frames.buf, frames.len);
+	benchmark->payload_len = payload_len;
+	benchmark->count = count;
+	benchmark->client.buffer.create_auto();
+	benchmark->client.has_buffer = true;
+	benchmark->client.socket_fd = -1;
+	benchmark->client.ssl = nullptr;
+	benchmark->websocket.create();
+	benchmark->websocket.client = &benchmark->client;
+	benchmark->websocket.payload_buffer.create_auto();
+	char name[64];
+	std::snprintf(name, sizeof(name), "websocket handle_frame %zu B", payload_len);
+	run_benchmark(Benchmark(name, count, frames.len, benchmark, bench_frames));
+	// not from a server's pool, so no release
+	benchmark->websocket.payload_buffer.destroy();
+	benchmark->client.buffer.destroy();
+	std::free(benchmark);
+	frames.destroy();
+}
+
+// HTTP responses
+
+ctk::gar<u8> make_response_head(const char* framing) {
+	ctk::gar<u8> out;
+	out.create_auto();
+	push_format(&out, "HTTP/1.1 200 OK\r\nDate: Mon, 01 Jan 2024 00:00:00 GMT\r\nServer: bench\r\nContent-Type: application/json; charset=utf-8\r\nCache-Control: no-cache, no-store\r\nX-Request-Id: 5f2b8c1e-3d4a-4b6f-9e7d-1a2b3c4d5e6f\r\nVary: Accept-Encoding\r\n%s\r\n", framing);
+	return out;
+}
+
+ctk::gar<u8> make_body(size_t len) {
+	ctk::gar<u8> body = make_api_corpus(len / 250 + 1);
+	body.len = std::min(body.len, len);
+	return body;
+}
+
+ctk::ar<u8> gzip(ctk::ar<const u8> data) {
+	z_stream stream = z_stream();
+	if (::deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		WTK_PANIC("::deflateInit2 failed");
+	}
+	size_t bound = ::deflateBound(&stream, data.len);
+	ctk::ar<u8> out = ctk::ar<u8>((u8*)std::malloc(bound), bound);
+	stream.next_in = (Bytef*)data.buf;
+	stream.avail_in = data.len;
+	stream.next_out = out.buf;
+	stream.avail_out = bound;
+	if (::deflate(&stream, Z_FINISH) != Z_STREAM_END) {
+		WTK_PANIC("::deflate failed");
+	}
+	out.len = stream.total_out;
+	::deflateEnd(&stream);
+	return out;
+}
+
+ctk::gar<u8> make_length_response(size_t body_len) {
+	ctk::gar<u8> body = make_body(body_len);
+	char framing[64];
+	std::snprintf(framing, sizeof(framing), "Content-Length: %zu\r\n", body.len);
+	ctk::gar<u8> out = make_response_head(framing);
+	out.push_many(body.buf, body.len);
+	body.destroy();
+	return out;
+}
+
+ctk::gar<u8> make_chunked(ctk::gar<u8> out, ctk::ar<const u8> body, size_t chunk_len) {
+	for (size_t offset = 0; offset < body.len; offset += chunk_len) {
+		size_t len = std::min(chunk_len, body.len - offset);
+		push_format(&out, "%zx\r\n", len);
+		out.push_many(&body.buf[offset], len);
+		push_format(&out, "\r\n");
+	}
+	push_format(&out, "0\r\n\r\n");
+	return out;
+}
+
+ctk::gar<u8> make_chunked_response(size_t body_len, size_t chunk_len) {
+	ctk::gar<u8> body = make_body(body_len);
+	ctk::gar<u8> out = make_chunked(make_response_head("Transfer-Encoding: chunked\r\n"), ctk::ar<const u8>(body.buf, body.len), chunk_len);
+	body.destroy();
+	return out;
+}
+
+ctk::gar<u8> make_gzip_response(size_t body_len, size_t chunk_len) {
+	ctk::gar<u8> body = make_body(body_len);
+	ctk::ar<u8> compressed = gzip(ctk::ar<const u8>(body.buf, body.len));
+	ctk::gar<u8> out = make_chunked(make_response_head("Transfer-Encoding: chunked\r\nContent-Encoding: gzip\r\n"), ctk::ar<const u8>(compressed.buf, compressed.len), chunk_len);
+	body.destroy();
+	compressed.destroy();
+	return out;
+}
+
+struct ResponseBenchmark {
+	ctk::ar<const u8> response;
+	// the decoded body length try_recv has to end up with
+	size_t body_len;
+	bool decode;
+};
+
+// Each run writes the response into a fresh socketpair and times try_recv reading it back.
+u64 bench_response(void* user) {
+	ResponseBenchmark* benchmark = (ResponseBenchmark*)user;
+	int fds[2];
+	if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+		WTK_PANIC("::socketpair failed");
+	}
+	int buffer_size = benchmark->response.len + 4096;
+	::setsockopt(fds[1], SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+	::setsockopt(fds[0], SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+	if (::write(fds[1], benchmark->response.buf, benchmark->response.len) != (ssize_t)benchmark->response.len) {
+		WTK_PANIC("::write failed, the response is bigger than the socket buffer");
+	}
+	::shutdown(fds[1], SHUT_WR);
+	HTTP::Request request;
+	request.data = ctk::ar<u8>();
+	request.create(false);
+	request.socket_fd = fds[0];
+	request.max_decoded_len = benchmark->decode ? SIZE_MAX : 0;
+	u64 start_ns = now_ns();
+	while (request.try_recv(-1) == HTTP::Request::RecvResult::None) {
+	}
+	u64 elapsed_ns = now_ns() - start_ns;
+	if (request.has_response() == false || request.body.data.len != benchmark->body_len) {
+		WTK_PANIC("HTTP::Request::try_recv got a wrong body");
+	}
+	request.destroy_response();
+	request.destroy(-1);
+	::close(fds[1]);
+	return elapsed_ns;
+}
+
+void run_response_benchmark(const char* name, ctk::gar<u8> response, size_t body_len, bool decode) {
+	ResponseBenchmark benchmark = ResponseBenchmark(ctk::ar<const u8>(response.buf, response.len), body_len, decode);
+	run_benchmark(Benchmark(name, 1, response.len, &benchmark, bench_response));
+	response.destroy();
+}
+
+size_t get_body_len(size_t len) {
+	ctk::gar<u8> body = make_body(len);
+	size_t body_len = body.len;
+	body.destroy();
+	return body_len;
+}
+
+int main(int argc, char** argv) {
+	wtk::init();
+	std::printf("%-48s %15s %15s\n", "benchmark", "rate", "throughput");
+
+	ctk::gar<u8> api = make_api_corpus(2000);
+	run_json_benchmarks("api", ctk::ar<const u8>(api.buf, api.len));
+	api.destroy();
+	ctk::gar<u8> numbers = make_numbers_corpus(50000);
+	run_json_benchmarks("numbers", ctk::ar<const u8>(numbers.buf, numbers.len));
+	numbers.destroy();
+	ctk::gar<u8> escaped = make_escaped_corpus(5000);
+	run_json_benchmarks("escaped strings", ctk::ar<const u8>(escaped.buf, escaped.len));
+	escaped.destroy();
+	ctk::gar<u8> nested = make_nested_corpus(2000, 64);
+	run_json_benchmarks("nested 64", ctk::ar<const u8>(nested.buf, nested.len));
+	nested.destroy();
+	// just under default_max_depth
+	ctk::gar<u8> deep = make_nested_corpus(100, JSON::default_max_depth - 8);
+	run_json_benchmarks("nested 1016", ctk::ar<const u8>(deep.buf, deep.len));
+	deep.destroy();
+	ctk::gar<u8> empty = make_empty_containers_corpus(100000);
+	run_json_benchmarks("empty containers", ctk::ar<const u8>(empty.buf, empty.len));
+	empty.destroy();
+	for (int a = 1; a < argc; ++a) {
+		ctk::ar<u8> data = read_file(argv[a]);
+		if (data.len == 0) {
+			WTK_LOG("can't read %s", argv[a]);
+			continue;
+		}
+		run_json_benchmarks(argv[a], ctk::ar<const u8>(data.buf, data.len));
+		data.destroy();
+	}
+
+	for (size_t payload_len : {16, 125, 1024, 16 * 1024, 60 * 1024}) {
+		run_frame_benchmark(payload_len);
+	}
+
+	run_response_benchmark("http try_recv length 1 KiB", make_length_response(1024), get_body_len(1024), false);
+	run_response_benchmark("http try_recv length 64 KiB", make_length_response(64 * 1024), get_body_len(64 * 1024), false);
+	run_response_benchmark("http try_recv chunked 96 KiB / 4 KiB", make_chunked_response(96 * 1024, 4096), get_body_len(96 * 1024), false);
+	run_response_benchmark("http try_recv chunked gzip 96 KiB", make_gzip_response(96 * 1024, 4096), get_body_len(96 * 1024), true);
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+// Timing and reporting shared by bench and load.
+
+u64 now_ns() {
+	struct timespec time;
+	::clock_gettime(CLOCK_MONOTONIC, &time);
+	return (u64)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+// Every sample is kept and sorted for the report, runs are short enough for that.
+struct Latencies {
+	ctk::gar<u64> samples_ns;
+
+	void create(this auto& self) {
+		self.samples_ns.create_auto();
+	}
+
+	void destroy(this auto& self) {
+		self.samples_ns.destroy();
+	}
+
+	void push(this auto& self, u64 sample_ns) {
+		self.samples_ns.push(sample_ns);
+	}
+
+	void push_many(this auto& self, const Latencies& other) {
+		self.samples_ns.push_many(other.samples_ns.buf, other.samples_ns.len);
+	}
+
+	// Sorts, so call it once all samples are in.
+	u64 get_quantile(this auto& self, double quantile) {
+		if (self.samples_ns.len == 0) {
+			return 0;
+		}
+		std::sort(self.samples_ns.buf, self.samples_ns.buf + self.samples_ns.len);
+		size_t index = (size_t)(quantile * (double)(self.samples_ns.len - 1) + 0.5);
+		return self.samples_ns[index];
+	}
+
+	// ops is the count behind the rate, bytes may be 0 for no throughput column.
+	void report(this auto& self, const char* name, u64 elapsed_ns, size_t ops, size_t bytes) {
+		double seconds = (double)elapsed_ns / 1e9;
+		std::printf("%-48s %12.0f op/s", name, (double)ops / seconds);
+		if (bytes > 0) {
+			std::printf(" %10.1f MB/s", (double)bytes / seconds / 1e6);
+		} else {
+			std::printf(" %15s", "");
+		}
+		std::printf("   p50 %9.2f us   p99 %9.2f us   p999 %9.2f us\n", (double)self.get_quantile(0.5) / 1e3, (double)self.get_quantile(0.99) / 1e3, (double)self.get_quantile(0.999) / 1e3);
+		std::fflush(stdout);
+	}
+};
+
+ctk::ar<u8> read_file(const char* path) {
+	FILE* file = std::fopen(path, "rb");
+	if (file == nullptr) {
+		return ctk::ar<u8>();
+	}
+	std::fseek(file, 0, SEEK_END);
+	long len = std::ftell(file);
+	std::fseek(file, 0, SEEK_SET);
+	u8* buf = (u8*)std::malloc(len);
+	if (std::fread(buf, 1, len, file) != (size_t)len) {
+		len = 0;
+	}
+	std::fclose(file);
+	return ctk::ar<u8>(buf, len);
+}
\ No newline at end of file
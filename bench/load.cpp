@@ -0,0 +1,447 @@
+// Loopback load generator. Starts a SocketServer in this process and drives it, reporting
+// throughput and p50/p99/p999 latency:
+//   websocket  clients keep one message in flight each through OutboundWebsocket, the server echoes
+//   http       HTTP clients keep requests in flight against a server that answers with size bytes
+//   accept     threads connect, wait for the server's first byte and close, a reconnect storm
+// load <websocket|http|accept> [-c clients] [-t threads] [-d seconds] [-s size] [-p port] [--tls cert.pem key.pem]
+
+#include <csignal>
+
+#include "../mod.cpp"
+
+using namespace wtk;
+
+#include "common.cpp"
+
+struct Config {
+	enum class Mode {
+		Websocket,
+		HTTP,
+		Accept,
+	};
+
+	Mode mode;
+	size_t clients;
+	size_t threads;
+	u64 duration_ns;
+	size_t size;
+	u16 port;
+	const char* cert_path;
+	const char* key_path;
+
+	bool use_tls(this const auto& self) {
+		return self.cert_path != nullptr;
+	}
+};
+
+Config config;
+// what the http server answers with
+ctk::gar<u8> http_response;
+
+// Server side
+
+constexpr int poll_timeout_ms = 100;
+constexpr size_t max_request_len = 16 * 1024;
+
+void wait_readable(SocketServer::Client* client) {
+	if (client->ssl != nullptr && ::SSL_pending(client->ssl) > 0) {
+		return;
+	}
+	struct pollfd pfd = {
+		.fd = client->socket_fd,
+		.events = POLLIN,
+	};
+	::poll(&pfd, 1, poll_timeout_ms);
+}
+
+size_t get_header_end(const ctk::gar<u8>& buffer) {
+	for (size_t a = 3; a < buffer.len; ++a) {
+		if (buffer[a - 3] == '\r' && buffer[a - 2] == '\n' && buffer[a - 1] == '\r' && buffer[a] == '\n') {
+			return a + 1;
+		}
+	}
+	return 0;
+}
+
+// Reads until the request head is in, returns its length or 0 when the client went away.
+size_t read_request_head(SocketServer::Client* client) {
+	while (true) {
+		if (client->read() == SocketServer::Client::Result::Fail || client->buffer.len > max_request_len) {
+			return 0;
+		}
+		size_t header_end = get_header_end(client->buffer);
+		if (header_end != 0) {
+			return header_end;
+		}
+		wait_readable(client);
+	}
+}
+
+void websocket_echo_thread(SocketServer::Client* client) {
+	size_t header_end = read_request_head(client);
+	WebsocketClient websocket;
+	websocket.create();
+	if (header_end != 0) {
+		websocket.http_upgrade(client, 0);
+	}
+	// a failed upgrade leaves the client with us, a failed reply shows up as a failed read below
+	if (websocket.is_valid() == false) {
+		client->release();
+		websocket.destroy();
+		return;
+	}
+	client->buffer.remove_many(0, header_end);
+	while (client->read() == SocketServer::Client::Result::Ok) {
+		size_t len_before = SIZE_MAX;
+		while (client->buffer.len > 0 && client->buffer.len != len_before) {
+			len_before = client->buffer.len;
+			if (websocket.handle_frame() == SocketServer::Client::Result::Fail) {
+				websocket.destroy();
+				return;
+			}
+			if (websocket.consume_payload()) {
+				websocket.send(ctk::ar<const u8>(websocket.payload_buffer.buf, websocket.payload_buffer.len));
+				websocket.payload_buffer.len = 0;
+			}
+		}
+		wait_readable(client);
+	}
+	websocket.destroy();
+}
+
+void http_thread(SocketServer::Client* client) {
+	if (read_request_head(client) != 0) {
+		client->send(ctk::ar<const u8>(http_response.buf, http_response.len));
+	}
+	client->release();
+}
+
+void accept_thread(SocketServer::Client* client) {
+	client->send(ctk::ar<const u8>((const u8*)"x", 1));
+	// the peer closes first, so the TIME_WAIT sockets end up on the load side
+	wait_readable(client);
+	client->read();
+	client->release();
+}
+
+// Load side
+
+struct LoadThread {
+	size_t index;
+	size_t clients;
+	u64 end_ns;
+	Latencies latencies;
+	size_t ops;
+	size_t bytes;
+	size_t failures;
+	bool done;
+	ctk::Thread thread;
+};
+
+struct WebsocketLoad {
+	OutboundWebsocket* websocket;
+	u64 sent_ns;
+	bool waiting;
+};
+
+WebsocketLoad* find_websocket(ctk::gar<WebsocketLoad>& loads, OutboundWebsocket* websocket) {
+	size_t low = 0;
+	size_t high = loads.len;
+	while (low < high) {
+		size_t middle = (low + high) / 2;
+		if (loads[middle].websocket < websocket) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	return low < loads.len && loads[low].websocket == websocket ? &loads[low] : nullptr;
+}
+
+void websocket_load_thread(LoadThread* load) {
+	Addr addr = Addr::resolve("127.0.0.1", config.port);
+	ctk::gar<u8> payload;
+	payload.create_auto();
+	for (size_t a = 0; a < config.size; ++a) {
+		payload.push((u8)a);
+	}
+	SocketClient::Loop loop;
+	loop.create();
+	ctk::gar<WebsocketLoad> loads;
+	loads.create_auto();
+	for (size_t a = 0; a < load->clients; ++a) {
+		OutboundWebsocket* websocket = OutboundWebsocket::make(&loop, addr, config.use_tls(), "/");
+		if (websocket == nullptr) {
+			load->failures += 1;
+			continue;
+		}
+		loads.push(WebsocketLoad(websocket, 0, false));
+	}
+	std::sort(loads.buf, loads.buf + loads.len, [](const WebsocketLoad& a, const WebsocketLoad& b) {
+		return a.websocket < b.websocket;
+	});
+	size_t open_count = loads.len;
+	size_t waiting_count = 0;
+	while (open_count > 0 && (now_ns() < load->end_ns || waiting_count > 0)) {
+		loop.update(poll_timeout_ms);
+		SocketClient::Event event;
+		while (loop.try_pop_event(&event)) {
+			WebsocketLoad* websocket_load = find_websocket(loads, (OutboundWebsocket*)event.client->user);
+			OutboundWebsocket* websocket = websocket_load->websocket;
+			if (websocket->state == OutboundWebsocket::State::Closed) {
+				continue;
+			}
+			if (websocket->handle_event(event.type) == SocketClient::Result::Fail) {
+				load->failures += 1;
+				open_count -= 1;
+				waiting_count -= websocket_load->waiting ? 1 : 0;
+				websocket->state = OutboundWebsocket::State::Closed;
+				continue;
+			}
+			if (websocket->consume_payload()) {
+				u64 now = now_ns();
+				load->latencies.push(now - websocket_load->sent_ns);
+				load->ops += 1;
+				load->bytes += websocket->payload_buffer.len;
+				websocket->payload_buffer.len = 0;
+				websocket_load->waiting = false;
+				waiting_count -= 1;
+			}
+			if (websocket->state == OutboundWebsocket::State::Open && websocket_load->waiting == false && now_ns() < load->end_ns) {
+				websocket_load->sent_ns = now_ns();
+				websocket_load->waiting = true;
+				waiting_count += 1;
+				websocket->send(ctk::ar<const u8>(payload.buf, payload.len));
+			}
+		}
+	}
+	for (size_t a = 0; a < loads.len; ++a) {
+		loads[a].websocket->destroy();
+		std::free(loads[a].websocket);
+	}
+	loads.destroy();
+	loop.destroy();
+	payload.destroy();
+	std::atomic_ref<bool>(load->done).store(true, std::memory_order_release);
+}
+
+void http_load_thread(LoadThread* load) {
+	Addr addr = Addr::resolve("127.0.0.1", config.port);
+	HTTP http;
+	http.create();
+	// indexed by request id, ids count up from 1
+	ctk::gar<u64> start_ns;
+	start_ns.create_auto();
+	start_ns.push(0);
+	size_t in_flight = 0;
+	auto push = [&]() {
+		HTTP::Request request;
+		request.create_get(&addr, config.use_tls(), "/");
+		u64 now = now_ns();
+		size_t id = http.push_request(request);
+		if (id == 0) {
+			load->failures += 1;
+			return;
+		}
+		while (start_ns.len <= id) {
+			start_ns.push(0);
+		}
+		start_ns[id] = now;
+		in_flight += 1;
+	};
+	for (size_t a = 0; a < load->clients; ++a) {
+		push();
+	}
+	while (in_flight > 0) {
+		http.update(1);
+		size_t finished = 0;
+		HTTP::Response response;
+		while (http.try_pop_response(&response)) {
+			load->latencies.push(now_ns() - start_ns[response.id]);
+			load->ops += 1;
+			load->bytes += response.body.data.len;
+			response.destroy();
+			finished += 1;
+		}
+		size_t id;
+		while (http.try_pop_failure(&id)) {
+			load->failures += 1;
+			finished += 1;
+		}
+		in_flight -= finished;
+		for (size_t a = 0; a < finished && now_ns() < load->end_ns; ++a) {
+			push();
+		}
+	}
+	start_ns.destroy();
+	http.destroy();
+	std::atomic_ref<bool>(load->done).store(true, std::memory_order_release);
+}
+
+void accept_load_thread(LoadThread* load) {
+	SSL_CTX* ssl_ctx = config.use_tls() ? ::SSL_CTX_new(::TLS_client_method()) : nullptr;
+	struct sockaddr_in server_addr = {};
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_port = ::htons(config.port);
+	server_addr.sin_addr.s_addr = ::htonl(INADDR_LOOPBACK);
+	while (now_ns() < load->end_ns) {
+		u64 start = now_ns();
+		int socket_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+		bool ok = ::connect(socket_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) == 0;
+		SSL* ssl = nullptr;
+		if (ok && ssl_ctx != nullptr) {
+			ssl = ::SSL_new(ssl_ctx);
+			::SSL_set_fd(ssl, socket_fd);
+			ok = ::SSL_connect(ssl) == 1;
+		}
+		u8 byte;
+		if (ok) {
+			ok = (ssl != nullptr ? ::SSL_read(ssl, &byte, 1) : ::recv(socket_fd, &byte, 1, 0)) == 1;
+		}
+		if (ok) {
+			load->latencies.push(now_ns() - start);
+			load->ops += 1;
+		} else {
+			load->failures += 1;
+		}
+		if (ssl != nullptr) {
+			::SSL_free(ssl);
+		}
+		::close(socket_fd);
+	}
+	if (ssl_ctx != nullptr) {
+		::SSL_CTX_free(ssl_ctx);
+	}
+	std::atomic_ref<bool>(load->done).store(true, std::memory_order_release);
+}
+
+bool parse_args(int argc, char** argv) {
+	if (argc < 2) {
+		return false;
+	}
+	config = Config(Config::Mode::Websocket, 100, 4, 10000000000, 64, 39080, nullptr, nullptr);
+	if (std::strcmp(argv[1], "websocket") == 0) {
+		config.mode = Config::Mode::Websocket;
+	} else if (std::strcmp(argv[1], "http") == 0) {
+		config.mode = Config::Mode::HTTP;
+		config.size = 1024;
+	} else if (std::strcmp(argv[1], "accept") == 0) {
+		config.mode = Config::Mode::Accept;
+		config.clients = config.threads;
+	} else {
+		return false;
+	}
+	for (int a = 2; a < argc; ++a) {
+		bool has_value = a + 1 < argc;
+		if (std::strcmp(argv[a], "--tls") == 0 && a + 2 < argc) {
+			config.cert_path = argv[a + 1];
+			config.key_path = argv[a + 2];
+			a += 2;
+			continue;
+		}
+		if (has_value == false) {
+			return false;
+		}
+		u64 value = std::strtoull(argv[a + 1], nullptr, 10);
+		if (std::strcmp(argv[a], "-c") == 0) {
+			config.clients = value;
+		} else if (std::strcmp(argv[a], "-t") == 0) {
+			config.threads = value;
+		} else if (std::strcmp(argv[a], "-d") == 0) {
+			config.duration_ns = value * 1000000000;
+		} else if (std::strcmp(argv[a], "-s") == 0) {
+			config.size = value;
+		} else if (std::strcmp(argv[a], "-p") == 0) {
+			config.port = value;
+		} else {
+			return false;
+		}
+		a += 1;
+	}
+	if (config.mode == Config::Mode::Accept) {
+		config.threads = config.clients;
+	}
+	return config.clients > 0 && config.threads > 0 && config.size <= 65535;
+}
+
+int main(int argc, char** argv) {
+	if (parse_args(argc, argv) == false) {
+		std::fprintf(stderr, "load <websocket|http|accept> [-c clients] [-t threads] [-d seconds] [-s size] [-p port] [--tls cert.pem key.pem]\n");
+		return 1;
+	}
+	wtk::init();
+	::signal(SIGPIPE, SIG_IGN);
+
+	SocketServer::TLS tls;
+	if (config.use_tls()) {
+		tls.cert = read_file(config.cert_path);
+		tls.key = read_file(config.key_path);
+		if (tls.cert.len == 0 || tls.key.len == 0) {
+			WTK_LOG("can't read %s or %s", config.cert_path, config.key_path);
+			return 1;
+		}
+	}
+	void (*client_thread_func)(SocketServer::Client*) = websocket_echo_thread;
+	void (*load_thread_func)(LoadThread*) = websocket_load_thread;
+	if (config.mode == Config::Mode::HTTP) {
+		http_response.create_auto();
+		char head[128];
+		int head_len = std::snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", config.size);
+		http_response.push_many((const u8*)head, head_len);
+		for (size_t a = 0; a < config.size; ++a) {
+			http_response.push('a' + a % 26);
+		}
+		client_thread_func = http_thread;
+		load_thread_func = http_load_thread;
+	} else if (config.mode == Config::Mode::Accept) {
+		client_thread_func = accept_thread;
+		load_thread_func = accept_load_thread;
+	}
+	SocketServer* server = SocketServer::make(false, Addr::make_ipv6(in6addr_any, config.port), config.use_tls() ? &tls : nullptr, client_thread_func, nullptr, false);
+	if (server == nullptr) {
+		return 1;
+	}
+
+	LoadThread* loads = (LoadThread*)std::calloc(config.threads, sizeof(LoadThread));
+	u64 start = now_ns();
+	for (size_t a = 0; a < config.threads; ++a) {
+		LoadThread* load = &loads[a];
+		load->index = a;
+		load->clients = config.clients / config.threads + (a < config.clients % config.threads ? 1 : 0);
+		load->end_ns = start + config.duration_ns;
+		load->latencies.create();
+		load->thread.create<LoadThread>(load_thread_func, load);
+		if (load->thread.exists == false) {
+			WTK_PANIC("ctk::Thread::create failed");
+		}
+	}
+	Latencies latencies;
+	latencies.create();
+	size_t ops = 0;
+	size_t bytes = 0;
+	size_t failures = 0;
+	for (size_t a = 0; a < config.threads; ++a) {
+		while (std::atomic_ref<bool>(loads[a].done).load(std::memory_order_acquire) == false) {
+			::usleep(1000);
+		}
+		latencies.push_many(loads[a].latencies);
+		loads[a].latencies.destroy();
+		ops += loads[a].ops;
+		bytes += loads[a].bytes;
+		failures += loads[a].failures;
+	}
+	u64 elapsed_ns = now_ns() - start;
+
+	const char* mode_names[] = {"websocket", "http", "accept"};
+	char name[64];
+	std::snprintf(name, sizeof(name), "%s%s c=%zu t=%zu s=%zu", mode_names[(size_t)config.mode], config.use_tls() ? " tls" : "", config.clients, config.threads, config.size);
+	latencies.report(name, elapsed_ns, ops, bytes);
+	if (failures > 0) {
+		std::printf("%zu failures\n", failures);
+	}
+	latencies.destroy();
+	std::free(loads);
+	http_response.destroy();
+	// SocketServer has no destroy, its threads end with the process
+	return failures > 0 && ops == 0 ? 1 : 0;
+}
\ No newline at end of file
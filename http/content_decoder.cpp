@@ -0,0 +1,189 @@
+// Streaming decoder for compressed response bodies (Content-Encoding gzip, deflate and br). Input is
+// fed as it arrives, output goes to the sink as soon as it is produced, so decoding overlaps with
+// the transfer and the compressed body is never buffered. Output is capped at max_output_len.
+struct ContentDecoder {
+	enum class Encoding {
+		Gzip,
+		// zlib wrapped as the spec says, raw deflate as some servers send it is detected too
+		Deflate,
+		Brotli,
+	};
+
+	enum class Result {
+		Fail,
+		Ok,
+	};
+
+	struct Sink {
+		void* user;
+		void (*func)(void* user, ctk::ar<const u8> chunk);
+	};
+
+	constexpr static size_t output_buffer_size = 64 * 1024;
+
+	Encoding encoding;
+	z_stream zlib;
+#ifdef WTK_BROTLI
+	BrotliDecoderState* brotli;
+#endif
+	size_t max_output_len;
+	size_t output_len;
+	size_t input_len;
+	// the end of the compressed stream was reached, anything after it is ignored
+	bool finished;
+
+	// What we send in Accept-Encoding.
+	constexpr static const char* get_accept_encoding() {
+#ifdef WTK_BROTLI
+		return "gzip, deflate, br";
+#else
+		return "gzip, deflate";
+#endif
+	}
+
+	// Returns false for encodings it can't decode (and for identity), the body is left alone then.
+	static bool parse_encoding(ctk::ar<const u8> header, Encoding* out_encoding) {
+		while (header.len > 0 && (header[header.len - 1] == ' ' || header[header.len - 1] == '\r')) {
+			header.len -= 1;
+		}
+		auto is = [&](const char* name) {
+			return header.len == std::strlen(name) && ctk::astr_nocase_cmp(header.buf, name, header.len);
+		};
+		if (is("gzip") || is("x-gzip")) {
+			*out_encoding = Encoding::Gzip;
+			return true;
+		}
+		if (is("deflate")) {
+			*out_encoding = Encoding::Deflate;
+			return true;
+		}
+#ifdef WTK_BROTLI
+		if (is("br")) {
+			*out_encoding = Encoding::Brotli;
+			return true;
+		}
+#endif
+		return false;
+	}
+
+	static ContentDecoder* make(Encoding encoding, size_t max_output_len) {
+		ContentDecoder* decoder = ctk::alloc<ContentDecoder>(ContentDecoder());
+		decoder->encoding = encoding;
+		decoder->max_output_len = max_output_len;
+		decoder->output_len = 0;
+		decoder->input_len = 0;
+		decoder->finished = false;
+#ifdef WTK_BROTLI
+		decoder->brotli = nullptr;
+		if (encoding == Encoding::Brotli) {
+			decoder->brotli = ::BrotliDecoderCreateInstance(nullptr, nullptr, nullptr);
+			if (decoder->brotli == nullptr) {
+				WTK_PANIC("::BrotliDecoderCreateInstance failed");
+			}
+			return decoder;
+		}
+#endif
+		decoder->init_zlib(encoding == Encoding::Gzip ? 16 + MAX_WBITS : MAX_WBITS);
+		return decoder;
+	}
+
+	void init_zlib(this auto& self, int window_bits) {
+		self.zlib = z_stream();
+		if (::inflateInit2(&self.zlib, window_bits) != Z_OK) {
+			WTK_PANIC("::inflateInit2 failed");
+		}
+	}
+
+	void destroy(this auto& self) {
+#ifdef WTK_BROTLI
+		if (self.encoding == Encoding::Brotli) {
+			::BrotliDecoderDestroyInstance(self.brotli);
+			return;
+		}
+#endif
+		::inflateEnd(&self.zlib);
+	}
+
+	Result emit(this auto& self, const u8* buf, size_t len, Sink sink) {
+		if (len == 0) {
+			return Result::Ok;
+		}
+		if (self.output_len + len > self.max_output_len) {
+			WTK_LOG("decoded body is over %zu bytes", self.max_output_len);
+			return Result::Fail;
+		}
+		self.output_len += len;
+		sink.func(sink.user, ctk::ar<const u8>(buf, len));
+		return Result::Ok;
+	}
+
+	// Fails on corrupt input or when the output would pass max_output_len.
+	Result feed(this auto& self, ctk::ar<const u8> input, Sink sink) {
+		if (self.finished || input.len == 0) {
+			return Result::Ok;
+		}
+		bool is_first_input = self.input_len == 0;
+		self.input_len += input.len;
+		u8 output[output_buffer_size];
+#ifdef WTK_BROTLI
+		if (self.encoding == Encoding::Brotli) {
+			size_t available_in = input.len;
+			const u8* next_in = input.buf;
+			while (true) {
+				size_t available_out = output_buffer_size;
+				u8* next_out = output;
+				BrotliDecoderResult result = ::BrotliDecoderDecompressStream(self.brotli, &available_in, &next_in, &available_out, &next_out, nullptr);
+				if (result == BROTLI_DECODER_RESULT_ERROR) {
+					WTK_LOG("brotli body is corrupt (%s)", ::BrotliDecoderErrorString(::BrotliDecoderGetErrorCode(self.brotli)));
+					return Result::Fail;
+				}
+				if (self.emit(output, output_buffer_size - available_out, sink) == Result::Fail) {
+					return Result::Fail;
+				}
+				if (result == BROTLI_DECODER_RESULT_SUCCESS) {
+					self.finished = true;
+					return Result::Ok;
+				}
+				if (result == BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT) {
+					return Result::Ok;
+				}
+			}
+		}
+#endif
+		self.zlib.next_in = (Bytef*)input.buf;
+		self.zlib.avail_in = input.len;
+		while (true) {
+			self.zlib.next_out = output;
+			self.zlib.avail_out = output_buffer_size;
+			int ret = ::inflate(&self.zlib, Z_NO_FLUSH);
+			if (ret == Z_DATA_ERROR && self.encoding == Encoding::Deflate && is_first_input && self.zlib.total_out == 0) {
+				// not zlib wrapped, start over as raw deflate
+				::inflateEnd(&self.zlib);
+				self.init_zlib(-MAX_WBITS);
+				self.zlib.next_in = (Bytef*)input.buf;
+				self.zlib.avail_in = input.len;
+				is_first_input = false;
+				continue;
+			}
+			if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+				WTK_LOG("compressed body is corrupt (%i)", ret);
+				return Result::Fail;
+			}
+			size_t output_len = output_buffer_size - self.zlib.avail_out;
+			if (self.emit(output, output_len, sink) == Result::Fail) {
+				return Result::Fail;
+			}
+			if (ret == Z_STREAM_END) {
+				self.finished = true;
+				return Result::Ok;
+			}
+			// more output is pending only when the output buffer was filled up
+			if (self.zlib.avail_in == 0 && self.zlib.avail_out != 0) {
+				return Result::Ok;
+			}
+			if (ret == Z_BUF_ERROR && output_len == 0) {
+				return Result::Ok;
+			}
+		}
+	}
+};
\ No newline at end of file
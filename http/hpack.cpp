@@ -0,0 +1,472 @@
+// HPACK header compression for HTTP/2 (RFC 7541). The Decoder keeps the dynamic table that the
+// peer's encoder fills. Encoding is stateless: fields refer to the static table at most and are
+// never indexed, so there is no table on the peer's side to keep in sync.
+struct HPACK {
+	struct StaticEntry {
+		const char* name;
+		const char* value;
+	};
+
+	// RFC 7541 Appendix B
+	constexpr static u32 huffman_codes[256] = {
+		0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+		0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+		0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+		0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+		0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+		0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+		0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+		0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+		0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+		0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+		0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+		0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+		0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+		0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+		0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+		0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+		0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+		0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+		0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+		0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+		0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+		0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+		0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+		0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+		0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+		0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+		0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+		0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+		0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+		0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+		0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+		0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+	};
+	constexpr static u8 huffman_code_lens[256] = {
+		13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+		28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+		6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+		5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+		13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+		7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+		15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+		6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+		20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+		24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+		22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+		21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+		26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+		19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+		20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+		26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+	};
+	// the symbols sorted by code, codes of one length are consecutive (the code is canonical)
+	constexpr static u8 huffman_symbols[256] = {
+		48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37, 45, 46, 47, 51,
+		52, 53, 54, 55, 56, 57, 61, 65, 95, 98, 100, 102, 103, 104, 108, 109,
+		110, 112, 114, 117, 58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+		77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89, 106, 107, 113, 118,
+		119, 120, 121, 122, 38, 42, 44, 59, 88, 90, 33, 34, 40, 41, 63, 39,
+		43, 124, 35, 62, 0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+		195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161, 167, 172, 176, 177,
+		179, 209, 216, 217, 227, 229, 230, 129, 132, 133, 134, 136, 146, 154, 156, 160,
+		163, 164, 169, 170, 173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+		233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150, 151, 152, 155, 157,
+		158, 165, 166, 168, 174, 175, 180, 182, 183, 188, 191, 197, 231, 239, 9, 142,
+		144, 145, 148, 159, 171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+		200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211,
+		212, 214, 221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254,
+		2, 3, 4, 5, 6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+		21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220, 249, 10, 13, 22,
+	};
+	// by code length
+	constexpr static u32 huffman_first_code[31] = {
+		0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x14, 0x5c,
+		0xf8, 0x0, 0x3f8, 0x7fa, 0xffa, 0x1ff8, 0x3ffc, 0x7ffc,
+		0x0, 0x0, 0x0, 0x7fff0, 0xfffe6, 0x1fffdc, 0x3fffd2, 0x7fffd8,
+		0xffffea, 0x1ffffec, 0x3ffffe0, 0x7ffffde, 0xfffffe2, 0x0, 0x3ffffffc,
+	};
+	constexpr static u8 huffman_first_index[31] = {
+		0, 0, 0, 0, 0, 0, 10, 36, 68, 0, 74, 79, 82, 84, 90, 92,
+		0, 0, 0, 95, 98, 106, 119, 145, 174, 186, 190, 205, 224, 0, 253,
+	};
+	constexpr static u16 huffman_counts[31] = {
+		0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3,
+		0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 3,
+	};
+	// RFC 7541 Appendix A, index 1 is static_table[0]
+	constexpr static StaticEntry static_table[61] = {
+		StaticEntry(":authority", ""),
+		StaticEntry(":method", "GET"),
+		StaticEntry(":method", "POST"),
+		StaticEntry(":path", "/"),
+		StaticEntry(":path", "/index.html"),
+		StaticEntry(":scheme", "http"),
+		StaticEntry(":scheme", "https"),
+		StaticEntry(":status", "200"),
+		StaticEntry(":status", "204"),
+		StaticEntry(":status", "206"),
+		StaticEntry(":status", "304"),
+		StaticEntry(":status", "400"),
+		StaticEntry(":status", "404"),
+		StaticEntry(":status", "500"),
+		StaticEntry("accept-charset", ""),
+		StaticEntry("accept-encoding", "gzip, deflate"),
+		StaticEntry("accept-language", ""),
+		StaticEntry("accept-ranges", ""),
+		StaticEntry("accept", ""),
+		StaticEntry("access-control-allow-origin", ""),
+		StaticEntry("age", ""),
+		StaticEntry("allow", ""),
+		StaticEntry("authorization", ""),
+		StaticEntry("cache-control", ""),
+		StaticEntry("content-disposition", ""),
+		StaticEntry("content-encoding", ""),
+		StaticEntry("content-language", ""),
+		StaticEntry("content-length", ""),
+		StaticEntry("content-location", ""),
+		StaticEntry("content-range", ""),
+		StaticEntry("content-type", ""),
+		StaticEntry("cookie", ""),
+		StaticEntry("date", ""),
+		StaticEntry("etag", ""),
+		StaticEntry("expect", ""),
+		StaticEntry("expires", ""),
+		StaticEntry("from", ""),
+		StaticEntry("host", ""),
+		StaticEntry("if-match", ""),
+		StaticEntry("if-modified-since", ""),
+		StaticEntry("if-none-match", ""),
+		StaticEntry("if-range", ""),
+		StaticEntry("if-unmodified-since", ""),
+		StaticEntry("last-modified", ""),
+		StaticEntry("link", ""),
+		StaticEntry("location", ""),
+		StaticEntry("max-forwards", ""),
+		StaticEntry("proxy-authenticate", ""),
+		StaticEntry("proxy-authorization", ""),
+		StaticEntry("range", ""),
+		StaticEntry("referer", ""),
+		StaticEntry("refresh", ""),
+		StaticEntry("retry-after", ""),
+		StaticEntry("server", ""),
+		StaticEntry("set-cookie", ""),
+		StaticEntry("strict-transport-security", ""),
+		StaticEntry("transfer-encoding", ""),
+		StaticEntry("user-agent", ""),
+		StaticEntry("vary", ""),
+		StaticEntry("via", ""),
+		StaticEntry("www-authenticate", ""),
+	};
+
+	constexpr static size_t static_entry_count = 61;
+	// per-entry overhead counted against the dynamic table size
+	constexpr static size_t entry_overhead = 32;
+	constexpr static size_t default_table_size = 4096;
+
+	// prefix_bits of the first byte hold the start of the value, the bits above them are left alone.
+	static bool decode_integer(ctk::ar<const u8> block, size_t* offset, u8 prefix_bits, u64* out_value) {
+		if (*offset >= block.len) {
+			return false;
+		}
+		u64 mask = (1u << prefix_bits) - 1;
+		u64 value = block[*offset] & mask;
+		*offset += 1;
+		if (value < mask) {
+			*out_value = value;
+			return true;
+		}
+		for (size_t shift = 0; shift <= 56; shift += 7) {
+			if (*offset >= block.len) {
+				return false;
+			}
+			u8 byte = block[*offset];
+			*offset += 1;
+			value += (u64)(byte & 0x7f) << shift;
+			if ((byte & 0x80) == 0) {
+				*out_value = value;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static void encode_integer(ctk::gar<u8>* out, u8 first_byte, u8 prefix_bits, u64 value) {
+		u64 mask = (1u << prefix_bits) - 1;
+		if (value < mask) {
+			out->push(first_byte | (u8)value);
+			return;
+		}
+		out->push(first_byte | (u8)mask);
+		value -= mask;
+		while (value >= 0x80) {
+			out->push((u8)(value & 0x7f) | 0x80);
+			value >>= 7;
+		}
+		out->push((u8)value);
+	}
+
+	static bool huffman_decode(ctk::ar<const u8> string, ctk::gar<u8>* out) {
+		u64 bits = 0;
+		size_t bit_count = 0;
+		size_t offset = 0;
+		while (true) {
+			while (bit_count <= 56 && offset < string.len) {
+				bits = (bits << 8) | string[offset];
+				bit_count += 8;
+				offset += 1;
+			}
+			if (bit_count == 0) {
+				return true;
+			}
+			bool found = false;
+			for (size_t len = 5; len <= 30 && len <= bit_count; ++len) {
+				u32 code = (u32)((bits >> (bit_count - len)) & ((1ull << len) - 1));
+				if (code - huffman_first_code[len] < huffman_counts[len]) {
+					out->push(huffman_symbols[huffman_first_index[len] + code - huffman_first_code[len]]);
+					bit_count -= len;
+					found = true;
+					break;
+				}
+			}
+			if (found == false) {
+				// the rest has to be padding, under 8 bits of the EOS code (all ones)
+				u64 padding_mask = (1ull << bit_count) - 1;
+				return bit_count < 8 && offset == string.len && (bits & padding_mask) == padding_mask;
+			}
+		}
+	}
+
+	static size_t get_huffman_len(ctk::ar<const u8> string) {
+		size_t bit_count = 0;
+		for (size_t a = 0; a < string.len; ++a) {
+			bit_count += huffman_code_lens[string[a]];
+		}
+		return (bit_count + 7) / 8;
+	}
+
+	static void huffman_encode(ctk::ar<const u8> string, ctk::gar<u8>* out) {
+		u64 bits = 0;
+		size_t bit_count = 0;
+		for (size_t a = 0; a < string.len; ++a) {
+			bits = (bits << huffman_code_lens[string[a]]) | huffman_codes[string[a]];
+			bit_count += huffman_code_lens[string[a]];
+			while (bit_count >= 8) {
+				bit_count -= 8;
+				out->push((u8)(bits >> bit_count));
+			}
+		}
+		if (bit_count > 0) {
+			out->push((u8)((bits << (8 - bit_count)) | (0xff >> bit_count)));
+		}
+	}
+
+	static bool decode_string(ctk::ar<const u8> block, size_t* offset, ctk::gar<u8>* out) {
+		if (*offset >= block.len) {
+			return false;
+		}
+		bool is_huffman = (block[*offset] & 0x80) != 0;
+		u64 len;
+		if (decode_integer(block, offset, 7, &len) == false || len > block.len - *offset) {
+			return false;
+		}
+		ctk::ar<const u8> string(&block.buf[*offset], len);
+		*offset += len;
+		if (is_huffman) {
+			return huffman_decode(string, out);
+		}
+		out->push_many(string.buf, string.len);
+		return true;
+	}
+
+	// Huffman coded when that is shorter.
+	static void encode_string(ctk::gar<u8>* out, ctk::ar<const u8> string) {
+		size_t huffman_len = get_huffman_len(string);
+		if (huffman_len < string.len) {
+			encode_integer(out, 0x80, 7, huffman_len);
+			huffman_encode(string, out);
+		} else {
+			encode_integer(out, 0x00, 7, string.len);
+			out->push_many(string.buf, string.len);
+		}
+	}
+
+	// Appends one field to a header block. name has to be lower case.
+	static void encode_field(ctk::gar<u8>* out, ctk::ar<const u8> name, ctk::ar<const u8> value) {
+		size_t name_index = 0;
+		for (size_t a = 0; a < static_entry_count; ++a) {
+			const StaticEntry& entry = static_table[a];
+			if (std::strlen(entry.name) != name.len || std::memcmp(entry.name, name.buf, name.len) != 0) {
+				continue;
+			}
+			if (std::strlen(entry.value) == value.len && std::memcmp(entry.value, value.buf, value.len) == 0) {
+				// indexed header field
+				encode_integer(out, 0x80, 7, a + 1);
+				return;
+			}
+			if (name_index == 0) {
+				name_index = a + 1;
+			}
+		}
+		// literal header field without indexing
+		encode_integer(out, 0x00, 4, name_index);
+		if (name_index == 0) {
+			encode_string(out, name);
+		}
+		encode_string(out, value);
+	}
+
+	// Fields with these would break the line format Decoder::decode writes (and are malformed).
+	static bool is_valid_field(ctk::ar<const u8> string) {
+		for (size_t a = 0; a < string.len; ++a) {
+			if (string[a] == '\r' || string[a] == '\n' || string[a] == '\0') {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	struct Decoder {
+		struct Entry {
+			u8* data;
+			size_t name_len;
+			size_t value_len;
+		};
+
+		// oldest first, dynamic index 62 is the last one
+		ctk::gar<Entry> entries;
+		size_t size;
+		// lowered by the encoder with size updates, never above settings_max_size
+		size_t max_size;
+		// what we announced in SETTINGS_HEADER_TABLE_SIZE
+		size_t settings_max_size;
+		ctk::gar<u8> name;
+		ctk::gar<u8> value;
+
+		void create(this auto& self, size_t settings_max_size) {
+			self.entries.create_auto();
+			self.size = 0;
+			self.max_size = settings_max_size;
+			self.settings_max_size = settings_max_size;
+			self.name.create_auto();
+			self.value.create_auto();
+		}
+
+		void destroy(this auto& self) {
+			for (size_t a = 0; a < self.entries.len; ++a) {
+				std::free(self.entries[a].data);
+			}
+			self.entries.destroy();
+			self.name.destroy();
+			self.value.destroy();
+		}
+
+		void evict(this auto& self, size_t max_size) {
+			size_t evict_count = 0;
+			while (self.size > max_size) {
+				Entry entry = self.entries[evict_count];
+				self.size -= entry.name_len + entry.value_len + entry_overhead;
+				std::free(entry.data);
+				evict_count += 1;
+			}
+			self.entries.remove_many(0, evict_count);
+		}
+
+		void insert(this auto& self) {
+			size_t entry_size = self.name.len + self.value.len + entry_overhead;
+			if (entry_size > self.max_size) {
+				// not an error, the table just ends up empty
+				self.evict(0);
+				return;
+			}
+			self.evict(self.max_size - entry_size);
+			u8* data = (u8*)std::malloc(self.name.len + self.value.len);
+			std::memcpy(data, self.name.buf, self.name.len);
+			std::memcpy(data + self.name.len, self.value.buf, self.value.len);
+			self.entries.push(Entry(data, self.name.len, self.value.len));
+			self.size += entry_size;
+		}
+
+		// Copies the name and, with with_value, the value of a static or dynamic entry.
+		bool load_entry(this auto& self, u64 index, bool with_value) {
+			if (index == 0) {
+				return false;
+			}
+			if (index <= static_entry_count) {
+				const StaticEntry& entry = static_table[index - 1];
+				self.name.push_many((const u8*)entry.name, std::strlen(entry.name));
+				if (with_value) {
+					self.value.push_many((const u8*)entry.value, std::strlen(entry.value));
+				}
+				return true;
+			}
+			u64 dynamic_index = index - static_entry_count - 1;
+			if (dynamic_index >= self.entries.len) {
+				return false;
+			}
+			Entry entry = self.entries[self.entries.len - 1 - dynamic_index];
+			self.name.push_many(entry.data, entry.name_len);
+			if (with_value) {
+				self.value.push_many(entry.data + entry.name_len, entry.value_len);
+			}
+			return true;
+		}
+
+		// Appends a "name: value\n" line per field to out. Fails on a malformed block, which is a
+		// connection error since the table may be out of sync with the peer's from then on.
+		bool decode(this auto& self, ctk::ar<const u8> block, ctk::gar<u8>* out) {
+			size_t offset = 0;
+			bool got_field = false;
+			while (offset < block.len) {
+				u8 byte = block[offset];
+				self.name.len = 0;
+				self.value.len = 0;
+				u64 index;
+				if (byte & 0x80) {
+					// indexed header field
+					if (decode_integer(block, &offset, 7, &index) == false || self.load_entry(index, true) == false) {
+						return false;
+					}
+				} else if ((byte & 0xe0) == 0x20) {
+					// dynamic table size update, only before the first field
+					u64 max_size;
+					if (got_field || decode_integer(block, &offset, 5, &max_size) == false || max_size > self.settings_max_size) {
+						return false;
+					}
+					self.max_size = max_size;
+					self.evict(max_size);
+					continue;
+				} else {
+					// literal, 0x40 adds it to the table, 0x00 and 0x10 (never indexed) don't
+					bool is_indexed = (byte & 0xc0) == 0x40;
+					if (decode_integer(block, &offset, is_indexed ? 6 : 4, &index) == false) {
+						return false;
+					}
+					if (index == 0) {
+						if (decode_string(block, &offset, &self.name) == false) {
+							return false;
+						}
+					} else if (self.load_entry(index, false) == false) {
+						return false;
+					}
+					if (decode_string(block, &offset, &self.value) == false) {
+						return false;
+					}
+					if (is_indexed) {
+						self.insert();
+					}
+				}
+				got_field = true;
+				if (is_valid_field(ctk::ar<const u8>(self.name.buf, self.name.len)) == false || is_valid_field(ctk::ar<const u8>(self.value.buf, self.value.len)) == false) {
+					return false;
+				}
+				out->push_many(self.name.buf, self.name.len);
+				out->push(':');
+				out->push(' ');
+				out->push_many(self.value.buf, self.value.len);
+				out->push('\n');
+			}
+			return true;
+		}
+	};
+};
\ No newline at end of file
@@ -38,7 +38,7 @@ struct HTTP {
 						a += name_len;
 						if (self.data[a] == ':' && self.data[a + 1] == ' ') {
 							a += 2;
-							for (size_t b = a; b < up_to; ++b) {
+							for (size_t b = a; b < self.data.len; ++b) {
 								if (self.data[b] == '\n') {
 									return ctk::ar<const u8>(&self.data[a], b - a);
 								}
@@ -96,10 +96,54 @@ struct HTTP {
 			Body,
 			ChunkedBodySize,
 			ChunkedBodyData,
+			// the CRLF after a chunk's data
+			ChunkedBodyDataEnd,
+			ChunkedBodyTrailer,
+			// the last chunk and the trailers are in
+			Finished,
+		};
+
+		// When set, body bytes are handed over as they arrive instead of being buffered in body.
+		struct BodySink {
+			void* user;
+			void (*func)(void* user, ctk::ar<const u8> chunk);
 		};
 
+		// The request body when it isn't part of data, set up by RequestBuilder. It is never copied
+		// as a whole, only read ahead a chunk at a time for callbacks and for files over TLS.
+		struct BodySource {
+			enum class Type {
+				None,
+				// a view the owner keeps alive until the request is done
+				Memory,
+				// func fills buf with up to len bytes and returns how many, 0 at the end, -1 to fail
+				Callback,
+				// sent with sendfile on plain TCP, the owner closes file_fd once the request is done
+				File,
+			};
+
+			Type type;
+			ctk::ar<const u8> memory;
+			void* user;
+			ssize_t (*func)(void* user, u8* buf, size_t len);
+			int file_fd;
+			off_t file_offset;
+			// unknown_len (callbacks only) sends the body chunked
+			size_t len;
+		};
+
+		constexpr static size_t unknown_len = SIZE_MAX;
+		constexpr static size_t body_chunk_size = 64 * 1024;
+		// room left before the data in body_chunk for the chunk size line, "%zx\r\n" of a size_t
+		constexpr static size_t body_chunk_header_len = 2 * sizeof(size_t) + 2;
+
 		size_t id;
 		const Addr* addr;
+		// the resolved addresses, after connecting only the one the socket is connected to
+		Addr target;
+		// happy eyeballs: the next target endpoint to try and when to start it without waiting for the others
+		size_t next_endpoint;
+		u64 next_attempt_ms;
 		ctk::ar<u8> data;
 		size_t sent_bytes;
 		int socket_fd;
@@ -111,17 +155,60 @@ struct HTTP {
 		Response::Status status;
 		Response::Headers headers;
 		Response::Body body;
+		// left of the current chunk's data, or the size being parsed in ChunkedBodySize
+		size_t chunk_remaining;
+		// digits of the size line, or bytes of the trailer line
+		size_t chunk_line_len;
+		bool chunk_extension;
+		// 0 leaves bodies as the server sent them, otherwise the decoded size allowed
+		size_t max_decoded_len;
+		// set once the headers name a Content-Encoding we asked for
+		ContentDecoder* decoder;
+		// the body was corrupt or too big, the request fails
+		bool body_failed;
+		BodySink body_sink;
+		BodySource body_source;
+		// how much of body_source was sent, or read into body_chunk
+		size_t body_offset;
+		// read ahead from a callback or a file over TLS, with chunked framing when the length is unknown,
+		// what is left to send is body_chunk_offset up to body_chunk_len
+		ctk::ar<u8> body_chunk;
+		size_t body_chunk_offset;
+		size_t body_chunk_len;
+		bool body_done;
+		// for the latency histograms, set by push_request and as the socket connects
+		u64 start_us;
+		u64 connected_us;
+		bool got_first_byte;
 
 		void create(this auto& self, bool use_tls) {
+			self.socket_fd = -1;
 			self.sent_bytes = 0;
 			self.ssl_state = use_tls ? SSL_State::Initial : SSL_State::NoUse;
 			self.ssl_ctx = nullptr;
 			self.ssl = nullptr;
 			self.state = State::Status;
 			self.got_carriage_return = false;
+			self.chunk_remaining = 0;
+			self.chunk_line_len = 0;
+			self.chunk_extension = false;
+			self.max_decoded_len = 0;
+			self.decoder = nullptr;
+			self.body_failed = false;
 			self.status.data.create_auto();
 			self.headers.create();
 			self.body.create();
+			self.body_sink = BodySink(nullptr, nullptr);
+			self.body_source = BodySource();
+			self.body_source.type = BodySource::Type::None;
+			self.body_offset = 0;
+			self.body_chunk = ctk::ar<u8>(nullptr, 0);
+			self.body_chunk_offset = 0;
+			self.body_chunk_len = 0;
+			self.body_done = true;
+			self.start_us = 0;
+			self.connected_us = 0;
+			self.got_first_byte = false;
 		}
 
 		void create_get(this auto& self, const Addr* addr, bool use_tls, const char* path) {
@@ -138,14 +225,28 @@ struct HTTP {
 
 		void destroy(this auto& self, int epoll_fd) {
 			self.data.destroy();
-			::epoll_ctl(epoll_fd, EPOLL_CTL_DEL, self.socket_fd, nullptr);
-			::close(self.socket_fd);
+			self.body_chunk.destroy();
+			if (self.decoder != nullptr) {
+				self.decoder->destroy();
+				std::free(self.decoder);
+			}
+			if (self.socket_fd != -1) {
+				::epoll_ctl(epoll_fd, EPOLL_CTL_DEL, self.socket_fd, nullptr);
+				::close(self.socket_fd);
+			}
 			if (self.ssl_state == SSL_State::Handshake || self.ssl_state == SSL_State::Ready) {
 				::SSL_free(self.ssl);
 				::SSL_CTX_free(self.ssl_ctx);
 			}
 		}
 
+		// for requests that end without handing their buffers over to a Response
+		void destroy_response(this auto& self) {
+			self.status.destroy();
+			self.headers.destroy();
+			self.body.destroy();
+		}
+
 		enum class SSL_Result {
 			Wait,
 			None,
@@ -158,15 +259,11 @@ struct HTTP {
 				return SSL_Result::None;
 			}
 			int err = ::SSL_get_error(self.ssl, ret);
-			if (err == SSL_ERROR_WANT_READ) {
-				struct epoll_event ev;
-				ev.events = EPOLLIN | EPOLLET;
-				ev.data.fd = self.socket_fd;
-				epoll_ctl(epoll_fd, EPOLL_CTL_MOD, self.socket_fd, &ev);
-				return SSL_Result::Wait;
-			} else if (err == SSL_ERROR_WANT_WRITE) {
+			if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+				// a body upload reads and writes at the same time, so one direction must not disarm the
+				// other, re-arming reports what is ready already again
 				struct epoll_event ev;
-				ev.events = EPOLLOUT | EPOLLET;
+				ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
 				ev.data.fd = self.socket_fd;
 				epoll_ctl(epoll_fd, EPOLL_CTL_MOD, self.socket_fd, &ev);
 				return SSL_Result::Wait;
@@ -196,6 +293,7 @@ struct HTTP {
 			}
 			int ret = ::SSL_connect(self.ssl);
 			if (ret == 1) {
+				Metrics::record(Metrics::Histogram::HTTPTLSHandshakeUs, Metrics::now_us() - self.connected_us);
 				self.ssl_state = SSL_State::Ready;
 				self.try_send(epoll_fd);
 				return SSL_Result::Ready;
@@ -209,41 +307,201 @@ struct HTTP {
 			Close,
 		};
 
-		SendResult try_send(this auto& self, int epoll_fd) {
-			while (self.sent_bytes < self.data.len) {
+		enum class WriteResult {
+			Done,
+			Wait,
+			Close,
+		};
+
+		// Writes buf from *offset on until it is all out or the socket would block.
+		WriteResult write(this auto& self, const u8* buf, size_t len, size_t* offset, int epoll_fd) {
+			while (*offset < len) {
 				ssize_t bytes_sent = 0;
 				if (self.ssl_state == SSL_State::NoUse) {
-					bytes_sent = ::send(self.socket_fd, &self.data[self.sent_bytes], self.data.len - self.sent_bytes, MSG_NOSIGNAL);
+					bytes_sent = ::send(self.socket_fd, &buf[*offset], len - *offset, MSG_NOSIGNAL);
 					if (bytes_sent == -1) {
 						if (errno == EAGAIN || errno == EWOULDBLOCK) {
-							return SendResult::None;
+							return WriteResult::Wait;
 						}
 						WTK_LOG("::send failed (%i)", errno);
-						return SendResult::Close;
+						return WriteResult::Close;
 					}
 				} else {
 					SSL_Result ssl_result = self.update_ssl(epoll_fd);
 					if (ssl_result == SSL_Result::Ready) {
-						bytes_sent = ::SSL_write(self.ssl, &self.data[self.sent_bytes], self.data.len - self.sent_bytes);
+						// a handshake finishing in update_ssl has sent through try_send already
+						if (*offset == len) {
+							break;
+						}
+						bytes_sent = ::SSL_write(self.ssl, &buf[*offset], len - *offset);
 						ssl_result = self.handle_ssl_err(bytes_sent, epoll_fd);
 						if (ssl_result == SSL_Result::Failed) {
-							return SendResult::Close;
+							return WriteResult::Close;
 						}
 						if (ssl_result == SSL_Result::Wait) {
-							return SendResult::None;
+							return WriteResult::Wait;
 						}
 					} else if (ssl_result == SSL_Result::Failed) {
-						return SendResult::Close;
+						return WriteResult::Close;
 					} else {
-						return SendResult::None;
+						return WriteResult::Wait;
 					}
 				}
 				if (bytes_sent == 0) {
-					return SendResult::None;
+					return WriteResult::Wait;
 				}
-				self.sent_bytes += bytes_sent;
+				*offset += bytes_sent;
 			}
-			return SendResult::None;
+			return WriteResult::Done;
+		}
+
+		SendResult try_send(this auto& self, int epoll_fd) {
+			WriteResult result = self.write(self.data.buf, self.data.len, &self.sent_bytes, epoll_fd);
+			if (result == WriteResult::Done) {
+				result = self.send_body(epoll_fd);
+			}
+			return result == WriteResult::Close ? SendResult::Close : SendResult::None;
+		}
+
+		WriteResult send_body(this auto& self, int epoll_fd) {
+			switch (self.body_source.type) {
+				case BodySource::Type::None: {
+					return WriteResult::Done;
+				}
+				case BodySource::Type::Memory: {
+					return self.write(self.body_source.memory.buf, self.body_source.memory.len, &self.body_offset, epoll_fd);
+				}
+				case BodySource::Type::File: {
+					if (self.ssl_state == SSL_State::NoUse) {
+						return self.send_file();
+					}
+					break;
+				}
+				default: {
+					break;
+				}
+			}
+			while (true) {
+				WriteResult result = self.write(self.body_chunk.buf, self.body_chunk_len, &self.body_chunk_offset, epoll_fd);
+				if (result != WriteResult::Done || self.body_done) {
+					return result;
+				}
+				if (self.fill_body_chunk() == false) {
+					return WriteResult::Close;
+				}
+			}
+		}
+
+		WriteResult send_file(this auto& self) {
+			while (self.body_offset < self.body_source.len) {
+				off_t offset = self.body_source.file_offset + self.body_offset;
+				ssize_t bytes_sent = ::sendfile(self.socket_fd, self.body_source.file_fd, &offset, self.body_source.len - self.body_offset);
+				if (bytes_sent == -1) {
+					if (errno == EAGAIN || errno == EWOULDBLOCK) {
+						return WriteResult::Wait;
+					}
+					WTK_LOG("::sendfile failed (%i)", errno);
+					return WriteResult::Close;
+				}
+				if (bytes_sent == 0) {
+					WTK_LOG("body file ended early (host:%s)", self.addr->name);
+					return WriteResult::Close;
+				}
+				self.body_offset += bytes_sent;
+			}
+			return WriteResult::Done;
+		}
+
+		// Reads the next piece of a callback or file body straight into body_chunk, after the room
+		// kept for the chunk size line, which is written in front of the data once its size is known.
+		bool fill_body_chunk(this auto& self) {
+			BodySource& source = self.body_source;
+			bool is_chunked = source.len == unknown_len;
+			size_t want = is_chunked ? body_chunk_size : std::min(body_chunk_size, source.len - self.body_offset);
+			u8* data = &self.body_chunk.buf[body_chunk_header_len];
+			ssize_t bytes_read;
+			if (source.type == BodySource::Type::Callback) {
+				bytes_read = source.func(source.user, data, want);
+			} else {
+				bytes_read = ::pread(source.file_fd, data, want, source.file_offset + self.body_offset);
+			}
+			if (bytes_read < 0 || (size_t)bytes_read > want || (bytes_read == 0 && is_chunked == false)) {
+				WTK_LOG("reading the request body failed (host:%s)", self.addr->name);
+				return false;
+			}
+			self.body_offset += bytes_read;
+			self.body_chunk_offset = body_chunk_header_len;
+			self.body_chunk_len = body_chunk_header_len + bytes_read;
+			if (is_chunked) {
+				char chunk_header[body_chunk_header_len + 1];
+				int chunk_header_len = std::snprintf(chunk_header, sizeof(chunk_header), "%zx\r\n", (size_t)bytes_read);
+				self.body_chunk_offset -= chunk_header_len;
+				std::memcpy(&self.body_chunk.buf[self.body_chunk_offset], chunk_header, chunk_header_len);
+				// an empty chunk is the last one
+				std::memcpy(&self.body_chunk.buf[self.body_chunk_len], "\r\n", 2);
+				self.body_chunk_len += 2;
+				self.body_done = bytes_read == 0;
+			} else {
+				self.body_done = self.body_offset == source.len;
+			}
+			return true;
+		}
+
+		void push_decoded_body(this auto& self, const u8* buf, size_t len) {
+			if (self.body_sink.func != nullptr) {
+				self.body_sink.func(self.body_sink.user, ctk::ar<const u8>(buf, len));
+			} else {
+				self.body.data.push_many(buf, len);
+			}
+		}
+
+		static void push_decoded_body(void* user, ctk::ar<const u8> chunk) {
+			((Request*)user)->push_decoded_body(chunk.buf, chunk.len);
+		}
+
+		// Returns false when the body can't be decoded, the request fails then.
+		bool push_body(this auto& self, const u8* buf, size_t len) {
+			if (self.decoder == nullptr) {
+				self.push_decoded_body(buf, len);
+				return true;
+			}
+			ContentDecoder::Sink sink = ContentDecoder::Sink(&self, push_decoded_body);
+			if (self.decoder->feed(ctk::ar<const u8>(buf, len), sink) == ContentDecoder::Result::Fail) {
+				self.body_failed = true;
+				return false;
+			}
+			return true;
+		}
+
+		// Called as the headers end.
+		void start_body(this auto& self) {
+			self.state = State::Body;
+			self.body.data.create_auto();
+			ctk::ar<const u8> transfer_encoding = self.headers.get_header("transfer-encoding");
+			if (transfer_encoding.buf != nullptr) {
+				const char* chunked_encoding = "chunked";
+				if (ctk::astr_nocase_cmp(transfer_encoding.buf, chunked_encoding, std::strlen(chunked_encoding))) {
+					self.state = State::ChunkedBodySize;
+				}
+			}
+			if (self.max_decoded_len > 0) {
+				ContentDecoder::Encoding encoding;
+				if (ContentDecoder::parse_encoding(self.headers.get_header("content-encoding"), &encoding)) {
+					self.decoder = ContentDecoder::make(encoding, self.max_decoded_len);
+				}
+			}
+		}
+
+		// Whether the request ended with a whole response: chunked bodies need their last chunk and
+		// compressed bodies their end, otherwise the connection was cut short.
+		bool has_response(this const auto& self) {
+			if (self.body_failed || self.state == State::Status || self.state == State::Header) {
+				return false;
+			}
+			if (self.state != State::Body && self.state != State::Finished) {
+				return false;
+			}
+			return self.decoder == nullptr || self.decoder->input_len == 0 || self.decoder->finished;
 		}
 
 		enum class RecvResult {
@@ -252,6 +510,76 @@ struct HTTP {
 			Finished,
 		};
 
+		// Chunks are framed by their size, so their data may hold any bytes including CRLF.
+		RecvResult recv_chunked(this auto& self, const u8* buf, size_t len) {
+			size_t offset = 0;
+			while (offset < len) {
+				switch (self.state) {
+					case State::ChunkedBodySize: {
+						u8 c = buf[offset++];
+						if (c == '\n') {
+							if (self.chunk_line_len == 0) {
+								return RecvResult::Close;
+							}
+							self.state = self.chunk_remaining == 0 ? State::ChunkedBodyTrailer : State::ChunkedBodyData;
+							self.chunk_line_len = 0;
+							self.chunk_extension = false;
+						} else if (c == ';') {
+							self.chunk_extension = true;
+						} else if (self.chunk_extension == false && c != '\r' && c != ' ' && c != '\t') {
+							int digit = std::isdigit(c) ? c - '0' : std::isxdigit(c) ? (std::tolower(c) - 'a' + 10) : -1;
+							if (digit == -1 || self.chunk_remaining > (SIZE_MAX >> 4)) {
+								return RecvResult::Close;
+							}
+							self.chunk_remaining = (self.chunk_remaining << 4) | (size_t)digit;
+							self.chunk_line_len += 1;
+						}
+						break;
+					}
+					case State::ChunkedBodyData: {
+						size_t data_len = std::min(len - offset, self.chunk_remaining);
+						if (self.push_body(&buf[offset], data_len) == false) {
+							return RecvResult::Close;
+						}
+						offset += data_len;
+						self.chunk_remaining -= data_len;
+						if (self.chunk_remaining == 0) {
+							self.state = State::ChunkedBodyDataEnd;
+						}
+						break;
+					}
+					case State::ChunkedBodyDataEnd: {
+						u8 c = buf[offset++];
+						if (c == '\n') {
+							self.state = State::ChunkedBodySize;
+						} else if (c != '\r') {
+							return RecvResult::Close;
+						}
+						break;
+					}
+					case State::ChunkedBodyTrailer: {
+						// trailer fields are skipped, an empty line ends the body
+						u8 c = buf[offset++];
+						if (c == '\n') {
+							if (self.chunk_line_len == 0) {
+								self.state = State::Finished;
+								return RecvResult::Finished;
+							}
+							self.chunk_line_len = 0;
+						} else if (c != '\r') {
+							self.chunk_line_len += 1;
+						}
+						break;
+					}
+					default: {
+						WTK_PANIC("invalid State");
+						break;
+					}
+				}
+			}
+			return RecvResult::None;
+		}
+
 		RecvResult try_recv(this auto& self, int epoll_fd) {
 			constexpr size_t temp_buffer_size = 256 * 256;
 			u8 temp_buffer[temp_buffer_size];
@@ -283,10 +611,24 @@ struct HTTP {
 					}
 				}
 				if (bytes_read == 0) {
-					return RecvResult::None;
+					return RecvResult::Close;
 				}
-				if (self.state == State::Body) {
-					self.body.data.push_many(temp_buffer, bytes_read);
+				if (self.got_first_byte == false) {
+					self.got_first_byte = true;
+					Metrics::record(Metrics::Histogram::HTTPFirstByteUs, Metrics::now_us() - self.start_us);
+				}
+				// the \n that ends the headers is still to come when got_carriage_return is set
+				if (self.state == State::Body && self.got_carriage_return == false) {
+					if (self.push_body(temp_buffer, bytes_read) == false) {
+						return RecvResult::Close;
+					}
+					continue;
+				}
+				if (self.state >= State::ChunkedBodySize && self.got_carriage_return == false) {
+					RecvResult chunked_result = self.recv_chunked(temp_buffer, bytes_read);
+					if (chunked_result != RecvResult::None) {
+						return chunked_result;
+					}
 					continue;
 				}
 				int temp_buffer_offset = 0;
@@ -298,6 +640,19 @@ struct HTTP {
 						}
 						self.got_carriage_return = false;
 						temp_buffer_offset = a + 1;
+						if (self.state == State::Body) {
+							if (self.push_body(&temp_buffer[temp_buffer_offset], bytes_read - temp_buffer_offset) == false) {
+								return RecvResult::Close;
+							}
+							goto main_loop_continue;
+						}
+						if (self.state != State::Status && self.state != State::Header) {
+							RecvResult chunked_result = self.recv_chunked(&temp_buffer[temp_buffer_offset], bytes_read - temp_buffer_offset);
+							if (chunked_result != RecvResult::None) {
+								return chunked_result;
+							}
+							goto main_loop_continue;
+						}
 						continue;
 					}
 					if (temp_buffer[a] == '\r') {
@@ -317,19 +672,7 @@ struct HTTP {
 							}
 							case State::Header: {
 								if (self.got_carriage_return && double_crlf) {
-									self.state = State::Body;
-									self.body.data.create_auto();
-									ctk::ar<const u8> transfer_encoding = self.headers.get_header("transfer-encoding");
-									if (transfer_encoding.buf != nullptr) {
-										const char* chunked_encoding = "chunked";
-										if (ctk::astr_nocase_cmp(transfer_encoding.buf, chunked_encoding, std::strlen(chunked_encoding))) {
-											self.state = State::ChunkedBodySize;
-										}
-									}
-									if (self.state == State::Body) {
-										self.body.data.push_many(&temp_buffer[temp_buffer_offset], bytes_read - temp_buffer_offset);
-										goto main_loop_continue;
-									}
+									self.start_body();
 									continue;
 								}
 								self.headers.data.push_many(&temp_buffer[temp_buffer_offset], crlf_index - temp_buffer_offset);
@@ -338,19 +681,6 @@ struct HTTP {
 								}
 								break;
 							}
-							case State::ChunkedBodySize:
-							case State::ChunkedBodyData: {
-								if (self.got_carriage_return && double_crlf) {
-									return RecvResult::Finished;
-								}
-								if (self.state == State::ChunkedBodyData) {
-									self.body.data.push_many(&temp_buffer[temp_buffer_offset], crlf_index - temp_buffer_offset);
-								}
-								if (self.got_carriage_return) {
-									self.state = (self.state == State::ChunkedBodySize) ? State::ChunkedBodyData : State::ChunkedBodySize;
-								}
-								break;
-							}
 							default: {
 								WTK_PANIC("invalid State");
 								break;
@@ -371,10 +701,223 @@ struct HTTP {
 		}
 	};
 
+	// Builds requests with any method and headers. The head is written into a buffer the builder
+	// keeps for the next request, the body is never copied: it is sent from a memory view, pulled
+	// from a callback or sent from a file. start, add_header as often as needed, a set_body, build.
+	struct RequestBuilder {
+		ctk::gar<u8> head;
+		const Addr* addr;
+		Request::BodySource body_source;
+		size_t max_decoded_len;
+		bool has_accept_encoding;
+		bool failed;
+
+		// start and build write these, add_header refuses them so a request never carries two
+		constexpr static const char* reserved_headers[] = {"Host", "Content-Length", "Transfer-Encoding", "Connection"};
+
+		void create(this auto& self) {
+			self.head.create_auto();
+			self.addr = nullptr;
+			self.has_accept_encoding = false;
+			self.failed = false;
+		}
+
+		void destroy(this auto& self) {
+			self.head.destroy();
+		}
+
+		static bool is_header_name(const char* name, const char* other) {
+			size_t len = std::strlen(other);
+			return std::strlen(name) == len && ctk::astr_nocase_cmp((const u8*)name, other, len);
+		}
+
+		static bool is_token(const char* string) {
+			if (*string == '\0') {
+				return false;
+			}
+			for (const char* c = string; *c != '\0'; ++c) {
+				if (std::isalnum((u8)*c) == 0 && std::strchr("!#$%&'*+-.^_`|~", *c) == nullptr) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		// Percent-encodes the bytes a request target can't hold as they are. '%' is kept, so paths
+		// that are encoded already pass through unchanged.
+		void push_path(this auto& self, const char* path) {
+			constexpr const char* hex = "0123456789ABCDEF";
+			for (const u8* c = (const u8*)path; *c != '\0'; ++c) {
+				if (*c <= 0x20 || *c >= 0x7f || std::strchr("\"#<>\\^`{|}", *c) != nullptr) {
+					self.head.push('%');
+					self.head.push(hex[*c >> 4]);
+					self.head.push(hex[*c & 0xf]);
+				} else {
+					self.head.push(*c);
+				}
+			}
+		}
+
+		// addr has to stay valid until the request is done, like with create_get.
+		void start(this auto& self, const char* method, const Addr* addr, const char* path) {
+			self.head.len = 0;
+			self.addr = addr;
+			self.body_source = Request::BodySource();
+			self.body_source.type = Request::BodySource::Type::None;
+			self.max_decoded_len = 0;
+			self.has_accept_encoding = false;
+			self.failed = is_token(method) == false;
+			self.head.push_many((const u8*)method, std::strlen(method));
+			self.head.push(' ');
+			if (path[0] != '/') {
+				self.head.push('/');
+			}
+			self.push_path(path);
+			constexpr const char* host = " HTTP/1.1\r\nHost: ";
+			self.head.push_many((const u8*)host, std::strlen(host));
+			self.head.push_many((const u8*)addr->name, std::strlen(addr->name));
+			self.head.push('\r');
+			self.head.push('\n');
+		}
+
+		// Fails, and makes build fail, for a name that isn't a token or a value with CR or LF in it, for
+		// one of reserved_headers and for a second Accept-Encoding (accept_encoding adds one too).
+		bool add_header(this auto& self, const char* name, ctk::ar<const u8> value) {
+			bool valid = is_token(name);
+			for (size_t a = 0; a < value.len; ++a) {
+				valid = valid && value[a] != '\r' && value[a] != '\n';
+			}
+			for (const char* reserved : reserved_headers) {
+				valid = valid && is_header_name(name, reserved) == false;
+			}
+			if (valid && is_header_name(name, "Accept-Encoding")) {
+				valid = self.has_accept_encoding == false;
+				self.has_accept_encoding = true;
+			}
+			if (valid == false) {
+				self.failed = true;
+				return false;
+			}
+			self.push_header(name, value);
+			return true;
+		}
+
+		bool add_header(this auto& self, const char* name, const char* value) {
+			return self.add_header(name, ctk::ar<const u8>((const u8*)value, std::strlen(value)));
+		}
+
+		// Without the checks of add_header, for the headers the builder writes itself.
+		void push_header(this auto& self, const char* name, ctk::ar<const u8> value) {
+			self.head.push_many((const u8*)name, std::strlen(name));
+			self.head.push(':');
+			self.head.push(' ');
+			self.head.push_many(value.buf, value.len);
+			self.head.push('\r');
+			self.head.push('\n');
+		}
+
+		void push_header(this auto& self, const char* name, const char* value) {
+			self.push_header(name, ctk::ar<const u8>((const u8*)value, std::strlen(value)));
+		}
+
+		// Asks for a compressed response and decodes it as it arrives, the response body is the
+		// decoded one. Decoding more than max_decoded_len bytes fails the request.
+		void accept_encoding(this auto& self, size_t max_decoded_len) {
+			self.add_header("Accept-Encoding", ContentDecoder::get_accept_encoding());
+			self.max_decoded_len = max_decoded_len;
+		}
+
+		// memory has to stay valid until the request is done.
+		void set_body(this auto& self, ctk::ar<const u8> memory) {
+			self.body_source.type = Request::BodySource::Type::Memory;
+			self.body_source.memory = memory;
+			self.body_source.len = memory.len;
+		}
+
+		// len may be Request::unknown_len, the body is sent chunked then.
+		void set_body_callback(this auto& self, size_t len, void* user, ssize_t (*func)(void* user, u8* buf, size_t len)) {
+			self.body_source.type = Request::BodySource::Type::Callback;
+			self.body_source.user = user;
+			self.body_source.func = func;
+			self.body_source.len = len;
+		}
+
+		void set_body_file(this auto& self, int file_fd, off_t file_offset, size_t len) {
+			self.body_source.type = Request::BodySource::Type::File;
+			self.body_source.file_fd = file_fd;
+			self.body_source.file_offset = file_offset;
+			self.body_source.len = len;
+		}
+
+		// Ends the head and hands it to request, the builder is ready for the next start then.
+		// Returns false when a method or header was refused.
+		bool build(this auto& self, bool use_tls, Request* out_request) {
+			if (self.failed) {
+				return false;
+			}
+			Request::BodySource& source = self.body_source;
+			if (source.type != Request::BodySource::Type::None) {
+				if (source.len == Request::unknown_len) {
+					self.push_header("Transfer-Encoding", "chunked");
+				} else {
+					char content_length[24];
+					int content_length_len = std::snprintf(content_length, sizeof(content_length), "%zu", source.len);
+					self.push_header("Content-Length", ctk::ar<const u8>((const u8*)content_length, content_length_len));
+				}
+			}
+			// responses without a length end when the server closes
+			self.push_header("Connection", "close");
+			self.head.push('\r');
+			self.head.push('\n');
+			Request request;
+			request.addr = self.addr;
+			request.data = ctk::ar<u8>((u8*)std::malloc(self.head.len), self.head.len);
+			std::memcpy(request.data.buf, self.head.buf, self.head.len);
+			request.create(use_tls);
+			request.body_source = source;
+			request.max_decoded_len = self.max_decoded_len;
+			if (source.type == Request::BodySource::Type::Callback || source.type == Request::BodySource::Type::File) {
+				request.body_done = source.len == 0;
+			}
+			// plain TCP sends files with ::sendfile and never reads them into body_chunk
+			if (source.type == Request::BodySource::Type::Callback || (source.type == Request::BodySource::Type::File && use_tls)) {
+				size_t body_chunk_capacity = Request::body_chunk_header_len + Request::body_chunk_size + 2;
+				request.body_chunk = ctk::ar<u8>((u8*)std::malloc(body_chunk_capacity), body_chunk_capacity);
+			}
+			*out_request = request;
+			return true;
+		}
+	};
+
+	// HTTP stays on epoll rather than IOUring: most requests are TLS, where OpenSSL reads and writes
+	// the socket itself, and file bodies go out through ::sendfile, which has no io_uring opcode.
 	int epoll_fd;
 	size_t next_id;
 	ctk::gar<Request> requests;
+	// popped oldest first, the ones before responses_head are gone already
 	ctk::gar<Response> responses;
+	size_t responses_head;
+	// ids of requests that ended without a response, popped like responses
+	ctk::gar<size_t> failures;
+	size_t failures_head;
+	// started on the first request for an unresolved Addr
+	Resolver* resolver;
+	// requests waiting for their Addr to be resolved, not connected yet
+	ctk::gar<Request> resolving;
+
+	// One in-flight connect for a request in connecting, several may race for the same request.
+	struct Attempt {
+		size_t id;
+		int socket_fd;
+		size_t endpoint;
+	};
+
+	// RFC 8305 Connection Attempt Delay
+	constexpr static u64 connection_attempt_delay_ms = 250;
+
+	// requests with connect attempts in flight, moved to requests once one of them succeeds
+	ctk::gar<Request> connecting;
+	ctk::gar<Attempt> attempts;
 
 	void create(this auto& self) {
 		self.epoll_fd = ::epoll_create1(0);
@@ -384,24 +927,62 @@ struct HTTP {
 		self.next_id = 1;
 		self.requests.create_auto();
 		self.responses.create_auto();
+		self.responses_head = 0;
+		self.failures.create_auto();
+		self.failures_head = 0;
+		self.resolver = nullptr;
+		self.resolving.create_auto();
+		self.connecting.create_auto();
+		self.attempts.create_auto();
 	}
 
 	void destroy(this auto& self) {
 		::close(self.epoll_fd);
+		// dropped without a response or a failure
+		Metrics::add(Metrics::Counter::HTTPInFlight, -(i64)(self.requests.len + self.resolving.len + self.connecting.len));
 		for (size_t a = 0; a < self.requests.len; ++a) {
 			self.requests[a].destroy(self.epoll_fd);
+			self.requests[a].destroy_response();
 		}
 		self.requests.destroy();
-		for (size_t a = 0; a < self.responses.len; ++a) {
+		for (size_t a = 0; a < self.resolving.len; ++a) {
+			self.resolving[a].destroy(self.epoll_fd);
+			self.resolving[a].destroy_response();
+		}
+		self.resolving.destroy();
+		for (size_t a = 0; a < self.attempts.len; ++a) {
+			::close(self.attempts[a].socket_fd);
+		}
+		self.attempts.destroy();
+		for (size_t a = 0; a < self.connecting.len; ++a) {
+			self.connecting[a].destroy(self.epoll_fd);
+			self.connecting[a].destroy_response();
+		}
+		self.connecting.destroy();
+		if (self.resolver != nullptr) {
+			self.resolver->destroy();
+			std::free(self.resolver);
+		}
+		for (size_t a = self.responses_head; a < self.responses.len; ++a) {
 			self.responses[a].destroy();
 		}
 		self.responses.destroy();
+		self.failures.destroy();
 	}
 
 	void update(this auto& self) {
+		self.update(0);
+	}
+
+	// Waits up to timeout_ms (-1 forever) for socket events, less while a connect attempt is due.
+	void update(this auto& self, int timeout_ms) {
+		int attempt_timeout_ms = self.update_connecting();
+		if (attempt_timeout_ms != -1 && (timeout_ms == -1 || attempt_timeout_ms < timeout_ms)) {
+			timeout_ms = attempt_timeout_ms;
+		}
 		constexpr size_t max_events = 4096;
 		struct epoll_event events[max_events];
-		int epoll_fd_count = ::epoll_wait(self.epoll_fd, events, max_events, 0);
+		int epoll_fd_count = ::epoll_wait(self.epoll_fd, events, max_events, timeout_ms);
 		if (epoll_fd_count == -1) {
 			if (errno != EINTR) {
 				WTK_LOG("::epoll_wait failed (%i)", errno);
@@ -410,7 +991,20 @@ struct HTTP {
 		}
 		for (int a = 0; a < epoll_fd_count; ++a) {
 			int epoll_fd = events[a].data.fd;
+			if (self.resolver != nullptr && epoll_fd == self.resolver->event_fd) {
+				self.update_resolving();
+				continue;
+			}
+			size_t attempt_index = self.get_attempt(epoll_fd);
+			if (attempt_index != SIZE_MAX) {
+				self.update_attempt(attempt_index, events[a].events);
+				continue;
+			}
 			size_t request_index = self.get_request(epoll_fd);
+			if (request_index == SIZE_MAX) {
+				// a losing attempt closed earlier in this batch
+				continue;
+			}
 			bool remove = (events[a].events & EPOLLERR) || (events[a].events & EPOLLHUP);
 			if (remove == false && (events[a].events & EPOLLIN)) {
 				Request::RecvResult recv_result = self.requests[request_index].try_recv(self.epoll_fd);
@@ -426,9 +1020,14 @@ struct HTTP {
 				}
 			}
 			if (remove) {
-				if (self.requests[request_index].state == Request::State::Body) {
+				Metrics::record(Metrics::Histogram::HTTPTotalUs, Metrics::now_us() - self.requests[request_index].start_us);
+				if (self.requests[request_index].has_response()) {
 					Request request = self.requests[request_index];
 					self.responses.push(Response(request.id, request.status, request.headers, request.body));
+					Metrics::add(Metrics::Counter::HTTPInFlight, -1);
+				} else {
+					self.push_failure(self.requests[request_index].id);
+					self.requests[request_index].destroy_response();
 				}
 				self.requests[request_index].destroy(self.epoll_fd);
 				self.requests.remove(request_index);
@@ -443,54 +1042,276 @@ struct HTTP {
 				return a;
 			}
 		}
-		WTK_PANIC("HTTP::get_request failed");
+		return SIZE_MAX;
+	}
+
+	size_t get_attempt(this auto& self, int socket_fd) {
+		for (size_t a = 0; a < self.attempts.len; ++a) {
+			if (self.attempts[a].socket_fd == socket_fd) {
+				return a;
+			}
+		}
+		return SIZE_MAX;
+	}
+
+	size_t get_connecting(this auto& self, size_t id) {
+		for (size_t a = 0; a < self.connecting.len; ++a) {
+			if (self.connecting[a].id == id) {
+				return a;
+			}
+		}
+		WTK_PANIC("HTTP::get_connecting failed");
 		return 0;
 	}
 
+	bool has_attempt(this auto& self, size_t id) {
+		for (size_t a = 0; a < self.attempts.len; ++a) {
+			if (self.attempts[a].id == id) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void update_resolving(this auto& self) {
+		self.resolver->clear_event();
+		size_t id;
+		Addr addr;
+		while (self.resolver->try_pop(&id, &addr)) {
+			for (size_t a = 0; a < self.resolving.len; ++a) {
+				if (self.resolving[a].id != id) {
+					continue;
+				}
+				Request request = self.resolving[a];
+				self.resolving.remove(a);
+				if (self.connect_request(request, addr) == false) {
+					self.push_failure(id);
+				}
+				break;
+			}
+		}
+	}
+
+	void push_failure(this auto& self, size_t id) {
+		self.failures.push(id);
+		Metrics::add(Metrics::Counter::HTTPFailures, 1);
+		Metrics::add(Metrics::Counter::HTTPInFlight, -1);
+	}
+
 	size_t push_request(this auto& self, Request request) {
-		int address_family = request.addr->type == Addr::Type::IPv4 ? AF_INET : AF_INET6;
-		request.socket_fd = ::socket(address_family, SOCK_STREAM, 0);
-		if (request.socket_fd < 0) {
-			WTK_LOG("::socket failed (host:%s)", request.addr->name);
-			return 0;
-		}
-		wtk::make_socket_nonblocking(request.socket_fd);
-		int connect_result;
-		if (request.addr->type == Addr::Type::IPv4) {
-			struct sockaddr_in server_addr = {};
-			server_addr.sin_family = AF_INET;
-			server_addr.sin_port = ::htons(request.addr->port);
-			server_addr.sin_addr = request.addr->ip.v4;
-			connect_result = ::connect(request.socket_fd, (struct sockaddr*)&server_addr, sizeof(server_addr));
+		request.start_us = Metrics::now_us();
+		size_t id = self.start_request(request);
+		Metrics::add(Metrics::Counter::HTTPRequests, 1);
+		if (id == 0) {
+			Metrics::add(Metrics::Counter::HTTPFailures, 1);
 		} else {
-			struct sockaddr_in6 server_addr = {};
-			server_addr.sin6_family = AF_INET6;
-			server_addr.sin6_port = ::htons(request.addr->port);
-			server_addr.sin6_addr = request.addr->ip.v6;
-			connect_result = ::connect(request.socket_fd, (struct sockaddr*)&server_addr, sizeof(server_addr));
-		}
-		if (connect_result == -1 && errno != EINPROGRESS) {
-			WTK_LOG("::connect failed (host:%s)", request.addr->name);
+			Metrics::add(Metrics::Counter::HTTPInFlight, 1);
+		}
+		return id;
+	}
+
+	size_t start_request(this auto& self, Request request) {
+		request.id = self.next_id;
+		self.next_id += 1;
+		if (request.addr->type != Addr::Type::Unresolved) {
+			return self.connect_request(request, *request.addr) ? request.id : 0;
+		}
+		if (self.resolver == nullptr) {
+			self.resolver = Resolver::make(Resolver::default_thread_count);
+			if (self.resolver == nullptr) {
+				request.destroy(self.epoll_fd);
+				request.destroy_response();
+				return 0;
+			}
+			struct epoll_event ev = {};
+			ev.events = EPOLLIN;
+			ev.data.fd = self.resolver->event_fd;
+			if (::epoll_ctl(self.epoll_fd, EPOLL_CTL_ADD, self.resolver->event_fd, &ev) == -1) {
+				WTK_PANIC("::epoll_ctl failed");
+			}
+		}
+		Addr addr;
+		if (self.resolver->resolve(request.id, request.addr->name, request.addr->port, &addr)) {
+			return self.connect_request(request, addr) ? request.id : 0;
+		}
+		self.resolving.push(request);
+		return request.id;
+	}
+
+	bool connect_request(this auto& self, Request request, Addr target) {
+		if (target.endpoint_count == 0) {
+			WTK_LOG("resolve failed (host:%s)", request.addr->name);
 			request.destroy(self.epoll_fd);
-			return 0;
+			request.destroy_response();
+			return false;
+		}
+		request.target = target;
+		request.target.name = request.addr->name;
+		request.next_endpoint = 0;
+		self.connecting.push(request);
+		if (self.start_attempt(&self.connecting[self.connecting.len - 1]) == false) {
+			self.fail_connecting(self.connecting.len - 1);
+			return false;
+		}
+		return true;
+	}
+
+	// Starts a nonblocking connect to the next endpoint, skipping the ones that fail right away.
+	bool start_attempt(this auto& self, Request* request) {
+		while (request->next_endpoint < request->target.endpoint_count) {
+			size_t endpoint = request->next_endpoint;
+			request->next_endpoint += 1;
+			Addr addr = request->target.get_endpoint(endpoint);
+			int address_family = addr.type == Addr::Type::IPv4 ? AF_INET : AF_INET6;
+			int socket_fd = ::socket(address_family, SOCK_STREAM, 0);
+			if (socket_fd < 0) {
+				WTK_LOG("::socket failed (host:%s)", addr.name);
+				continue;
+			}
+			wtk::make_socket_nonblocking(socket_fd);
+			wtk::set_socket_nodelay(socket_fd);
+			int connect_result;
+			if (addr.type == Addr::Type::IPv4) {
+				struct sockaddr_in server_addr = {};
+				server_addr.sin_family = AF_INET;
+				server_addr.sin_port = ::htons(addr.port);
+				server_addr.sin_addr = addr.ip.v4;
+				connect_result = ::connect(socket_fd, (struct sockaddr*)&server_addr, sizeof(server_addr));
+			} else {
+				struct sockaddr_in6 server_addr = {};
+				server_addr.sin6_family = AF_INET6;
+				server_addr.sin6_port = ::htons(addr.port);
+				server_addr.sin6_addr = addr.ip.v6;
+				connect_result = ::connect(socket_fd, (struct sockaddr*)&server_addr, sizeof(server_addr));
+			}
+			if (connect_result == -1 && errno != EINPROGRESS) {
+				WTK_LOG("::connect failed (host:%s)", addr.name);
+				::close(socket_fd);
+				continue;
+			}
+			struct epoll_event ev = {};
+			ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+			ev.data.fd = socket_fd;
+			if (::epoll_ctl(self.epoll_fd, EPOLL_CTL_ADD, socket_fd, &ev) == -1) {
+				WTK_PANIC("::epoll_ctl failed");
+			}
+			self.attempts.push(Attempt(request->id, socket_fd, endpoint));
+			request->next_attempt_ms = Resolver::now_ms() + connection_attempt_delay_ms;
+			return true;
 		}
+		return false;
+	}
+
+	void fail_connecting(this auto& self, size_t index) {
+		WTK_LOG("::connect failed for every address (host:%s)", self.connecting[index].target.name);
+		self.connecting[index].destroy(self.epoll_fd);
+		self.connecting[index].destroy_response();
+		self.connecting.remove(index);
+	}
+
+	// Starts the next attempt for requests whose latest attempt has been pending for the attempt delay.
+	// Returns the ms until the next attempt is due, -1 when no request has addresses left to try.
+	int update_connecting(this auto& self) {
+		if (self.connecting.len == 0) {
+			return -1;
+		}
+		u64 now = Resolver::now_ms();
+		u64 next_attempt_ms = UINT64_MAX;
+		for (size_t a = 0; a < self.connecting.len; ++a) {
+			Request& request = self.connecting[a];
+			if (request.next_endpoint < request.target.endpoint_count && request.next_attempt_ms <= now) {
+				self.start_attempt(&request);
+			}
+			if (request.next_endpoint < request.target.endpoint_count) {
+				next_attempt_ms = std::min(next_attempt_ms, request.next_attempt_ms);
+			}
+		}
+		if (next_attempt_ms == UINT64_MAX) {
+			return -1;
+		}
+		return next_attempt_ms > now ? (int)(next_attempt_ms - now) : 0;
+	}
+
+	void update_attempt(this auto& self, size_t attempt_index, u32 events) {
+		Attempt attempt = self.attempts[attempt_index];
+		bool failed = (events & EPOLLERR) || (events & EPOLLHUP);
+		if (failed == false) {
+			if ((events & EPOLLOUT) == 0) {
+				return;
+			}
+			int err = 0;
+			socklen_t len = sizeof(err);
+			if (::getsockopt(attempt.socket_fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+				failed = true;
+			} else {
+				struct sockaddr_storage peer;
+				socklen_t peer_len = sizeof(peer);
+				if (::getpeername(attempt.socket_fd, (struct sockaddr*)&peer, &peer_len) != 0) {
+					// a stale event for a reused fd, the connect is still in progress
+					return;
+				}
+			}
+		}
+		self.attempts.remove(attempt_index);
+		size_t request_index = self.get_connecting(attempt.id);
+		if (failed) {
+			::epoll_ctl(self.epoll_fd, EPOLL_CTL_DEL, attempt.socket_fd, nullptr);
+			::close(attempt.socket_fd);
+			// no point in waiting out the attempt delay after a failure
+			if (self.start_attempt(&self.connecting[request_index]) == false && self.has_attempt(attempt.id) == false) {
+				self.push_failure(attempt.id);
+				self.fail_connecting(request_index);
+			}
+			return;
+		}
+		for (size_t a = self.attempts.len; a > 0; --a) {
+			if (self.attempts[a - 1].id == attempt.id) {
+				::epoll_ctl(self.epoll_fd, EPOLL_CTL_DEL, self.attempts[a - 1].socket_fd, nullptr);
+				::close(self.attempts[a - 1].socket_fd);
+				self.attempts.remove(a - 1);
+			}
+		}
+		Request request = self.connecting[request_index];
+		self.connecting.remove(request_index);
+		request.target = request.target.get_endpoint(attempt.endpoint);
+		request.socket_fd = attempt.socket_fd;
+		request.connected_us = Metrics::now_us();
+		Metrics::record(Metrics::Histogram::HTTPConnectUs, request.connected_us - request.start_us);
+		self.requests.push(request);
+		// the EPOLLOUT edge was used up here, re-arming reports it again for the request
 		struct epoll_event ev = {};
-		ev.events = EPOLLOUT | EPOLLET;
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
 		ev.data.fd = request.socket_fd;
-		if (::epoll_ctl(self.epoll_fd, EPOLL_CTL_ADD, request.socket_fd, &ev) == -1) {
+		if (::epoll_ctl(self.epoll_fd, EPOLL_CTL_MOD, request.socket_fd, &ev) == -1) {
 			WTK_PANIC("::epoll_ctl failed");
 		}
-		request.id = self.next_id;
-		self.next_id += 1;
-		self.requests.push(request);
-		return request.id;
 	}
 
+	// Oldest first.
 	bool try_pop_response(this auto& self, Response* out_response) {
-		if (self.responses.len > 0) {
-			*out_response = self.responses.pop();
-			return true;
+		if (self.responses_head == self.responses.len) {
+			return false;
 		}
-		return false;
+		*out_response = self.responses[self.responses_head];
+		self.responses_head += 1;
+		if (self.responses_head == self.responses.len) {
+			self.responses.len = 0;
+			self.responses_head = 0;
+		}
+		return true;
+	}
+
+	// Ids of requests that failed after push_request returned, oldest first.
+	bool try_pop_failure(this auto& self, size_t* out_id) {
+		if (self.failures_head == self.failures.len) {
+			return false;
+		}
+		*out_id = self.failures[self.failures_head];
+		self.failures_head += 1;
+		if (self.failures_head == self.failures.len) {
+			self.failures.len = 0;
+			self.failures_head = 0;
+		}
+		return true;
 	}
 };
\ No newline at end of file
@@ -0,0 +1,824 @@
+// An HTTP/2 connection (RFC 9113) on a SocketClient::Loop: any number of requests to one host share
+// one TCP/TLS connection as concurrent streams. TLS connections negotiate h2 through ALPN and fail
+// when the server doesn't pick it, plain TCP speaks h2 with prior knowledge. Forward every Loop event
+// for its client (client->user points back here) to handle_event, responses then pop like with HTTP.
+struct HTTP2 {
+	enum class State {
+		Connecting,
+		// the preface is sent, streams wait for the server's first SETTINGS
+		Settings,
+		Open,
+		// no new streams, the connection closes once the open ones are done
+		GoingAway,
+		Closed,
+	};
+
+	enum FrameType : u8 {
+		Data = 0x0,
+		Headers = 0x1,
+		Priority = 0x2,
+		RstStream = 0x3,
+		Settings = 0x4,
+		PushPromise = 0x5,
+		Ping = 0x6,
+		GoAway = 0x7,
+		WindowUpdate = 0x8,
+		Continuation = 0x9,
+	};
+
+	enum Flag : u8 {
+		EndStream = 0x1,
+		Ack = 0x1,
+		EndHeaders = 0x4,
+		Padded = 0x8,
+		PriorityInfo = 0x20,
+	};
+
+	enum Setting : u16 {
+		HeaderTableSize = 0x1,
+		EnablePush = 0x2,
+		MaxConcurrentStreams = 0x3,
+		InitialWindowSize = 0x4,
+		MaxFrameSize = 0x5,
+		MaxHeaderListSize = 0x6,
+	};
+
+	enum ErrorCode : u32 {
+		NoError = 0x0,
+		ProtocolError = 0x1,
+		InternalError = 0x2,
+		FlowControlError = 0x3,
+		StreamClosed = 0x5,
+		FrameSizeError = 0x6,
+		RefusedStream = 0x7,
+		Cancel = 0x8,
+		CompressionError = 0x9,
+	};
+
+	struct Stream {
+		// 0 while queued
+		u32 id;
+		size_t request_id;
+		// encoded request headers, sent and dropped once the stream starts
+		ctk::gar<u8> header_block;
+		ctk::ar<u8> body;
+		size_t body_offset;
+		i64 send_window;
+		// received DATA bytes not given back with WINDOW_UPDATE yet
+		size_t recv_unacked;
+		bool got_final_headers;
+		HTTP::Response response;
+
+		void destroy(this auto& self) {
+			self.header_block.destroy();
+			self.body.destroy();
+		}
+	};
+
+	constexpr static const char* preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+	constexpr static size_t frame_header_len = 9;
+	constexpr static u32 max_stream_id = 0x7fffffff;
+	constexpr static i64 max_window = 0x7fffffff;
+	constexpr static u32 default_window = 65535;
+	constexpr static u32 default_max_frame_size = 16384;
+	// what this side announces, the peer keeps DATA inside these
+	constexpr static u32 local_stream_window = 1024 * 1024;
+	constexpr static u32 local_connection_window = 16 * 1024 * 1024;
+	// a header block continued past this is refused
+	constexpr static size_t max_header_block_len = 256 * 1024;
+
+	SocketClient* client;
+	State state;
+	bool use_tls;
+	// started streams by id, requests over the peer's stream limit wait in queued
+	ctk::gar<Stream> streams;
+	ctk::gar<Stream> queued;
+	u32 next_stream_id;
+	size_t next_request_id;
+	HPACK::Decoder decoder;
+	// a HEADERS block continued in CONTINUATION frames, header_block_stream_id is 0 when there is none
+	ctk::gar<u8> header_block;
+	u32 header_block_stream_id;
+	bool header_block_end_stream;
+	// scratch for decoded header lines and outgoing frames
+	ctk::gar<u8> header_lines;
+	ctk::gar<u8> frame_buffer;
+	// the peer's settings
+	u32 max_concurrent_streams;
+	u32 initial_window_size;
+	u32 max_frame_size;
+	i64 send_window;
+	size_t recv_unacked;
+	// popped oldest first like HTTP's
+	ctk::gar<HTTP::Response> responses;
+	size_t responses_head;
+	ctk::gar<size_t> failures;
+	size_t failures_head;
+
+	static HTTP2* make(SocketClient::Loop* loop, Addr addr, bool use_tls) {
+		SocketClient* client = SocketClient::make(loop, addr, use_tls);
+		if (client == nullptr) {
+			return nullptr;
+		}
+		client->alpn = ctk::ar<const u8>((const u8*)"\x02h2", 3);
+		HTTP2* http2 = ctk::alloc<HTTP2>(HTTP2());
+		http2->client = client;
+		http2->state = State::Connecting;
+		http2->use_tls = use_tls;
+		http2->streams.create_auto();
+		http2->queued.create_auto();
+		http2->next_stream_id = 1;
+		http2->next_request_id = 1;
+		http2->decoder.create(HPACK::default_table_size);
+		http2->header_block.create_auto();
+		http2->header_block_stream_id = 0;
+		http2->header_block_end_stream = false;
+		http2->header_lines.create_auto();
+		http2->frame_buffer.create_auto();
+		// until the server's SETTINGS say otherwise
+		http2->max_concurrent_streams = UINT32_MAX;
+		http2->initial_window_size = default_window;
+		http2->max_frame_size = default_max_frame_size;
+		http2->send_window = default_window;
+		http2->recv_unacked = 0;
+		http2->responses.create_auto();
+		http2->responses_head = 0;
+		http2->failures.create_auto();
+		http2->failures_head = 0;
+		client->user = http2;
+		return http2;
+	}
+
+	void destroy(this auto& self) {
+		self.client->destroy();
+		std::free(self.client);
+		for (size_t a = 0; a < self.streams.len; ++a) {
+			self.streams[a].destroy();
+			self.streams[a].response.destroy();
+		}
+		self.streams.destroy();
+		for (size_t a = 0; a < self.queued.len; ++a) {
+			self.queued[a].destroy();
+			self.queued[a].response.destroy();
+		}
+		self.queued.destroy();
+		self.decoder.destroy();
+		self.header_block.destroy();
+		self.header_lines.destroy();
+		self.frame_buffer.destroy();
+		for (size_t a = self.responses_head; a < self.responses.len; ++a) {
+			self.responses[a].destroy();
+		}
+		self.responses.destroy();
+		self.failures.destroy();
+	}
+
+	// headers are extra "\r\nName: value" lines like with HTTP::Request::create_post, an empty body
+	// sends none. Returns 0 when the connection can't take new streams anymore.
+	size_t push_request(this auto& self, const char* method, const char* path, ctk::ar<const u8> headers, ctk::ar<const u8> body) {
+		if (self.state == State::GoingAway || self.state == State::Closed) {
+			return 0;
+		}
+		Stream stream;
+		stream.id = 0;
+		stream.request_id = self.next_request_id;
+		self.next_request_id += 1;
+		stream.header_block.create_auto();
+		stream.body = ctk::ar<u8>(nullptr, 0);
+		if (body.len > 0) {
+			stream.body = ctk::ar<u8>((u8*)std::malloc(body.len), body.len);
+			std::memcpy(stream.body.buf, body.buf, body.len);
+		}
+		stream.body_offset = 0;
+		stream.send_window = 0;
+		stream.recv_unacked = 0;
+		stream.got_final_headers = false;
+		stream.response.status.data.create_auto();
+		stream.response.headers.data.create_auto();
+		stream.response.body.data.create_auto();
+		self.encode_headers(&stream.header_block, method, path, headers, body.len);
+		self.queued.push(stream);
+		self.start_streams();
+		return stream.request_id;
+	}
+
+	size_t push_get(this auto& self, const char* path) {
+		return self.push_request("GET", path, ctk::ar<const u8>(nullptr, 0), ctk::ar<const u8>(nullptr, 0));
+	}
+
+	size_t push_post(this auto& self, const char* path, ctk::ar<const u8> headers, ctk::ar<const u8> body) {
+		return self.push_request("POST", path, headers, body);
+	}
+
+	void encode_headers(this auto& self, ctk::gar<u8>* out, const char* method, const char* path, ctk::ar<const u8> headers, size_t body_len) {
+		auto field = [&](const char* name, ctk::ar<const u8> value) {
+			HPACK::encode_field(out, ctk::ar<const u8>((const u8*)name, std::strlen(name)), value);
+		};
+		auto text = [](const char* string) {
+			return ctk::ar<const u8>((const u8*)string, std::strlen(string));
+		};
+		field(":method", text(method));
+		field(":scheme", text(self.use_tls ? "https" : "http"));
+		u16 default_port = self.use_tls ? 443 : 80;
+		if (self.client->addr.port == default_port) {
+			field(":authority", text(self.client->addr.name));
+		} else {
+			ctk::ar<u8> authority = ctk::alloc_format("%s:%u", self.client->addr.name, self.client->addr.port);
+			field(":authority", ctk::ar<const u8>(authority.buf, authority.len));
+			authority.destroy();
+		}
+		field(":path", text(path));
+		if (body_len > 0) {
+			char content_length[24];
+			int content_length_len = std::snprintf(content_length, sizeof(content_length), "%zu", body_len);
+			field("content-length", ctk::ar<const u8>((const u8*)content_length, content_length_len));
+		}
+		// header names are lower case in HTTP/2, connection specific headers are not allowed
+		constexpr const char* skipped[] = {"connection", "keep-alive", "proxy-connection", "transfer-encoding", "upgrade", "host", "content-length"};
+		char name[256];
+		size_t line_start = 0;
+		while (line_start < headers.len) {
+			size_t line_end = line_start;
+			while (line_end < headers.len && headers[line_end] != '\r' && headers[line_end] != '\n') {
+				line_end += 1;
+			}
+			size_t colon = line_start;
+			while (colon < line_end && headers[colon] != ':') {
+				colon += 1;
+			}
+			size_t name_len = colon - line_start;
+			if (colon < line_end && name_len > 0 && name_len < sizeof(name)) {
+				for (size_t a = 0; a < name_len; ++a) {
+					name[a] = (char)std::tolower(headers[line_start + a]);
+				}
+				name[name_len] = '\0';
+				bool skip = false;
+				for (const char* skipped_name : skipped) {
+					skip = skip || std::strcmp(name, skipped_name) == 0;
+				}
+				size_t value_start = colon + 1;
+				while (value_start < line_end && headers[value_start] == ' ') {
+					value_start += 1;
+				}
+				if (skip == false) {
+					field(name, ctk::ar<const u8>(&headers.buf[value_start], line_end - value_start));
+				}
+			}
+			line_start = line_end + 1;
+		}
+	}
+
+	SocketClient::Result send_frame(this auto& self, FrameType type, u8 flags, u32 stream_id, ctk::ar<const u8> payload) {
+		u8 header[frame_header_len];
+		header[0] = (payload.len >> 16) & 0xff;
+		header[1] = (payload.len >> 8) & 0xff;
+		header[2] = payload.len & 0xff;
+		header[3] = type;
+		header[4] = flags;
+		write_u32(&header[5], stream_id);
+		self.frame_buffer.len = 0;
+		self.frame_buffer.push_many(header, frame_header_len);
+		self.frame_buffer.push_many(payload.buf, payload.len);
+		return self.client->send(ctk::ar<const u8>(self.frame_buffer.buf, self.frame_buffer.len));
+	}
+
+	static void write_u32(u8* buf, u32 value) {
+		buf[0] = (value >> 24) & 0xff;
+		buf[1] = (value >> 16) & 0xff;
+		buf[2] = (value >> 8) & 0xff;
+		buf[3] = value & 0xff;
+	}
+
+	static u32 read_u32(const u8* buf) {
+		return ((u32)buf[0] << 24) | ((u32)buf[1] << 16) | ((u32)buf[2] << 8) | buf[3];
+	}
+
+	void send_window_update(this auto& self, u32 stream_id, u32 increment) {
+		u8 payload[4];
+		write_u32(payload, increment);
+		self.send_frame(FrameType::WindowUpdate, 0, stream_id, ctk::ar<const u8>(payload, 4));
+	}
+
+	void connection_error(this auto& self, ErrorCode error_code) {
+		u8 payload[8];
+		write_u32(&payload[0], 0);
+		write_u32(&payload[4], error_code);
+		self.send_frame(FrameType::GoAway, 0, 0, ctk::ar<const u8>(payload, 8));
+		WTK_LOG("HTTP/2 connection error (%u) (host:%s)", error_code, self.client->addr.name);
+		self.client->close();
+	}
+
+	// queued frames may take up this much of the client's send buffer, the rest stays free for
+	// control frames so those are never refused
+	size_t get_send_room(this const auto& self) {
+		size_t limit = self.client->max_pending_bytes / 2;
+		size_t pending = self.client->get_pending_bytes();
+		return pending < limit ? limit - pending : 0;
+	}
+
+	void start_streams(this auto& self) {
+		if (self.state != State::Open) {
+			return;
+		}
+		while (self.queued.len > 0 && self.streams.len < self.max_concurrent_streams && self.get_send_room() > 0) {
+			if (self.next_stream_id > max_stream_id) {
+				// stream ids ran out, the owner has to open a new connection
+				self.state = State::GoingAway;
+				self.fail_queued();
+				return;
+			}
+			Stream stream = self.queued[0];
+			self.queued.remove(0);
+			stream.id = self.next_stream_id;
+			self.next_stream_id += 2;
+			stream.send_window = self.initial_window_size;
+			self.streams.push(stream);
+			Stream& started = self.streams[self.streams.len - 1];
+			ctk::ar<const u8> block(started.header_block.buf, started.header_block.len);
+			size_t offset = 0;
+			FrameType type = FrameType::Headers;
+			do {
+				size_t len = std::min<size_t>(block.len - offset, self.max_frame_size);
+				u8 flags = offset + len == block.len ? Flag::EndHeaders : 0;
+				if (type == FrameType::Headers && started.body.len == 0) {
+					flags |= Flag::EndStream;
+				}
+				self.send_frame(type, flags, started.id, ctk::ar<const u8>(&block.buf[offset], len));
+				offset += len;
+				type = FrameType::Continuation;
+			} while (offset < block.len);
+			started.header_block.destroy();
+			started.header_block.create_auto();
+			self.send_body(&started);
+		}
+	}
+
+	// Sends as much of the request body as flow control and the send buffer allow.
+	void send_body(this auto& self, Stream* stream) {
+		while (stream->body_offset < stream->body.len) {
+			i64 len = std::min<i64>(stream->body.len - stream->body_offset, self.max_frame_size);
+			len = std::min<i64>(len, std::min(self.send_window, stream->send_window));
+			len = std::min<i64>(len, self.get_send_room());
+			if (len <= 0) {
+				return;
+			}
+			u8 flags = stream->body_offset + len == stream->body.len ? Flag::EndStream : 0;
+			if (self.send_frame(FrameType::Data, flags, stream->id, ctk::ar<const u8>(&stream->body.buf[stream->body_offset], len)) == SocketClient::Result::Fail) {
+				return;
+			}
+			stream->body_offset += len;
+			self.send_window -= len;
+			stream->send_window -= len;
+		}
+	}
+
+	void send_bodies(this auto& self) {
+		for (size_t a = 0; a < self.streams.len; ++a) {
+			self.send_body(&self.streams[a]);
+		}
+	}
+
+	size_t get_stream(this auto& self, u32 id) {
+		for (size_t a = 0; a < self.streams.len; ++a) {
+			if (self.streams[a].id == id) {
+				return a;
+			}
+		}
+		return SIZE_MAX;
+	}
+
+	void finish_stream(this auto& self, size_t index) {
+		Stream stream = self.streams[index];
+		self.streams.remove(index);
+		stream.response.id = stream.request_id;
+		self.responses.push(stream.response);
+		stream.destroy();
+		self.end_stream();
+	}
+
+	void fail_stream(this auto& self, size_t index) {
+		Stream stream = self.streams[index];
+		self.streams.remove(index);
+		self.failures.push(stream.request_id);
+		stream.response.destroy();
+		stream.destroy();
+		self.end_stream();
+	}
+
+	void fail_queued(this auto& self) {
+		for (size_t a = 0; a < self.queued.len; ++a) {
+			self.failures.push(self.queued[a].request_id);
+			self.queued[a].response.destroy();
+			self.queued[a].destroy();
+		}
+		self.queued.len = 0;
+	}
+
+	void end_stream(this auto& self) {
+		if (self.state == State::GoingAway && self.streams.len == 0) {
+			self.client->close();
+			return;
+		}
+		self.start_streams();
+	}
+
+	// Fail means the connection is done, destroy this once the Closed event arrives.
+	SocketClient::Result handle_event(this auto& self, SocketClient::Event::Type type) {
+		if (type == SocketClient::Event::Type::Closed) {
+			self.state = State::Closed;
+			while (self.streams.len > 0) {
+				self.fail_stream(self.streams.len - 1);
+			}
+			self.fail_queued();
+			return SocketClient::Result::Fail;
+		}
+		if (self.state == State::Closed) {
+			return SocketClient::Result::Fail;
+		}
+		if (type == SocketClient::Event::Type::Connected) {
+			return self.handle_connected();
+		}
+		if (type == SocketClient::Event::Type::Writable) {
+			self.send_bodies();
+			self.start_streams();
+			return SocketClient::Result::Ok;
+		}
+		return self.handle_frames();
+	}
+
+	SocketClient::Result handle_connected(this auto& self) {
+		if (self.use_tls) {
+			ctk::ar<const u8> protocol = self.client->get_alpn_protocol();
+			if (protocol.len != 2 || std::memcmp(protocol.buf, "h2", 2) != 0) {
+				WTK_LOG("the server doesn't speak HTTP/2 (host:%s)", self.client->addr.name);
+				self.client->close();
+				return SocketClient::Result::Fail;
+			}
+		}
+		self.client->send(ctk::ar<const u8>((const u8*)preface, std::strlen(preface)));
+		u8 settings[18];
+		size_t settings_len = 0;
+		auto setting = [&](Setting id, u32 value) {
+			settings[settings_len] = id >> 8;
+			settings[settings_len + 1] = id & 0xff;
+			write_u32(&settings[settings_len + 2], value);
+			settings_len += 6;
+		};
+		setting(Setting::EnablePush, 0);
+		setting(Setting::InitialWindowSize, local_stream_window);
+		setting(Setting::HeaderTableSize, HPACK::default_table_size);
+		self.send_frame(FrameType::Settings, 0, 0, ctk::ar<const u8>(settings, settings_len));
+		self.send_window_update(0, local_connection_window - default_window);
+		self.state = State::Settings;
+		return SocketClient::Result::Ok;
+	}
+
+	// Handles every complete frame in the buffer.
+	SocketClient::Result handle_frames(this auto& self) {
+		ctk::gar<u8>& buffer = self.client->buffer;
+		size_t offset = 0;
+		SocketClient::Result result = SocketClient::Result::Ok;
+		while (buffer.len - offset >= frame_header_len) {
+			const u8* header = &buffer.buf[offset];
+			size_t len = ((size_t)header[0] << 16) | ((size_t)header[1] << 8) | header[2];
+			u8 type = header[3];
+			u8 flags = header[4];
+			u32 stream_id = read_u32(&header[5]) & max_stream_id;
+			if (len > default_max_frame_size) {
+				self.connection_error(ErrorCode::FrameSizeError);
+				return SocketClient::Result::Fail;
+			}
+			if (buffer.len - offset < frame_header_len + len) {
+				break;
+			}
+			ctk::ar<const u8> payload(&buffer.buf[offset + frame_header_len], len);
+			offset += frame_header_len + len;
+			ErrorCode error_code = ErrorCode::NoError;
+			if (self.state == State::Settings && type != FrameType::Settings) {
+				// the server preface is a SETTINGS frame
+				error_code = ErrorCode::ProtocolError;
+			} else if (self.header_block_stream_id != 0 && (type != FrameType::Continuation || stream_id != self.header_block_stream_id)) {
+				error_code = ErrorCode::ProtocolError;
+			} else {
+				error_code = self.handle_frame(type, flags, stream_id, payload);
+			}
+			if (error_code != ErrorCode::NoError) {
+				self.connection_error(error_code);
+				result = SocketClient::Result::Fail;
+				break;
+			}
+			if (self.client->state == SocketClient::State::Closed) {
+				result = SocketClient::Result::Fail;
+				break;
+			}
+		}
+		self.client->consume(offset);
+		return result;
+	}
+
+	ErrorCode handle_frame(this auto& self, u8 type, u8 flags, u32 stream_id, ctk::ar<const u8> payload) {
+		switch (type) {
+			case FrameType::Data: {
+				return self.handle_data(flags, stream_id, payload);
+			}
+			case FrameType::Headers: {
+				if (stream_id == 0) {
+					return ErrorCode::ProtocolError;
+				}
+				size_t start = 0;
+				size_t end = payload.len;
+				if (flags & Flag::Padded) {
+					if (payload.len < 1 || payload[0] >= payload.len) {
+						return ErrorCode::ProtocolError;
+					}
+					start = 1;
+					end -= payload[0];
+				}
+				if (flags & Flag::PriorityInfo) {
+					start += 5;
+				}
+				if (start > end) {
+					return ErrorCode::FrameSizeError;
+				}
+				self.header_block.len = 0;
+				self.header_block.push_many(&payload.buf[start], end - start);
+				self.header_block_end_stream = (flags & Flag::EndStream) != 0;
+				if ((flags & Flag::EndHeaders) == 0) {
+					self.header_block_stream_id = stream_id;
+					return ErrorCode::NoError;
+				}
+				return self.handle_header_block(stream_id);
+			}
+			case FrameType::Continuation: {
+				if (self.header_block_stream_id == 0) {
+					return ErrorCode::ProtocolError;
+				}
+				self.header_block.push_many(payload.buf, payload.len);
+				if (self.header_block.len > max_header_block_len) {
+					return ErrorCode::ProtocolError;
+				}
+				if ((flags & Flag::EndHeaders) == 0) {
+					return ErrorCode::NoError;
+				}
+				self.header_block_stream_id = 0;
+				return self.handle_header_block(stream_id);
+			}
+			case FrameType::RstStream: {
+				if (stream_id == 0) {
+					return ErrorCode::ProtocolError;
+				}
+				if (payload.len != 4) {
+					return ErrorCode::FrameSizeError;
+				}
+				size_t index = self.get_stream(stream_id);
+				if (index != SIZE_MAX) {
+					WTK_LOG("HTTP/2 stream reset (%u) (host:%s)", read_u32(payload.buf), self.client->addr.name);
+					self.fail_stream(index);
+				}
+				return ErrorCode::NoError;
+			}
+			case FrameType::Settings: {
+				return self.handle_settings(flags, stream_id, payload);
+			}
+			case FrameType::PushPromise: {
+				// push is disabled in our SETTINGS
+				return ErrorCode::ProtocolError;
+			}
+			case FrameType::Ping: {
+				if (stream_id != 0) {
+					return ErrorCode::ProtocolError;
+				}
+				if (payload.len != 8) {
+					return ErrorCode::FrameSizeError;
+				}
+				if ((flags & Flag::Ack) == 0) {
+					self.send_frame(FrameType::Ping, Flag::Ack, 0, payload);
+				}
+				return ErrorCode::NoError;
+			}
+			case FrameType::GoAway: {
+				if (stream_id != 0) {
+					return ErrorCode::ProtocolError;
+				}
+				if (payload.len < 8) {
+					return ErrorCode::FrameSizeError;
+				}
+				u32 last_stream_id = read_u32(payload.buf) & max_stream_id;
+				self.state = State::GoingAway;
+				self.fail_queued();
+				// streams above last_stream_id were never processed
+				for (size_t a = self.streams.len; a > 0; --a) {
+					if (self.streams[a - 1].id > last_stream_id) {
+						self.fail_stream(a - 1);
+					}
+				}
+				if (self.streams.len == 0) {
+					self.client->close();
+				}
+				return ErrorCode::NoError;
+			}
+			case FrameType::WindowUpdate: {
+				if (payload.len != 4) {
+					return ErrorCode::FrameSizeError;
+				}
+				u32 increment = read_u32(payload.buf) & max_stream_id;
+				if (increment == 0) {
+					return ErrorCode::ProtocolError;
+				}
+				if (stream_id == 0) {
+					self.send_window += increment;
+					if (self.send_window > max_window) {
+						return ErrorCode::FlowControlError;
+					}
+					self.send_bodies();
+					return ErrorCode::NoError;
+				}
+				size_t index = self.get_stream(stream_id);
+				if (index != SIZE_MAX) {
+					self.streams[index].send_window += increment;
+					if (self.streams[index].send_window > max_window) {
+						return ErrorCode::FlowControlError;
+					}
+					self.send_body(&self.streams[index]);
+				}
+				return ErrorCode::NoError;
+			}
+			default: {
+				// PRIORITY and unknown types are ignored
+				return ErrorCode::NoError;
+			}
+		}
+	}
+
+	ErrorCode handle_data(this auto& self, u8 flags, u32 stream_id, ctk::ar<const u8> payload) {
+		if (stream_id == 0) {
+			return ErrorCode::ProtocolError;
+		}
+		size_t start = 0;
+		size_t end = payload.len;
+		if (flags & Flag::Padded) {
+			if (payload.len < 1 || payload[0] >= payload.len) {
+				return ErrorCode::ProtocolError;
+			}
+			start = 1;
+			end -= payload[0];
+		}
+		// padding counts against flow control too
+		self.recv_unacked += payload.len;
+		if (self.recv_unacked > local_connection_window) {
+			return ErrorCode::FlowControlError;
+		}
+		if (self.recv_unacked >= local_connection_window / 2) {
+			self.send_window_update(0, self.recv_unacked);
+			self.recv_unacked = 0;
+		}
+		size_t index = self.get_stream(stream_id);
+		if (index == SIZE_MAX) {
+			// a stream that was reset or failed already
+			return ErrorCode::NoError;
+		}
+		Stream& stream = self.streams[index];
+		if (stream.got_final_headers == false) {
+			return ErrorCode::ProtocolError;
+		}
+		stream.recv_unacked += payload.len;
+		if (stream.recv_unacked > local_stream_window) {
+			return ErrorCode::FlowControlError;
+		}
+		stream.response.body.data.push_many(&payload.buf[start], end - start);
+		if (flags & Flag::EndStream) {
+			self.finish_stream(index);
+		} else if (stream.recv_unacked >= local_stream_window / 2) {
+			self.send_window_update(stream_id, stream.recv_unacked);
+			stream.recv_unacked = 0;
+		}
+		return ErrorCode::NoError;
+	}
+
+	ErrorCode handle_header_block(this auto& self, u32 stream_id) {
+		// decoded even for streams that are gone, the dynamic table has to stay in sync
+		self.header_lines.len = 0;
+		if (self.decoder.decode(ctk::ar<const u8>(self.header_block.buf, self.header_block.len), &self.header_lines) == false) {
+			return ErrorCode::CompressionError;
+		}
+		size_t index = self.get_stream(stream_id);
+		if (index == SIZE_MAX) {
+			return ErrorCode::NoError;
+		}
+		Stream& stream = self.streams[index];
+		ctk::ar<const u8> status(nullptr, 0);
+		size_t line_start = 0;
+		while (line_start < self.header_lines.len) {
+			size_t line_end = line_start;
+			while (self.header_lines[line_end] != '\n') {
+				line_end += 1;
+			}
+			ctk::ar<const u8> line(&self.header_lines.buf[line_start], line_end + 1 - line_start);
+			constexpr const char* status_name = ":status: ";
+			constexpr size_t status_name_len = std::strlen(status_name);
+			if (line[0] != ':') {
+				if (stream.got_final_headers || status.buf != nullptr) {
+					stream.response.headers.data.push_many(line.buf, line.len);
+				}
+			} else if (line.len > status_name_len && std::memcmp(line.buf, status_name, status_name_len) == 0) {
+				status = ctk::ar<const u8>(&line.buf[status_name_len], line.len - status_name_len - 1);
+			}
+			line_start = line_end + 1;
+		}
+		if (stream.got_final_headers == false) {
+			if (status.buf == nullptr) {
+				return ErrorCode::ProtocolError;
+			}
+			if (status.len == 3 && status[0] == '1') {
+				// an informational response, the final one follows
+				stream.response.headers.data.len = 0;
+				return ErrorCode::NoError;
+			}
+			constexpr const char* version = "HTTP/2 ";
+			stream.response.status.data.push_many((const u8*)version, std::strlen(version));
+			stream.response.status.data.push_many(status.buf, status.len);
+			stream.got_final_headers = true;
+		}
+		if (self.header_block_end_stream) {
+			self.finish_stream(index);
+		}
+		return ErrorCode::NoError;
+	}
+
+	ErrorCode handle_settings(this auto& self, u8 flags, u32 stream_id, ctk::ar<const u8> payload) {
+		if (stream_id != 0) {
+			return ErrorCode::ProtocolError;
+		}
+		if (flags & Flag::Ack) {
+			return payload.len == 0 ? ErrorCode::NoError : ErrorCode::FrameSizeError;
+		}
+		if (payload.len % 6 != 0) {
+			return ErrorCode::FrameSizeError;
+		}
+		for (size_t a = 0; a < payload.len; a += 6) {
+			u16 id = (payload[a] << 8) | payload[a + 1];
+			u32 value = read_u32(&payload.buf[a + 2]);
+			if (id == Setting::EnablePush) {
+				if (value > 1) {
+					return ErrorCode::ProtocolError;
+				}
+			} else if (id == Setting::MaxConcurrentStreams) {
+				self.max_concurrent_streams = value;
+			} else if (id == Setting::InitialWindowSize) {
+				if (value > max_window) {
+					return ErrorCode::FlowControlError;
+				}
+				// applies to the streams that are open already too
+				i64 delta = (i64)value - self.initial_window_size;
+				for (size_t b = 0; b < self.streams.len; ++b) {
+					self.streams[b].send_window += delta;
+					if (self.streams[b].send_window > max_window) {
+						return ErrorCode::FlowControlError;
+					}
+				}
+				self.initial_window_size = value;
+			} else if (id == Setting::MaxFrameSize) {
+				if (value < default_max_frame_size || value > 0xffffff) {
+					return ErrorCode::ProtocolError;
+				}
+				self.max_frame_size = value;
+			}
+			// HEADER_TABLE_SIZE only limits a table our encoder never fills
+		}
+		self.send_frame(FrameType::Settings, Flag::Ack, 0, ctk::ar<const u8>(nullptr, 0));
+		if (self.state == State::Settings) {
+			self.state = State::Open;
+		}
+		self.start_streams();
+		self.send_bodies();
+		return ErrorCode::NoError;
+	}
+
+	// Oldest first.
+	bool try_pop_response(this auto& self, HTTP::Response* out_response) {
+		if (self.responses_head == self.responses.len) {
+			return false;
+		}
+		*out_response = self.responses[self.responses_head];
+		self.responses_head += 1;
+		if (self.responses_head == self.responses.len) {
+			self.responses.len = 0;
+			self.responses_head = 0;
+		}
+		return true;
+	}
+
+	// Ids of requests that ended without a response (reset, refused or the connection closed).
+	bool try_pop_failure(this auto& self, size_t* out_id) {
+		if (self.failures_head == self.failures.len) {
+			return false;
+		}
+		*out_id = self.failures[self.failures_head];
+		self.failures_head += 1;
+		if (self.failures_head == self.failures.len) {
+			self.failures.len = 0;
+			self.failures_head = 0;
+		}
+		return true;
+	}
+};
\ No newline at end of file
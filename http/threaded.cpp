@@ -0,0 +1,312 @@
+// HTTP on a few loop threads. Any thread may submit, requests are spread round robin over the
+// loops and each loop runs its own HTTP, so the connections are sharded between them. Results come
+// back in completion order, either through the CompletionQueue named at submission or through a
+// callback run on the loop thread.
+struct ThreadedHTTP {
+	// Many threads push, one thread pops. push is a single atomic exchange, try_pop may miss a node
+	// whose push is still halfway done, the pusher signals afterwards so it is never lost.
+	template<typename T>
+	struct MPSCQueue {
+		struct Node {
+			Node* next;
+			T value;
+		};
+
+		// the last pushed node, swapped by producers
+		Node* head;
+		// the last popped node (a dummy at first), only touched by the consumer
+		Node* tail;
+
+		void create(this auto& self) {
+			self.tail = ctk::alloc<Node>(Node());
+			self.tail->next = nullptr;
+			self.head = self.tail;
+		}
+
+		// Frees the nodes left, destroying their values is up to the caller (drain with try_pop first).
+		void destroy(this auto& self) {
+			Node* node = self.tail;
+			while (node != nullptr) {
+				Node* next = node->next;
+				std::free(node);
+				node = next;
+			}
+		}
+
+		void push(this auto& self, T value) {
+			Node* node = ctk::alloc<Node>(Node(nullptr, value));
+			Node* prev = std::atomic_ref<Node*>(self.head).exchange(node, std::memory_order_acq_rel);
+			std::atomic_ref<Node*>(prev->next).store(node, std::memory_order_release);
+		}
+
+		bool try_pop(this auto& self, T* out_value) {
+			Node* next = std::atomic_ref<Node*>(self.tail->next).load(std::memory_order_acquire);
+			if (next == nullptr) {
+				return false;
+			}
+			*out_value = next->value;
+			std::free(self.tail);
+			self.tail = next;
+			return true;
+		}
+	};
+
+	struct Completion {
+		size_t id;
+		// false when the request failed before a response arrived, response is empty then
+		bool ok;
+		HTTP::Response response;
+	};
+
+	// Completions for one consuming thread, filled by any number of loops. Wait for event_fd in an
+	// epoll/poll loop or just poll try_pop.
+	struct CompletionQueue {
+		MPSCQueue<Completion> completions;
+		int event_fd;
+
+		static CompletionQueue* make() {
+			int event_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+			if (event_fd == -1) {
+				WTK_LOG("::eventfd failed (%i)", errno);
+				return nullptr;
+			}
+			CompletionQueue* queue = ctk::alloc<CompletionQueue>(CompletionQueue());
+			queue->completions.create();
+			queue->event_fd = event_fd;
+			return queue;
+		}
+
+		// Only once no request that names this queue is in flight anymore.
+		void destroy(this auto& self) {
+			Completion completion;
+			while (self.completions.try_pop(&completion)) {
+				completion.response.destroy();
+			}
+			self.completions.destroy();
+			::close(self.event_fd);
+		}
+
+		void push(this auto& self, Completion completion) {
+			self.completions.push(completion);
+			u64 count = 1;
+			if (::write(self.event_fd, &count, sizeof(count)) == -1) {
+				WTK_LOG("::write(eventfd) failed (%i)", errno);
+			}
+		}
+
+		// Call once when event_fd is readable, before draining with try_pop.
+		void clear_event(this auto& self) {
+			u64 count;
+			if (::read(self.event_fd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+				WTK_LOG("::read(eventfd) failed (%i)", errno);
+			}
+		}
+
+		// The caller owns completion.response.
+		bool try_pop(this auto& self, Completion* out_completion) {
+			return self.completions.try_pop(out_completion);
+		}
+	};
+
+	// Runs on the loop thread and owns completion->response, it must not block for long.
+	struct Callback {
+		void* user;
+		void (*func)(void* user, Completion* completion);
+	};
+
+	struct Submission {
+		size_t id;
+		HTTP::Request request;
+		CompletionQueue* completion_queue;
+		Callback callback;
+	};
+
+	// A submission handed to the loop's HTTP, which gave it an id of its own.
+	struct Pending {
+		size_t http_id;
+		Submission submission;
+	};
+
+	struct Loop {
+		HTTP http;
+		MPSCQueue<Submission> submissions;
+		// wakes the loop for new submissions and for stopping, watched by http's epoll instance
+		int event_fd;
+		ctk::gar<Pending> pending;
+		bool stopping;
+		// set by the thread as it returns, the loop may be destroyed then
+		bool stopped;
+		ctk::Thread thread;
+
+		bool create(this auto& self) {
+			self.event_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+			if (self.event_fd == -1) {
+				WTK_LOG("::eventfd failed (%i)", errno);
+				return false;
+			}
+			self.http.create();
+			struct epoll_event ev = {};
+			ev.events = EPOLLIN;
+			ev.data.fd = self.event_fd;
+			if (::epoll_ctl(self.http.epoll_fd, EPOLL_CTL_ADD, self.event_fd, &ev) == -1) {
+				WTK_PANIC("::epoll_ctl failed");
+			}
+			self.submissions.create();
+			self.pending.create_auto();
+			self.stopping = false;
+			self.stopped = false;
+			return true;
+		}
+
+		void destroy(this auto& self) {
+			Submission submission;
+			while (self.submissions.try_pop(&submission)) {
+				submission.request.destroy(-1);
+				submission.request.destroy_response();
+			}
+			self.submissions.destroy();
+			self.http.destroy();
+			self.pending.destroy();
+			::close(self.event_fd);
+		}
+
+		// Pushes to http everything submitted since the last call.
+		void take_submissions(this auto& self) {
+			Submission submission;
+			while (self.submissions.try_pop(&submission)) {
+				size_t http_id = self.http.push_request(submission.request);
+				if (http_id == 0) {
+					complete(submission, false, HTTP::Response());
+					continue;
+				}
+				self.pending.push(Pending(http_id, submission));
+			}
+		}
+
+		void deliver(this auto& self) {
+			HTTP::Response response;
+			while (self.http.try_pop_response(&response)) {
+				self.complete_pending(response.id, true, response);
+			}
+			size_t http_id;
+			while (self.http.try_pop_failure(&http_id)) {
+				self.complete_pending(http_id, false, HTTP::Response());
+			}
+		}
+
+		void complete_pending(this auto& self, size_t http_id, bool ok, HTTP::Response response) {
+			for (size_t a = 0; a < self.pending.len; ++a) {
+				if (self.pending[a].http_id == http_id) {
+					Submission submission = self.pending[a].submission;
+					self.pending.remove(a);
+					complete(submission, ok, response);
+					return;
+				}
+			}
+			WTK_PANIC("ThreadedHTTP::Loop::complete_pending failed");
+		}
+
+		static void complete(Submission submission, bool ok, HTTP::Response response) {
+			if (ok == false) {
+				response.create();
+			}
+			response.id = submission.id;
+			Completion completion = Completion(submission.id, ok, response);
+			if (submission.callback.func != nullptr) {
+				submission.callback.func(submission.callback.user, &completion);
+			} else {
+				submission.completion_queue->push(completion);
+			}
+		}
+
+		void clear_event(this auto& self) {
+			u64 count;
+			if (::read(self.event_fd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+				WTK_LOG("::read(eventfd) failed (%i)", errno);
+			}
+		}
+
+		void wake(this auto& self) {
+			u64 count = 1;
+			if (::write(self.event_fd, &count, sizeof(count)) == -1) {
+				WTK_LOG("::write(eventfd) failed (%i)", errno);
+			}
+		}
+	};
+
+	Loop* loops;
+	size_t loop_count;
+	size_t next_loop;
+	size_t next_id;
+
+	static void thread_func(Loop* loop) {
+		while (std::atomic_ref<bool>(loop->stopping).load(std::memory_order_acquire) == false) {
+			loop->clear_event();
+			loop->take_submissions();
+			// sleeps until a socket, the resolver or event_fd has something, or a connect attempt is due
+			loop->http.update(-1);
+			loop->deliver();
+		}
+		std::atomic_ref<bool>(loop->stopped).store(true, std::memory_order_release);
+	}
+
+	static ThreadedHTTP* make(size_t loop_count) {
+		ThreadedHTTP* threaded = ctk::alloc<ThreadedHTTP>(ThreadedHTTP());
+		threaded->loops = (Loop*)std::calloc(loop_count, sizeof(Loop));
+		threaded->loop_count = 0;
+		threaded->next_loop = 0;
+		threaded->next_id = 1;
+		for (size_t a = 0; a < loop_count; ++a) {
+			Loop* loop = &threaded->loops[threaded->loop_count];
+			if (loop->create() == false) {
+				break;
+			}
+			loop->thread.create<Loop>(thread_func, loop);
+			if (loop->thread.exists == false) {
+				loop->destroy();
+				break;
+			}
+			threaded->loop_count += 1;
+		}
+		if (threaded->loop_count == 0) {
+			WTK_LOG("ThreadedHTTP::make failed to start threads");
+			std::free(threaded->loops);
+			std::free(threaded);
+			return nullptr;
+		}
+		return threaded;
+	}
+
+	// Stops the loops, requests still in flight are dropped without a completion.
+	void destroy(this auto& self) {
+		for (size_t a = 0; a < self.loop_count; ++a) {
+			std::atomic_ref<bool>(self.loops[a].stopping).store(true, std::memory_order_release);
+			self.loops[a].wake();
+		}
+		for (size_t a = 0; a < self.loop_count; ++a) {
+			while (std::atomic_ref<bool>(self.loops[a].stopped).load(std::memory_order_acquire) == false) {
+				::sched_yield();
+			}
+			self.loops[a].destroy();
+		}
+		std::free(self.loops);
+	}
+
+	size_t submit(this auto& self, HTTP::Request request, CompletionQueue* completion_queue, Callback callback) {
+		size_t id = std::atomic_ref<size_t>(self.next_id).fetch_add(1, std::memory_order_relaxed);
+		size_t index = std::atomic_ref<size_t>(self.next_loop).fetch_add(1, std::memory_order_relaxed) % self.loop_count;
+		self.loops[index].submissions.push(Submission(id, request, completion_queue, callback));
+		self.loops[index].wake();
+		return id;
+	}
+
+	// Callable from any thread. The request belongs to the loop from here on, its addr has to stay
+	// valid until the completion, which carries the returned id, is in completion_queue.
+	size_t push_request(this auto& self, HTTP::Request request, CompletionQueue* completion_queue) {
+		return self.submit(request, completion_queue, Callback(nullptr, nullptr));
+	}
+
+	size_t push_request(this auto& self, HTTP::Request request, Callback callback) {
+		return self.submit(request, nullptr, callback);
+	}
+};
\ No newline at end of file
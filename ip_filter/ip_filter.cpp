@@ -0,0 +1,215 @@
+// A set of IPv4/IPv6 addresses and CIDR prefixes. Single addresses live in a hash set, shorter
+// prefixes in a binary trie, so a lookup costs one probe plus at most 32/128 trie steps no matter
+// how many entries there are. IPv4 keys are stored as IPv4-mapped IPv6 addresses.
+struct IPFilter {
+	enum class Mode {
+		// matching peers are refused
+		Deny,
+		// only matching peers are accepted
+		Allow,
+	};
+
+	struct Key {
+		u64 hi;
+		u64 lo;
+	};
+
+	struct Slot {
+		Key key;
+		bool used;
+	};
+
+	struct Node {
+		u32 child[2];
+		bool terminal;
+	};
+
+	constexpr static size_t initial_slot_count = 64;
+	constexpr static u32 root_v6 = 0;
+	constexpr static u32 root_v4 = 1;
+
+	Mode mode;
+	Slot* slots;
+	size_t slot_count;
+	size_t used_count;
+	// child index 0 means no child, the roots can never be children
+	ctk::gar<Node> nodes;
+
+	static IPFilter* make(Mode mode) {
+		IPFilter* filter = ctk::alloc<IPFilter>(IPFilter());
+		filter->mode = mode;
+		filter->slots = (Slot*)std::calloc(initial_slot_count, sizeof(Slot));
+		filter->slot_count = initial_slot_count;
+		filter->used_count = 0;
+		filter->nodes.create_auto();
+		filter->nodes.push(Node());
+		filter->nodes.push(Node());
+		return filter;
+	}
+
+	void destroy(this auto& self) {
+		std::free(self.slots);
+		self.nodes.destroy();
+	}
+
+	static Key make_key(const Addr& addr) {
+		u8 bytes[16] = {};
+		if (addr.type == Addr::Type::IPv4) {
+			bytes[10] = 0xff;
+			bytes[11] = 0xff;
+			std::memcpy(&bytes[12], &addr.ip.v4, 4);
+		} else {
+			std::memcpy(bytes, &addr.ip.v6, 16);
+		}
+		Key key;
+		key.hi = 0;
+		key.lo = 0;
+		for (size_t a = 0; a < 8; ++a) {
+			key.hi = (key.hi << 8) | bytes[a];
+			key.lo = (key.lo << 8) | bytes[8 + a];
+		}
+		return key;
+	}
+
+	static size_t hash_key(Key key) {
+		u64 hash = key.hi * 0x9E3779B97F4A7C15ull ^ key.lo;
+		hash ^= hash >> 33;
+		hash *= 0xFF51AFD7ED558CCDull;
+		hash ^= hash >> 33;
+		return (size_t)hash;
+	}
+
+	// bit 0 is the most significant bit of the address
+	static u32 get_bit(Key key, size_t bit) {
+		return bit < 64 ? (key.hi >> (63 - bit)) & 1 : (key.lo >> (127 - bit)) & 1;
+	}
+
+	void insert_slot(this auto& self, Key key) {
+		size_t mask = self.slot_count - 1;
+		for (size_t a = hash_key(key) & mask;; a = (a + 1) & mask) {
+			if (self.slots[a].used == false) {
+				self.slots[a] = Slot(key, true);
+				self.used_count += 1;
+				return;
+			}
+			if (self.slots[a].key.hi == key.hi && self.slots[a].key.lo == key.lo) {
+				return;
+			}
+		}
+	}
+
+	void add_address(this auto& self, Key key) {
+		if ((self.used_count + 1) * 2 > self.slot_count) {
+			Slot* old_slots = self.slots;
+			size_t old_slot_count = self.slot_count;
+			self.slot_count *= 2;
+			self.slots = (Slot*)std::calloc(self.slot_count, sizeof(Slot));
+			self.used_count = 0;
+			for (size_t a = 0; a < old_slot_count; ++a) {
+				if (old_slots[a].used) {
+					self.insert_slot(old_slots[a].key);
+				}
+			}
+			std::free(old_slots);
+		}
+		self.insert_slot(key);
+	}
+
+	void add_prefix(this auto& self, u32 root, Key key, size_t first_bit, size_t prefix_len) {
+		u32 node = root;
+		for (size_t a = 0; a < prefix_len; ++a) {
+			if (self.nodes[node].terminal) {
+				// already covered by a shorter prefix
+				return;
+			}
+			u32 bit = get_bit(key, first_bit + a);
+			if (self.nodes[node].child[bit] == 0) {
+				self.nodes[node].child[bit] = (u32)self.nodes.len;
+				self.nodes.push(Node());
+			}
+			node = self.nodes[node].child[bit];
+		}
+		self.nodes[node].terminal = true;
+	}
+
+	// prefix_len is counted in the address's own family, 0 to 32 for IPv4 and 0 to 128 for IPv6.
+	bool add(this auto& self, Addr addr, size_t prefix_len) {
+		bool is_v4 = addr.type == Addr::Type::IPv4;
+		if ((is_v4 == false && addr.type != Addr::Type::IPv6) || prefix_len > (is_v4 ? 32 : 128)) {
+			return false;
+		}
+		Key key = make_key(addr);
+		if (prefix_len == (is_v4 ? 32 : 128)) {
+			self.add_address(key);
+		} else if (is_v4) {
+			self.add_prefix(root_v4, key, 96, prefix_len);
+		} else {
+			self.add_prefix(root_v6, key, 0, prefix_len);
+		}
+		return true;
+	}
+
+	// Accepts "192.0.2.1", "192.0.2.0/24", "2001:db8::1" and "2001:db8::/32".
+	bool add(this auto& self, const char* text) {
+		char address[INET6_ADDRSTRLEN];
+		const char* slash = std::strchr(text, '/');
+		size_t address_len = slash == nullptr ? std::strlen(text) : slash - text;
+		if (address_len >= sizeof(address)) {
+			return false;
+		}
+		std::memcpy(address, text, address_len);
+		address[address_len] = '\0';
+		Addr addr;
+		size_t max_prefix_len;
+		struct in_addr v4;
+		struct in6_addr v6;
+		if (::inet_pton(AF_INET, address, &v4) == 1) {
+			addr = Addr::make_ipv4(v4.s_addr, 0);
+			max_prefix_len = 32;
+		} else if (::inet_pton(AF_INET6, address, &v6) == 1) {
+			addr = Addr::make_ipv6(v6, 0);
+			max_prefix_len = 128;
+		} else {
+			return false;
+		}
+		size_t prefix_len = max_prefix_len;
+		if (slash != nullptr) {
+			const char* end = text + std::strlen(text);
+			std::from_chars_result result = std::from_chars(slash + 1, end, prefix_len);
+			if (result.ec != std::errc() || result.ptr != end || slash + 1 == end) {
+				return false;
+			}
+		}
+		return self.add(addr, prefix_len);
+	}
+
+	bool contains(this const auto& self, const Addr& addr) {
+		if (addr.type != Addr::Type::IPv4 && addr.type != Addr::Type::IPv6) {
+			return false;
+		}
+		Key key = make_key(addr);
+		size_t mask = self.slot_count - 1;
+		for (size_t a = hash_key(key) & mask; self.slots[a].used; a = (a + 1) & mask) {
+			if (self.slots[a].key.hi == key.hi && self.slots[a].key.lo == key.lo) {
+				return true;
+			}
+		}
+		bool is_v4 = addr.type == Addr::Type::IPv4;
+		u32 node = is_v4 ? root_v4 : root_v6;
+		size_t first_bit = is_v4 ? 96 : 0;
+		for (size_t a = first_bit; a < 128; ++a) {
+			if (self.nodes[node].terminal) {
+				return true;
+			}
+			node = self.nodes[node].child[get_bit(key, a)];
+			if (node == 0) {
+				return false;
+			}
+		}
+		return self.nodes[node].terminal;
+	}
+
+	bool allows(this const auto& self, const Addr& addr) {
+		return self.contains(addr) == (self.mode == Mode::Allow);
+	}
+};
\ No newline at end of file
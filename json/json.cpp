@@ -1,9 +1,82 @@
+u32 JSON::Key::hash_of(ctk::ar<const u8> name) {
+	u32 hash = 2166136261;
+	for (size_t a = 0; a < name.len; ++a) {
+		hash = (hash ^ name.buf[a]) * 16777619;
+	}
+	return hash;
+}
+
+JSON::Key JSON::Key::make(const char* name) {
+	return make(ctk::ar<const u8>((const u8*)name, std::strlen(name)));
+}
+
+JSON::Key JSON::Key::make(ctk::ar<const u8> name) {
+	return Key(name, hash_of(name));
+}
+
 JSON::Value JSON::Value::create_of_type(JSON::Value::Type type) {
 	Value value = Value();
 	value.type = type;
 	return value;
 }
 
+void JSON::Arena::create(this JSON::Arena& self, size_t block_size) {
+	self.head = nullptr;
+	self.block_size = block_size < min_block_size ? min_block_size : block_size;
+}
+
+void JSON::Arena::destroy(this JSON::Arena& self) {
+	Block* block = self.head;
+	while (block != nullptr) {
+		Block* next = block->next;
+		std::free(block);
+		block = next;
+	}
+	self.head = nullptr;
+}
+
+void JSON::Arena::reset(this JSON::Arena& self) {
+	if (self.head == nullptr) {
+		return;
+	}
+	Block* block = self.head->next;
+	while (block != nullptr) {
+		Block* next = block->next;
+		std::free(block);
+		block = next;
+	}
+	self.head->next = nullptr;
+	self.head->len = 0;
+}
+
+void* JSON::Arena::alloc(this JSON::Arena& self, size_t size, size_t align) {
+	if (self.head != nullptr) {
+		uintptr_t base = (uintptr_t)(self.head + 1);
+		uintptr_t start = (base + self.head->len + align - 1) & ~(uintptr_t)(align - 1);
+		if (start + size <= base + self.head->cap) {
+			self.head->len = start + size - base;
+			return (void*)start;
+		}
+		self.block_size *= 2;
+	}
+	size_t cap = self.block_size;
+	if (cap < size + align) {
+		cap = size + align;
+	}
+	Block* block = (Block*)std::malloc(sizeof(Block) + cap);
+	if (block == nullptr) {
+		WTK_PANIC("std::malloc failed");
+	}
+	block->next = self.head;
+	block->cap = cap;
+	block->len = 0;
+	self.head = block;
+	uintptr_t base = (uintptr_t)(block + 1);
+	uintptr_t start = (base + align - 1) & ~(uintptr_t)(align - 1);
+	block->len = start + size - base;
+	return (void*)start;
+}
+
 void JSON::Value::destroy(this JSON::Value& self) {
 	switch (self.type) {
 		case Type::Object: {
@@ -11,6 +84,8 @@ void JSON::Value::destroy(this JSON::Value& self) {
 				self.fields[i].destroy();
 			}
 			self.fields.destroy();
+			std::free(self.field_index);
+			self.field_index = nullptr;
 			break;
 		}
 		case Type::Array: {
@@ -29,15 +104,65 @@ void JSON::Value::destroy(this JSON::Value& self) {
 	self.type = Type::Error;
 }
 
+void JSON::Value::build_index(this JSON::Value& self, JSON::Arena* arena) {
+	if (self.type != Type::Object || self.field_index != nullptr) {
+		return;
+	}
+	size_t slot_count = 4;
+	while (slot_count < self.fields.len * 2) {
+		slot_count *= 2;
+	}
+	size_t size = sizeof(FieldIndex) + sizeof(u32) * slot_count;
+	FieldIndex* index;
+	if (arena == nullptr) {
+		index = (FieldIndex*)std::malloc(size);
+		if (index == nullptr) {
+			WTK_PANIC("std::malloc failed");
+		}
+	} else {
+		index = (FieldIndex*)arena->alloc(size, alignof(FieldIndex));
+	}
+	index->mask = slot_count - 1;
+	u32* slots = (u32*)(index + 1);
+	std::memset(slots, 0, sizeof(u32) * slot_count);
+	for (size_t a = 0; a < self.fields.len; ++a) {
+		u32 slot = self.fields[a].name_hash & index->mask;
+		while (slots[slot] != 0) {
+			slot = (slot + 1) & index->mask;
+		}
+		slots[slot] = a + 1;
+	}
+	self.field_index = index;
+}
+
 JSON::Value JSON::Value::get_value(this const JSON::Value& self, const char* name) {
+	return self.get_value(Key::make(name));
+}
+
+JSON::Value JSON::Value::get_value(this const JSON::Value& self, ctk::ar<const u8> name) {
+	return self.get_value(Key::make(name));
+}
+
+JSON::Value JSON::Value::get_value(this const JSON::Value& self, const JSON::Key& key) {
 	if (self.type != Type::Object) {
 		return Value::create_of_type(Value::Type::Error);
 	}
-	size_t name_len = strlen(name);
+	if (self.field_index != nullptr) {
+		const u32* slots = (const u32*)(self.field_index + 1);
+		u32 slot = key.hash & self.field_index->mask;
+		while (slots[slot] != 0) {
+			const Field& field = self.fields[slots[slot] - 1];
+			if (field.name_hash == key.hash && field.name.len == key.name.len && std::memcmp(field.name.buf, key.name.buf, key.name.len) == 0) {
+				return field.value;
+			}
+			slot = (slot + 1) & self.field_index->mask;
+		}
+		return Value::create_of_type(Value::Type::Error);
+	}
 	for (size_t a = 0; a < self.fields.len; ++a) {
-		ctk::gar<u8> field_name = self.fields[a].name;
-		if (field_name.len == name_len && std::memcmp(field_name.buf, name, name_len) == 0) {
-			return self.fields[a].value;
+		const Field& field = self.fields[a];
+		if (field.name_hash == key.hash && field.name.len == key.name.len && std::memcmp(field.name.buf, key.name.buf, key.name.len) == 0) {
+			return field.value;
 		}
 	}
 	return Value::create_of_type(Value::Type::Error);
@@ -48,6 +173,11 @@ void JSON::Field::destroy(this JSON::Field& self) {
 	self.value.destroy();
 }
 
+void JSON::Document::destroy(this JSON::Document& self) {
+	self.arena.destroy();
+	self.root = Value::create_of_type(Value::Type::Error);
+}
+
 void skip_whitespace(ctk::ar<const u8> data, size_t* index) {
 	while (*index < data.len) {
 		char character = data[*index];
@@ -71,7 +201,7 @@ bool consume_char(ctk::ar<const u8> data, size_t* index, char expected) {
 
 bool consume_str(ctk::ar<const u8> data, size_t* index, const char* expected) {
 	size_t len = strlen(expected);
-	if (*index + len >= data.len) {
+	if (*index + len > data.len) {
 		return false;
 	}
 	bool valid = std::memcmp(&data[*index], expected, len) == 0;
@@ -81,182 +211,1773 @@ bool consume_str(ctk::ar<const u8> data, size_t* index, const char* expected) {
 	return valid;
 }
 
-ctk::gar<u8> JSON::parse_string(ctk::ar<const u8> data, size_t* index) {
-	ctk::gar<u8> string;
-	string.create_auto();
-	while (*index < data.len) {
-		u8 character = data[*index];
-		*index += 1;
+// Returns the offset of the first '"', '\\' or control character, or len if there is none.
+size_t find_string_special(const u8* buf, size_t len) {
+	size_t a = 0;
+#ifdef __SSE2__
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i control = _mm_set1_epi8(31);
+	const __m128i del = _mm_set1_epi8(127);
+	for (; a + 16 <= len; a += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i*)&buf[a]);
+		__m128i special = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash));
+		special = _mm_or_si128(special, _mm_cmpeq_epi8(_mm_min_epu8(chunk, control), chunk));
+		special = _mm_or_si128(special, _mm_cmpeq_epi8(chunk, del));
+		int mask = _mm_movemask_epi8(special);
+		if (mask != 0) {
+			return a + __builtin_ctz(mask);
+		}
+	}
+#endif
+	for (; a < len; ++a) {
+		u8 character = buf[a];
+		if (character == '"' || character == '\\' || character < 32 || character == 127) {
+			return a;
+		}
+	}
+	return len;
+}
+
+struct StructuralMasks {
+	u64 quote;
+	u64 backslash;
+	u64 whitespace;
+	u64 op;
+};
+
+void classify_block_scalar(const u8* block, StructuralMasks* masks) {
+	*masks = StructuralMasks();
+	for (size_t a = 0; a < 64; ++a) {
+		u64 bit = (u64)1 << a;
+		switch (block[a]) {
+			case '"': { masks->quote |= bit; break; }
+			case '\\': { masks->backslash |= bit; break; }
+			case ' ':
+			case '\t':
+			case '\n':
+			case '\r': { masks->whitespace |= bit; break; }
+			case '{':
+			case '}':
+			case '[':
+			case ']':
+			case ':':
+			case ',': { masks->op |= bit; break; }
+			default: {}
+		}
+	}
+}
+
+#ifdef __SSE2__
+void classify_block_sse2(const u8* block, StructuralMasks* masks) {
+	*masks = StructuralMasks();
+	for (size_t a = 0; a < 64; a += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i*)&block[a]);
+		__m128i lower = _mm_or_si128(chunk, _mm_set1_epi8(0x20));
+		__m128i whitespace = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\t'))),
+			_mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\r')))
+		);
+		__m128i op = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(lower, _mm_set1_epi8('{')), _mm_cmpeq_epi8(lower, _mm_set1_epi8('}'))),
+			_mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(':')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8(',')))
+		);
+		masks->quote |= (u64)(u16)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('"'))) << a;
+		masks->backslash |= (u64)(u16)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\\'))) << a;
+		masks->whitespace |= (u64)(u16)_mm_movemask_epi8(whitespace) << a;
+		masks->op |= (u64)(u16)_mm_movemask_epi8(op) << a;
+	}
+}
+
+__attribute__((target("avx2")))
+void classify_block_avx2(const u8* block, StructuralMasks* masks) {
+	*masks = StructuralMasks();
+	for (size_t a = 0; a < 64; a += 32) {
+		__m256i chunk = _mm256_loadu_si256((const __m256i*)&block[a]);
+		__m256i lower = _mm256_or_si256(chunk, _mm256_set1_epi8(0x20));
+		__m256i whitespace = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\t'))),
+			_mm256_or_si256(_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\r')))
+		);
+		__m256i op = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(lower, _mm256_set1_epi8('{')), _mm256_cmpeq_epi8(lower, _mm256_set1_epi8('}'))),
+			_mm256_or_si256(_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(':')), _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(',')))
+		);
+		masks->quote |= (u64)(u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('"'))) << a;
+		masks->backslash |= (u64)(u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\\'))) << a;
+		masks->whitespace |= (u64)(u32)_mm256_movemask_epi8(whitespace) << a;
+		masks->op |= (u64)(u32)_mm256_movemask_epi8(op) << a;
+	}
+}
+#endif
+
+JSON::StructuralIndex::Kernel JSON::StructuralIndex::detect_kernel() {
+#ifdef __SSE2__
+	static Kernel kernel = __builtin_cpu_supports("avx2") ? Kernel::AVX2 : Kernel::SSE2;
+	return kernel;
+#else
+	return Kernel::Scalar;
+#endif
+}
+
+void JSON::StructuralIndex::create(this JSON::StructuralIndex& self) {
+	self.positions.create_auto();
+}
+
+void JSON::StructuralIndex::destroy(this JSON::StructuralIndex& self) {
+	self.positions.destroy();
+}
+
+bool JSON::StructuralIndex::build(this JSON::StructuralIndex& self, ctk::ar<const u8> data, Kernel kernel) {
+	constexpr u64 odd_bits = 0xaaaaaaaaaaaaaaaa;
+	self.positions.len = 0;
+	if (data.len >= UINT32_MAX) {
+		return false;
+	}
+	u64 prev_escaped = 0;
+	u64 prev_in_string = 0;
+	u64 prev_scalar = 0;
+	for (size_t offset = 0; offset < data.len; offset += 64) {
+		const u8* block = &data.buf[offset];
+		u8 tail[64];
+		if (data.len - offset < 64) {
+			std::memset(tail, ' ', 64);
+			std::memcpy(tail, block, data.len - offset);
+			block = tail;
+		}
+		StructuralMasks masks;
+		switch (kernel) {
+#ifdef __SSE2__
+			case Kernel::AVX2: { classify_block_avx2(block, &masks); break; }
+			case Kernel::SSE2: { classify_block_sse2(block, &masks); break; }
+#endif
+			default: { classify_block_scalar(block, &masks); break; }
+		}
+		// characters preceded by an odd run of backslashes are escaped
+		u64 escaped = prev_escaped;
+		if (masks.backslash != 0) {
+			u64 potential_escape = masks.backslash & ~prev_escaped;
+			u64 escape_code = (((potential_escape << 1) | odd_bits) - potential_escape) ^ odd_bits;
+			escaped = escape_code ^ (masks.backslash | prev_escaped);
+			prev_escaped = (escape_code & masks.backslash) >> 63;
+		} else {
+			prev_escaped = 0;
+		}
+		u64 quote = masks.quote & ~escaped;
+		// prefix xor of the quotes marks everything from an opening quote up to its closing quote
+		u64 in_string = quote;
+		in_string ^= in_string << 1;
+		in_string ^= in_string << 2;
+		in_string ^= in_string << 4;
+		in_string ^= in_string << 8;
+		in_string ^= in_string << 16;
+		in_string ^= in_string << 32;
+		in_string ^= prev_in_string;
+		prev_in_string = (u64)((int64_t)in_string >> 63);
+		// scalars (numbers, literals, garbage) are indexed at their first character
+		u64 scalar = ~(masks.op | masks.whitespace);
+		u64 nonquote_scalar = scalar & ~quote;
+		u64 follows_nonquote_scalar = (nonquote_scalar << 1) | prev_scalar;
+		prev_scalar = nonquote_scalar >> 63;
+		u64 string_tail = in_string ^ quote;
+		u64 structural = (masks.op | (scalar & ~follows_nonquote_scalar)) & ~string_tail;
+		while (structural != 0) {
+			self.positions.push((u32)(offset + __builtin_ctzll(structural)));
+			structural &= structural - 1;
+		}
+	}
+	self.positions.push((u32)data.len);
+	return true;
+}
+
+// Returns the offset of the first '"' or bracket, or len if there is none.
+size_t find_container_special(const u8* buf, size_t len) {
+	size_t a = 0;
+#ifdef __SSE2__
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i open = _mm_set1_epi8('{');
+	const __m128i close = _mm_set1_epi8('}');
+	const __m128i lower = _mm_set1_epi8(0x20);
+	for (; a + 16 <= len; a += 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i*)&buf[a]);
+		// '[' and ']' are '{' and '}' without the 0x20 bit
+		__m128i folded = _mm_or_si128(chunk, lower);
+		__m128i special = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_or_si128(_mm_cmpeq_epi8(folded, open), _mm_cmpeq_epi8(folded, close)));
+		int mask = _mm_movemask_epi8(special);
+		if (mask != 0) {
+			return a + __builtin_ctz(mask);
+		}
+	}
+#endif
+	for (; a < len; ++a) {
+		u8 character = buf[a];
+		if (character == '"' || character == '{' || character == '}' || character == '[' || character == ']') {
+			return a;
+		}
+	}
+	return len;
+}
+
+// Returns the index after the closing quote of the string starting after its opening quote at index.
+size_t skip_string(ctk::ar<const u8> data, size_t index) {
+	while (index < data.len) {
+		index += find_string_special(&data.buf[index], data.len - index);
+		if (index >= data.len) {
+			break;
+		}
+		u8 character = data.buf[index];
+		index += 1;
 		if (character == '"') {
-			return string;
+			return index;
 		}
 		if (character == '\\') {
-			character = data[*index];
-			switch (character) {
-				case '"':
-				case '\\':
-				case '/': { string.push(character); break; }
-				case 'b': { string.push('\b'); break; }
-				case 'f': { string.push('\f'); break; }
-				case 'n': { string.push('\n'); break; }
-				case 'r': { string.push('\r'); break; }
-				case 't': { string.push('\t'); break; }
-				default: {
-					goto error;
+			index += 1;
+		}
+	}
+	return data.len;
+}
+
+// Returns the index after the value starting at index, without validating it.
+size_t skip_value(ctk::ar<const u8> data, size_t index) {
+	if (index >= data.len) {
+		return data.len;
+	}
+	u8 character = data.buf[index];
+	if (character == '"') {
+		return skip_string(data, index + 1);
+	}
+	if (character == '{' || character == '[') {
+		size_t depth = 0;
+		while (index < data.len) {
+			index += find_container_special(&data.buf[index], data.len - index);
+			if (index >= data.len) {
+				break;
+			}
+			character = data.buf[index];
+			if (character == '"') {
+				index = skip_string(data, index + 1);
+				continue;
+			}
+			index += 1;
+			if (character == '{' || character == '[') {
+				depth += 1;
+			} else {
+				depth -= 1;
+				if (depth == 0) {
+					return index;
 				}
 			}
-			*index += 1;
-			continue;
 		}
-		if (character >= 32 && character != 127) {
-			string.push(character);
-			continue;
+		return data.len;
+	}
+	while (index < data.len) {
+		character = data.buf[index];
+		if (character == ' ' || character == '\n' || character == '\r' || character == '\t' || character == ',' || character == ']' || character == '}' || character == ':') {
+			break;
 		}
-		goto error;
+		index += 1;
 	}
-	error:
-	string.destroy();
-	return ctk::gar<u8>();
+	return index;
 }
 
-JSON::Value JSON::parse_object(ctk::ar<const u8> data, size_t* index) {
-	Value value = Value::create_of_type(Value::Type::Object);
-	value.fields.create_auto();
-	bool was_comma = false;
-	parse_field:
-	skip_whitespace(data, index);
-	if (!was_comma) {
-		if (consume_char(data, index, '}')) {
-			return value;
-		} else if (value.fields.len != 0) {
-			value.fields.destroy();
-			return Value::create_of_type(Value::Type::Error);
+void JSON::Parser::create(this JSON::Parser& self) {
+	self.data = ctk::ar<const u8>(nullptr, 0);
+	self.index = 0;
+	self.arena = nullptr;
+	self.zero_copy = false;
+	self.max_depth = default_max_depth;
+	self.value_stack.create_auto();
+	self.field_stack.create_auto();
+	self.string_stack.create_auto();
+	self.frame_stack.create_auto();
+	self.structural_index.create();
+}
+
+void JSON::Parser::destroy(this JSON::Parser& self) {
+	self.value_stack.destroy();
+	self.field_stack.destroy();
+	self.string_stack.destroy();
+	self.frame_stack.destroy();
+	self.structural_index.destroy();
+}
+
+JSON::Value JSON::Parser::parse(this JSON::Parser& self, ctk::ar<const u8> data, JSON::Arena* arena, JSON::Options options) {
+	self.data = data;
+	self.index = 0;
+	self.arena = arena;
+	self.zero_copy = arena != nullptr && options.zero_copy;
+	self.max_depth = options.max_depth;
+	if (options.max_size != 0 && data.len > options.max_size) {
+		return Value::create_of_type(Value::Type::Error);
+	}
+	StructuralIndex::Kernel kernel = StructuralIndex::detect_kernel();
+	Backend backend = options.backend;
+	if (backend == Backend::Auto) {
+		bool use_structural = data.len >= structural_min_len && kernel != StructuralIndex::Kernel::Scalar;
+		backend = use_structural ? Backend::Structural : Backend::Recursive;
+	}
+	if (backend == Backend::Structural && self.structural_index.build(data, kernel)) {
+		return self.parse_structural();
+	}
+	return self.parse_value();
+}
+
+bool parse_hex4(ctk::ar<const u8> data, size_t index, u32* out_value) {
+	if (index + 4 > data.len) {
+		return false;
+	}
+	u32 value = 0;
+	for (size_t a = index; a < index + 4; ++a) {
+		u8 character = data[a];
+		if (character >= '0' && character <= '9') {
+			value = (value << 4) | (character - '0');
+		} else if ((character | 0x20) >= 'a' && (character | 0x20) <= 'f') {
+			value = (value << 4) | ((character | 0x20) - 'a' + 10);
+		} else {
+			return false;
 		}
 	}
-	if (!consume_char(data, index, '"')) {
-		value.fields.destroy();
-		return Value::create_of_type(Value::Type::Error);
+	*out_value = value;
+	return true;
+}
+
+void push_utf8(ctk::gar<u8>* string, u32 code_point) {
+	if (code_point < 0x80) {
+		string->push(code_point);
+	} else if (code_point < 0x800) {
+		string->push(0xc0 | (code_point >> 6));
+		string->push(0x80 | (code_point & 0x3f));
+	} else if (code_point < 0x10000) {
+		string->push(0xe0 | (code_point >> 12));
+		string->push(0x80 | ((code_point >> 6) & 0x3f));
+		string->push(0x80 | (code_point & 0x3f));
+	} else {
+		string->push(0xf0 | (code_point >> 18));
+		string->push(0x80 | ((code_point >> 12) & 0x3f));
+		string->push(0x80 | ((code_point >> 6) & 0x3f));
+		string->push(0x80 | (code_point & 0x3f));
 	}
-	ctk::gar<u8> field_name = parse_string(data, index);
-	if (field_name.buf == nullptr) {
-		value.fields.destroy();
-		return Value::create_of_type(Value::Type::Error);
+}
+
+bool JSON::decode_string(ctk::ar<const u8> data, size_t* index, ctk::gar<u8>* out_string) {
+	ctk::gar<u8>& string = *out_string;
+	while (*index < data.len) {
+		size_t run_start = *index;
+		*index += find_string_special(&data.buf[run_start], data.len - run_start);
+		string.push_many(&data.buf[run_start], *index - run_start);
+		if (*index >= data.len) {
+			break;
+		}
+		u8 character = data[*index];
+		*index += 1;
+		if (character == '"') {
+			return true;
+		}
+		if (character != '\\' || *index >= data.len) {
+			return false;
+		}
+		character = data[*index];
+		switch (character) {
+			case '"':
+			case '\\':
+			case '/': { string.push(character); break; }
+			case 'b': { string.push('\b'); break; }
+			case 'f': { string.push('\f'); break; }
+			case 'n': { string.push('\n'); break; }
+			case 'r': { string.push('\r'); break; }
+			case 't': { string.push('\t'); break; }
+			case 'u': {
+				u32 code_point;
+				if (!parse_hex4(data, *index + 1, &code_point)) {
+					return false;
+				}
+				*index += 4;
+				if (code_point >= 0xdc00 && code_point <= 0xdfff) {
+					return false;
+				}
+				if (code_point >= 0xd800 && code_point <= 0xdbff) {
+					u32 low_surrogate;
+					if (*index + 2 >= data.len || data[*index + 1] != '\\' || data[*index + 2] != 'u') {
+						return false;
+					}
+					if (!parse_hex4(data, *index + 3, &low_surrogate) || low_surrogate < 0xdc00 || low_surrogate > 0xdfff) {
+						return false;
+					}
+					code_point = 0x10000 + ((code_point - 0xd800) << 10) + (low_surrogate - 0xdc00);
+					*index += 6;
+				}
+				push_utf8(&string, code_point);
+				break;
+			}
+			default: {
+				return false;
+			}
+		}
+		*index += 1;
 	}
-	skip_whitespace(data, index);
-	if (!consume_char(data, index, ':')) {
-		value.fields.destroy();
-		return Value::create_of_type(Value::Type::Error);
+	return false;
+}
+
+bool JSON::Parser::parse_string(this JSON::Parser& self, ctk::gar<u8>* out_string, bool* out_escaped) {
+	size_t start = self.index;
+	self.index += find_string_special(&self.data.buf[start], self.data.len - start);
+	if (self.index < self.data.len && self.data[self.index] == '"') {
+		self.index += 1;
+		*out_escaped = false;
+		if (self.zero_copy) {
+			*out_string = ctk::gar<u8>();
+			out_string->buf = (u8*)&self.data.buf[start];
+			out_string->len = self.index - 1 - start;
+		} else {
+			*out_string = self.store(&self.data.buf[start], self.index - 1 - start);
+		}
+		return true;
 	}
-	Value field_value = parse_value(data, index);
-	if (field_value.type == Value::Type::Error) {
-		value.fields.destroy();
-		return Value::create_of_type(Value::Type::Error);
+	self.string_stack.len = 0;
+	self.index = start;
+	if (!decode_string(self.data, &self.index, &self.string_stack)) {
+		return false;
 	}
-	if (value.fields.buf == nullptr) {
-		value.fields.create_auto();
+	*out_string = self.store(self.string_stack.buf, self.string_stack.len);
+	*out_escaped = true;
+	return true;
+}
+
+// pushes the field for a key whose opening quote is consumed, its value is set by append_value
+bool JSON::Parser::parse_key(this JSON::Parser& self) {
+	ctk::gar<u8> name;
+	bool name_escaped;
+	if (!self.parse_string(&name, &name_escaped)) {
+		return false;
 	}
-	value.fields.push(Field(field_name, field_value));
-	skip_whitespace(data, index);
-	was_comma = consume_char(data, index, ',');
-	goto parse_field;
+	u32 name_hash = Key::hash_of(ctk::ar<const u8>(name.buf, name.len));
+	self.field_stack.push(Field(name, Value::create_of_type(Value::Type::Error), name_escaped, name_hash));
+	return true;
 }
 
-JSON::Value JSON::parse_array(ctk::ar<const u8> data, size_t* index) {
-	Value value = Value::create_of_type(Value::Type::Array);
-	value.array.create_auto();
-	bool was_comma = false;
-	parse_value:
-	skip_whitespace(data, index);
-	if (!was_comma) {
-		if (consume_char(data, index, ']')) {
-			return value;
-		} else if (value.array.len != 0) {
-			value.array.destroy();
-			return Value::create_of_type(Value::Type::Error);
+void discard_fields(JSON::Parser& parser, size_t base) {
+	if (parser.arena == nullptr) {
+		for (size_t a = base; a < parser.field_stack.len; ++a) {
+			parser.field_stack[a].destroy();
 		}
 	}
-	Value elem_value = parse_value(data, index);
-	if (elem_value.type == Value::Type::Error) {
-		value.array.destroy();
-		return Value::create_of_type(Value::Type::Error);
+	parser.field_stack.remove_many(base, parser.field_stack.len - base);
+}
+
+void discard_values(JSON::Parser& parser, size_t base) {
+	if (parser.arena == nullptr) {
+		for (size_t a = base; a < parser.value_stack.len; ++a) {
+			parser.value_stack[a].destroy();
+		}
+	}
+	parser.value_stack.remove_many(base, parser.value_stack.len - base);
+}
+
+void append_value(JSON::Parser& parser, bool is_object, JSON::Value value) {
+	if (is_object) {
+		parser.field_stack[parser.field_stack.len - 1].value = value;
+	} else {
+		parser.value_stack.push(value);
 	}
-	if (value.array.buf == nullptr) {
-		value.array.create_auto();
+}
+
+JSON::Value JSON::Parser::finish_object(this JSON::Parser& self, size_t base) {
+	Value value = Value::create_of_type(Value::Type::Object);
+	value.fields = self.store(self.field_stack.buf + base, self.field_stack.len - base);
+	self.field_stack.remove_many(base, self.field_stack.len - base);
+	if (value.fields.len >= Value::index_min_fields) {
+		value.build_index(self.arena);
 	}
-	value.array.push(elem_value);
-	skip_whitespace(data, index);
-	was_comma = consume_char(data, index, ',');
-	goto parse_value;
+	return value;
+}
+
+JSON::Value JSON::Parser::finish_array(this JSON::Parser& self, size_t base) {
+	Value value = Value::create_of_type(Value::Type::Array);
+	value.array = self.store(self.value_stack.buf + base, self.value_stack.len - base);
+	self.value_stack.remove_many(base, self.value_stack.len - base);
+	return value;
 }
 
 JSON::Value JSON::parse_number(ctk::ar<const u8> data, size_t* index) {
-	ctk::gar<u8> string;
-	string.create_auto();
-	if (data[*index] == '-') {
-		string.push('-');
-		*index += 1;
+	constexpr double powers_of_ten[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+	};
+	constexpr size_t max_digits = 19;
+	const u8* buf = data.buf;
+	size_t len = data.len;
+	size_t start = *index;
+	size_t a = start;
+	bool negative = a < len && buf[a] == '-';
+	if (negative) {
+		a += 1;
 	}
-	if (data[*index] == '0') {
-		string.push('0');
-		*index += 1;
+	u64 mantissa = 0;
+	size_t digits = 0;
+	int64_t exponent = 0;
+	bool truncated = false;
+	bool is_integer = true;
+	if (a < len && buf[a] == '0') {
+		a += 1;
+	} else if (a < len && buf[a] >= '1' && buf[a] <= '9') {
+		while (a < len && buf[a] >= '0' && buf[a] <= '9') {
+			if (digits < max_digits) {
+				mantissa = mantissa * 10 + (buf[a] - '0');
+				digits += 1;
+			} else {
+				truncated = true;
+				exponent += 1;
+			}
+			a += 1;
+		}
 	} else {
-		bool first = true;
-		while (true) {
-			char character = data[*index];
-			if (character < (first ? '1' : '0') || character > '9') {
-				break;
+		return Value::create_of_type(Value::Type::Error);
+	}
+	if (a < len && buf[a] == '.') {
+		a += 1;
+		is_integer = false;
+		size_t fraction_start = a;
+		while (a < len && buf[a] >= '0' && buf[a] <= '9') {
+			if (digits < max_digits) {
+				mantissa = mantissa * 10 + (buf[a] - '0');
+				digits += mantissa != 0;
+				exponent -= 1;
+			} else {
+				truncated = true;
 			}
-			first = false;
-			string.push(character);
-			*index += 1;
+			a += 1;
+		}
+		if (a == fraction_start) {
+			return Value::create_of_type(Value::Type::Error);
 		}
 	}
-	if (data[*index] == '.') {
-		string.push('.');
-		*index += 1;
+	if (a < len && (buf[a] == 'e' || buf[a] == 'E')) {
+		a += 1;
+		is_integer = false;
+		bool exponent_negative = false;
+		if (a < len && (buf[a] == '+' || buf[a] == '-')) {
+			exponent_negative = buf[a] == '-';
+			a += 1;
+		}
+		size_t exponent_start = a;
+		int64_t exponent_value = 0;
+		while (a < len && buf[a] >= '0' && buf[a] <= '9') {
+			if (exponent_value < 1000000) {
+				exponent_value = exponent_value * 10 + (buf[a] - '0');
+			}
+			a += 1;
+		}
+		if (a == exponent_start) {
+			return Value::create_of_type(Value::Type::Error);
+		}
+		exponent += exponent_negative ? -exponent_value : exponent_value;
 	}
+	*index = a;
 	Value value = Value::create_of_type(Value::Type::Number);
-	value.number = ctk::f64_parse(string.to_ar());
-	string.destroy();
-	return value;
-}
-
-JSON::Value JSON::parse_value(ctk::ar<const u8> data, size_t* index) {
-	skip_whitespace(data, index);
-	if (*index >= data.len) {
-		return Value::create_of_type(Value::Type::Error);
+	if (is_integer && !truncated && mantissa <= (u64)INT64_MAX + negative) {
+		value.is_integer = true;
+		value.integer = negative ? (int64_t)(0 - mantissa) : (int64_t)mantissa;
+		value.number = negative ? -(double)mantissa : (double)mantissa;
+		return value;
 	}
-	if (consume_char(data, index, '{')) {
-		return parse_object(data, index);
+	// exact when both the mantissa and the power of ten are representable doubles (Clinger)
+	if (!truncated && mantissa <= ((u64)1 << 53) && exponent >= -22 && exponent <= 22) {
+		double number = (double)mantissa;
+		number = exponent < 0 ? number / powers_of_ten[-exponent] : number * powers_of_ten[exponent];
+		value.number = negative ? -number : number;
+		return value;
 	}
-	if (consume_char(data, index, '[')) {
-		return parse_array(data, index);
+	// correctly rounded slow path, libstdc++ implements it with Eisel-Lemire
+	std::from_chars_result result = std::from_chars((const char*)&buf[start], (const char*)&buf[a], value.number);
+	if (result.ec == std::errc::result_out_of_range) {
+		double magnitude = exponent > 0 ? HUGE_VAL : 0.0;
+		value.number = negative ? -magnitude : magnitude;
 	}
-	if (consume_char(data, index, '"')) {
+	return value;
+}
+
+JSON::Value JSON::Parser::parse_scalar(this JSON::Parser& self) {
+	if (consume_char(self.data, &self.index, '"')) {
 		Value value = Value::create_of_type(Value::Type::String);
-		value.string = parse_string(data, index);
-		if (value.string.buf == nullptr) {
+		if (!self.parse_string(&value.string, &value.escaped)) {
 			return Value::create_of_type(Value::Type::Error);
 		}
 		return value;
 	}
-	if (consume_str(data, index, "null")) {
+	if (consume_str(self.data, &self.index, "null")) {
 		return Value::create_of_type(Value::Type::Null);
 	}
-	if (consume_str(data, index, "true")) {
+	if (consume_str(self.data, &self.index, "true")) {
 		Value value = Value::create_of_type(Value::Type::Bool);
 		value.boolean = true;
 		return value;
 	}
-	if (consume_str(data, index, "false")) {
+	if (consume_str(self.data, &self.index, "false")) {
 		Value value = Value::create_of_type(Value::Type::Bool);
 		value.boolean = false;
 		return value;
 	}
-	return parse_number(data, index);
+	return parse_number(self.data, &self.index);
 }
 
-JSON::Value JSON::parse(ctk::ar<const u8> data) {
-	size_t index = 0;
-	return parse_value(data, &index);
-}
\ No newline at end of file
+// Recursive descent driven by frame_stack instead of the call stack, so nesting is bounded by
+// max_depth rather than by the size of the calling thread's stack. Arrays and objects have their
+// own element loops so the common case of a scalar member stays on a short path.
+JSON::Value JSON::Parser::parse_value(this JSON::Parser& self) {
+	size_t field_base = self.field_stack.len;
+	size_t value_base = self.value_stack.len;
+	size_t frame_base = self.frame_stack.len;
+	Value value;
+	value_start:
+	skip_whitespace(self.data, &self.index);
+	if (self.index >= self.data.len) {
+		goto error;
+	}
+	if (self.data[self.index] == '{') {
+		if (self.frame_stack.len - frame_base >= self.max_depth) {
+			goto error;
+		}
+		self.index += 1;
+		skip_whitespace(self.data, &self.index);
+		// an empty container is done without a frame
+		if (consume_char(self.data, &self.index, '}')) {
+			value = self.finish_object(self.field_stack.len);
+			goto container_end;
+		}
+		self.frame_stack.push(Frame(true, self.field_stack.len));
+		goto object_key;
+	}
+	if (self.data[self.index] == '[') {
+		if (self.frame_stack.len - frame_base >= self.max_depth) {
+			goto error;
+		}
+		self.index += 1;
+		skip_whitespace(self.data, &self.index);
+		if (consume_char(self.data, &self.index, ']')) {
+			value = self.finish_array(self.value_stack.len);
+			goto container_end;
+		}
+		self.frame_stack.push(Frame(false, self.value_stack.len));
+		goto array_elements;
+	}
+	value = self.parse_scalar();
+	if (value.type == Value::Type::Error) {
+		goto error;
+	}
+	if (self.frame_stack.len == frame_base) {
+		return value;
+	}
+	value_end:
+	if (self.frame_stack[self.frame_stack.len - 1].is_object) {
+		self.field_stack[self.field_stack.len - 1].value = value;
+		skip_whitespace(self.data, &self.index);
+		if (consume_char(self.data, &self.index, ',')) {
+			skip_whitespace(self.data, &self.index);
+			goto object_key;
+		}
+		if (consume_char(self.data, &self.index, '}')) {
+			goto close_container;
+		}
+		goto error;
+	}
+	self.value_stack.push(value);
+	skip_whitespace(self.data, &self.index);
+	if (consume_char(self.data, &self.index, ']')) {
+		goto close_container;
+	}
+	if (!consume_char(self.data, &self.index, ',')) {
+		goto error;
+	}
+	skip_whitespace(self.data, &self.index);
+	array_elements:
+	// runs of scalar elements stay in this loop, only a nested container goes back to value_start
+	while (self.index < self.data.len && self.data[self.index] != '{' && self.data[self.index] != '[') {
+		Value element = self.parse_scalar();
+		if (element.type == Value::Type::Error) {
+			goto error;
+		}
+		self.value_stack.push(element);
+		skip_whitespace(self.data, &self.index);
+		if (consume_char(self.data, &self.index, ']')) {
+			goto close_container;
+		}
+		if (!consume_char(self.data, &self.index, ',')) {
+			goto error;
+		}
+		skip_whitespace(self.data, &self.index);
+	}
+	goto value_start;
+	object_key:
+	// the same for members, a key with a scalar value is handled without leaving the loop
+	while (true) {
+		if (!consume_char(self.data, &self.index, '"') || !self.parse_key()) {
+			goto error;
+		}
+		skip_whitespace(self.data, &self.index);
+		if (!consume_char(self.data, &self.index, ':')) {
+			goto error;
+		}
+		skip_whitespace(self.data, &self.index);
+		if (self.index < self.data.len && (self.data[self.index] == '{' || self.data[self.index] == '[')) {
+			goto value_start;
+		}
+		Value member = self.parse_scalar();
+		if (member.type == Value::Type::Error) {
+			goto error;
+		}
+		self.field_stack[self.field_stack.len - 1].value = member;
+		skip_whitespace(self.data, &self.index);
+		if (consume_char(self.data, &self.index, '}')) {
+			goto close_container;
+		}
+		if (!consume_char(self.data, &self.index, ',')) {
+			goto error;
+		}
+		skip_whitespace(self.data, &self.index);
+	}
+	close_container:
+	{
+		Frame frame = self.frame_stack.pop();
+		value = frame.is_object ? self.finish_object(frame.base) : self.finish_array(frame.base);
+	}
+	container_end:
+	if (self.frame_stack.len == frame_base) {
+		return value;
+	}
+	goto value_end;
+	error:
+	self.frame_stack.remove_many(frame_base, self.frame_stack.len - frame_base);
+	discard_fields(self, field_base);
+	discard_values(self, value_base);
+	return Value::create_of_type(Value::Type::Error);
+}
+
+// Stage 2 of the structural backend, walks the structural index without recursion and
+// accepts exactly what parse_value accepts.
+JSON::Value JSON::Parser::parse_structural(this JSON::Parser& self) {
+	ctk::gar<u32>& positions = self.structural_index.positions;
+	auto token = [&](size_t t) -> u8 {
+		return positions[t] < self.data.len ? self.data[positions[t]] : 0;
+	};
+	size_t field_base = self.field_stack.len;
+	size_t value_base = self.value_stack.len;
+	size_t frame_base = self.frame_stack.len;
+	size_t t = 0;
+	Value value;
+	value_start:
+	switch (token(t)) {
+		case 0: {
+			goto error;
+		}
+		case '{': {
+			if (self.frame_stack.len - frame_base >= self.max_depth) {
+				goto error;
+			}
+			self.frame_stack.push(Frame(true, self.field_stack.len));
+			t += 1;
+			if (token(t) == '}') {
+				t += 1;
+				goto close_container;
+			}
+			goto object_key;
+		}
+		case '[': {
+			if (self.frame_stack.len - frame_base >= self.max_depth) {
+				goto error;
+			}
+			self.frame_stack.push(Frame(false, self.value_stack.len));
+			t += 1;
+			if (token(t) == ']') {
+				t += 1;
+				goto close_container;
+			}
+			goto value_start;
+		}
+		default: {
+			self.index = positions[t];
+			value = self.parse_scalar();
+			if (value.type == Value::Type::Error) {
+				goto error;
+			}
+			if (self.frame_stack.len == frame_base) {
+				return value;
+			}
+			skip_whitespace(self.data, &self.index);
+			while (positions[t] < self.index) {
+				t += 1;
+			}
+			if (positions[t] != self.index) {
+				if (self.arena == nullptr) {
+					value.destroy();
+				}
+				goto error;
+			}
+			goto value_end;
+		}
+	}
+	object_key:
+	if (token(t) != '"') {
+		goto error;
+	}
+	self.index = positions[t] + 1;
+	if (!self.parse_key()) {
+		goto error;
+	}
+	skip_whitespace(self.data, &self.index);
+	while (positions[t] < self.index) {
+		t += 1;
+	}
+	if (positions[t] != self.index || token(t) != ':') {
+		goto error;
+	}
+	t += 1;
+	goto value_start;
+	close_container:
+	{
+		// past the bracket, callers check what follows the value
+		self.index = positions[t - 1] + 1;
+		Frame frame = self.frame_stack.pop();
+		value = frame.is_object ? self.finish_object(frame.base) : self.finish_array(frame.base);
+		if (self.frame_stack.len == frame_base) {
+			return value;
+		}
+	}
+	value_end:
+	{
+		bool is_object = self.frame_stack[self.frame_stack.len - 1].is_object;
+		append_value(self, is_object, value);
+		u8 character = token(t);
+		if (character == ',') {
+			t += 1;
+			if (is_object) {
+				goto object_key;
+			}
+			goto value_start;
+		}
+		if (character == (is_object ? '}' : ']')) {
+			t += 1;
+			goto close_container;
+		}
+	}
+	error:
+	self.frame_stack.remove_many(frame_base, self.frame_stack.len - frame_base);
+	discard_fields(self, field_base);
+	discard_values(self, value_base);
+	return Value::create_of_type(Value::Type::Error);
+}
+
+JSON::Lazy JSON::Lazy::make(ctk::ar<const u8> data, size_t index) {
+	Lazy lazy = Lazy(data, index, Value::Type::Error);
+	skip_whitespace(data, &lazy.index);
+	if (lazy.index >= data.len) {
+		return lazy;
+	}
+	switch (data.buf[lazy.index]) {
+		case '{': { lazy.type = Value::Type::Object; break; }
+		case '[': { lazy.type = Value::Type::Array; break; }
+		case '"': { lazy.type = Value::Type::String; break; }
+		case 't':
+		case 'f': { lazy.type = Value::Type::Bool; break; }
+		case 'n': { lazy.type = Value::Type::Null; break; }
+		default: {
+			u8 character = data.buf[lazy.index];
+			if (character == '-' || (character >= '0' && character <= '9')) {
+				lazy.type = Value::Type::Number;
+			}
+		}
+	}
+	return lazy;
+}
+
+size_t JSON::Lazy::end(this const JSON::Lazy& self) {
+	return skip_value(self.data, self.index);
+}
+
+bool JSON::Lazy::next(this const JSON::Lazy& self, size_t* cursor, JSON::Lazy* out_value, ctk::ar<const u8>* out_name) {
+	if (self.type != Value::Type::Object && self.type != Value::Type::Array) {
+		return false;
+	}
+	bool is_object = self.type == Value::Type::Object;
+	size_t index = *cursor == 0 ? self.index + 1 : *cursor;
+	skip_whitespace(self.data, &index);
+	if (*cursor != 0 && !consume_char(self.data, &index, ',')) {
+		return false;
+	}
+	skip_whitespace(self.data, &index);
+	if (is_object) {
+		if (!consume_char(self.data, &index, '"')) {
+			return false;
+		}
+		size_t name_start = index;
+		index = skip_string(self.data, index);
+		if (index >= self.data.len) {
+			return false;
+		}
+		if (out_name != nullptr) {
+			*out_name = ctk::ar<const u8>(&self.data.buf[name_start], index - 1 - name_start);
+		}
+		skip_whitespace(self.data, &index);
+		if (!consume_char(self.data, &index, ':')) {
+			return false;
+		}
+	}
+	*out_value = make(self.data, index);
+	if (out_value->type == Value::Type::Error) {
+		return false;
+	}
+	*cursor = skip_value(self.data, out_value->index);
+	return true;
+}
+
+JSON::Lazy JSON::Lazy::get_value(this const JSON::Lazy& self, const char* name) {
+	return self.get_value(Key::make(name));
+}
+
+JSON::Lazy JSON::Lazy::get_value(this const JSON::Lazy& self, const JSON::Key& key) {
+	Lazy value;
+	ctk::ar<const u8> name;
+	size_t cursor = 0;
+	if (self.type == Value::Type::Object) {
+		while (self.next(&cursor, &value, &name)) {
+			if (std::memchr(name.buf, '\\', name.len) == nullptr) {
+				if (name.len == key.name.len && std::memcmp(name.buf, key.name.buf, name.len) == 0) {
+					return value;
+				}
+				continue;
+			}
+			ctk::gar<u8> decoded;
+			decoded.create_auto();
+			size_t name_index = 0;
+			bool equal = decode_string(ctk::ar<const u8>(name.buf, name.len + 1), &name_index, &decoded) &&
+				decoded.len == key.name.len && std::memcmp(decoded.buf, key.name.buf, decoded.len) == 0;
+			decoded.destroy();
+			if (equal) {
+				return value;
+			}
+		}
+	}
+	return Lazy(self.data, self.data.len, Value::Type::Error);
+}
+
+JSON::Lazy JSON::Lazy::at(this const JSON::Lazy& self, size_t position) {
+	Lazy value;
+	size_t cursor = 0;
+	if (self.type == Value::Type::Array) {
+		for (size_t a = 0; self.next(&cursor, &value, nullptr); ++a) {
+			if (a == position) {
+				return value;
+			}
+		}
+	}
+	return Lazy(self.data, self.data.len, Value::Type::Error);
+}
+
+bool JSON::Lazy::get_string(this const JSON::Lazy& self, ctk::ar<const u8>* out_string, ctk::gar<u8>* scratch) {
+	if (self.type != Value::Type::String) {
+		return false;
+	}
+	size_t start = self.index + 1;
+	size_t index = start + find_string_special(&self.data.buf[start], self.data.len - start);
+	if (index < self.data.len && self.data.buf[index] == '"') {
+		*out_string = ctk::ar<const u8>(&self.data.buf[start], index - start);
+		return true;
+	}
+	scratch->len = 0;
+	index = start;
+	if (!decode_string(self.data, &index, scratch)) {
+		return false;
+	}
+	*out_string = ctk::ar<const u8>(scratch->buf, scratch->len);
+	return true;
+}
+
+bool JSON::Lazy::get_number(this const JSON::Lazy& self, double* out_number) {
+	size_t index = self.index;
+	Value value = self.type == Value::Type::Number ? parse_number(self.data, &index) : Value::create_of_type(Value::Type::Error);
+	if (value.type != Value::Type::Number) {
+		return false;
+	}
+	*out_number = value.number;
+	return true;
+}
+
+bool JSON::Lazy::get_integer(this const JSON::Lazy& self, int64_t* out_integer) {
+	size_t index = self.index;
+	Value value = self.type == Value::Type::Number ? parse_number(self.data, &index) : Value::create_of_type(Value::Type::Error);
+	if (value.type != Value::Type::Number || !value.is_integer) {
+		return false;
+	}
+	*out_integer = value.integer;
+	return true;
+}
+
+bool JSON::Lazy::get_bool(this const JSON::Lazy& self, bool* out_boolean) {
+	size_t index = self.index;
+	if (consume_str(self.data, &index, "true")) {
+		*out_boolean = true;
+		return true;
+	}
+	if (consume_str(self.data, &index, "false")) {
+		*out_boolean = false;
+		return true;
+	}
+	return false;
+}
+
+JSON::Value JSON::Lazy::parse(this const JSON::Lazy& self, JSON::Parser* parser, JSON::Arena* arena, JSON::Options options) {
+	if (self.type == Value::Type::Error) {
+		return Value::create_of_type(Value::Type::Error);
+	}
+	return parser->parse(ctk::ar<const u8>(&self.data.buf[self.index], self.end() - self.index), arena, options);
+}
+
+void tape_push_u32(ctk::gar<u8>* out, u32 word) {
+	out->push_many((const u8*)&word, sizeof(word));
+}
+
+void tape_patch_u32(ctk::gar<u8>* out, size_t index, u32 word) {
+	std::memcpy(&out->buf[index], &word, sizeof(word));
+}
+
+u32 tape_read_u32(ctk::ar<const u8> data, size_t index) {
+	u32 word;
+	std::memcpy(&word, &data.buf[index], sizeof(word));
+	return word;
+}
+
+size_t write_tape_string(ctk::gar<u8>* out, size_t base, const u8* buf, size_t len) {
+	constexpr u8 padding[3] = {0, 0, 0};
+	size_t offset = out->len - base;
+	tape_push_u32(out, (u32)JSON::Value::Type::String);
+	tape_push_u32(out, len);
+	out->push_many(buf, len);
+	out->push_many(padding, (4 - len % 4) % 4);
+	return offset;
+}
+
+// children are written after their parent's offset table, which is patched as they land
+size_t write_tape_node(ctk::gar<u8>* out, size_t base, const JSON::Value& value) {
+	if (value.type == JSON::Value::Type::String) {
+		return write_tape_string(out, base, value.string.buf, value.string.len);
+	}
+	size_t offset = out->len - base;
+	u32 flag = 0;
+	if (value.type == JSON::Value::Type::Bool) {
+		flag = value.boolean;
+	} else if (value.type == JSON::Value::Type::Number) {
+		flag = value.is_integer;
+	}
+	tape_push_u32(out, (u32)value.type | flag << 8);
+	switch (value.type) {
+		case JSON::Value::Type::Object: {
+			tape_push_u32(out, value.fields.len);
+			size_t table = out->len;
+			for (size_t a = 0; a < value.fields.len * 3; ++a) {
+				tape_push_u32(out, 0);
+			}
+			for (size_t a = 0; a < value.fields.len; ++a) {
+				const JSON::Field& field = value.fields[a];
+				ctk::ar<const u8> name = ctk::ar<const u8>(field.name.buf, field.name.len);
+				size_t name_offset = write_tape_string(out, base, name.buf, name.len);
+				size_t value_offset = write_tape_node(out, base, field.value);
+				tape_patch_u32(out, table + a * 12, JSON::Key::hash_of(name));
+				tape_patch_u32(out, table + a * 12 + 4, name_offset);
+				tape_patch_u32(out, table + a * 12 + 8, value_offset);
+			}
+			break;
+		}
+		case JSON::Value::Type::Array: {
+			tape_push_u32(out, value.array.len);
+			size_t table = out->len;
+			for (size_t a = 0; a < value.array.len; ++a) {
+				tape_push_u32(out, 0);
+			}
+			for (size_t a = 0; a < value.array.len; ++a) {
+				tape_patch_u32(out, table + a * 4, write_tape_node(out, base, value.array[a]));
+			}
+			break;
+		}
+		case JSON::Value::Type::Number: {
+			out->push_many((const u8*)&value.number, sizeof(value.number));
+			int64_t integer = value.is_integer ? value.integer : 0;
+			out->push_many((const u8*)&integer, sizeof(integer));
+			break;
+		}
+		default: {}
+	}
+	return offset;
+}
+
+bool JSON::Tape::write(const JSON::Value& value, ctk::gar<u8>* out) {
+	size_t base = out->len;
+	tape_push_u32(out, magic);
+	tape_push_u32(out, version);
+	tape_push_u32(out, 0);
+	tape_push_u32(out, 0);
+	size_t root = write_tape_node(out, base, value);
+	size_t len = out->len - base;
+	// offsets are only truncated if the whole tape exceeds u32
+	if (len > UINT32_MAX) {
+		out->len = base;
+		return false;
+	}
+	tape_patch_u32(out, base + 8, root);
+	tape_patch_u32(out, base + 12, len);
+	return true;
+}
+
+JSON::Tape JSON::Tape::make(ctk::ar<const u8> data) {
+	if (data.len < header_len || tape_read_u32(data, 0) != magic || tape_read_u32(data, 4) != version) {
+		return Tape(data, 0, Value::Type::Error);
+	}
+	size_t len = tape_read_u32(data, 12);
+	if (len < header_len || len > data.len) {
+		return Tape(data, 0, Value::Type::Error);
+	}
+	return make_node(ctk::ar<const u8>(data.buf, len), tape_read_u32(data, 8));
+}
+
+JSON::Tape JSON::Tape::make_node(ctk::ar<const u8> data, size_t offset) {
+	Tape tape = Tape(data, offset, Value::Type::Error);
+	if (offset < header_len || offset % 4 != 0 || offset + 4 > data.len) {
+		return tape;
+	}
+	Value::Type type = (Value::Type)(tape_read_u32(data, offset) & 0xff);
+	size_t node_len = 4;
+	switch (type) {
+		case Value::Type::Null:
+		case Value::Type::Bool: {
+			break;
+		}
+		case Value::Type::Number: {
+			node_len = 20;
+			break;
+		}
+		case Value::Type::String:
+		case Value::Type::Array:
+		case Value::Type::Object: {
+			if (offset + 8 > data.len) {
+				return tape;
+			}
+			size_t count = tape_read_u32(data, offset + 4);
+			size_t entry_len = type == Value::Type::String ? 1 : type == Value::Type::Array ? 4 : 12;
+			node_len = 8 + count * entry_len;
+			break;
+		}
+		default: {
+			return tape;
+		}
+	}
+	if (node_len <= data.len - offset) {
+		tape.type = type;
+	}
+	return tape;
+}
+
+size_t JSON::Tape::len(this const JSON::Tape& self) {
+	switch (self.type) {
+		case Value::Type::String:
+		case Value::Type::Array:
+		case Value::Type::Object: {
+			return tape_read_u32(self.data, self.offset + 4);
+		}
+		default: {
+			return 0;
+		}
+	}
+}
+
+bool JSON::Tape::next(this const JSON::Tape& self, size_t* cursor, JSON::Tape* out_value, ctk::ar<const u8>* out_name) {
+	if ((self.type != Value::Type::Object && self.type != Value::Type::Array) || *cursor >= self.len()) {
+		return false;
+	}
+	if (self.type == Value::Type::Array) {
+		*out_value = make_node(self.data, tape_read_u32(self.data, self.offset + 8 + *cursor * 4));
+	} else {
+		size_t entry = self.offset + 8 + *cursor * 12;
+		*out_value = make_node(self.data, tape_read_u32(self.data, entry + 8));
+		if (out_name != nullptr && !make_node(self.data, tape_read_u32(self.data, entry + 4)).get_string(out_name)) {
+			*out_name = ctk::ar<const u8>(nullptr, 0);
+		}
+	}
+	*cursor += 1;
+	return true;
+}
+
+JSON::Tape JSON::Tape::get_value(this const JSON::Tape& self, const char* name) {
+	return self.get_value(Key::make(name));
+}
+
+JSON::Tape JSON::Tape::get_value(this const JSON::Tape& self, ctk::ar<const u8> name) {
+	return self.get_value(Key::make(name));
+}
+
+JSON::Tape JSON::Tape::get_value(this const JSON::Tape& self, const JSON::Key& key) {
+	if (self.type == Value::Type::Object) {
+		size_t count = self.len();
+		for (size_t a = 0; a < count; ++a) {
+			size_t entry = self.offset + 8 + a * 12;
+			if (tape_read_u32(self.data, entry) != key.hash) {
+				continue;
+			}
+			ctk::ar<const u8> name;
+			if (make_node(self.data, tape_read_u32(self.data, entry + 4)).get_string(&name) &&
+				name.len == key.name.len && std::memcmp(name.buf, key.name.buf, name.len) == 0) {
+				return make_node(self.data, tape_read_u32(self.data, entry + 8));
+			}
+		}
+	}
+	return Tape(self.data, 0, Value::Type::Error);
+}
+
+JSON::Tape JSON::Tape::at(this const JSON::Tape& self, size_t position) {
+	if (self.type != Value::Type::Array || position >= self.len()) {
+		return Tape(self.data, 0, Value::Type::Error);
+	}
+	return make_node(self.data, tape_read_u32(self.data, self.offset + 8 + position * 4));
+}
+
+bool JSON::Tape::get_string(this const JSON::Tape& self, ctk::ar<const u8>* out_string) {
+	if (self.type != Value::Type::String) {
+		return false;
+	}
+	*out_string = ctk::ar<const u8>(&self.data.buf[self.offset + 8], self.len());
+	return true;
+}
+
+bool JSON::Tape::get_number(this const JSON::Tape& self, double* out_number) {
+	if (self.type != Value::Type::Number) {
+		return false;
+	}
+	std::memcpy(out_number, &self.data.buf[self.offset + 4], sizeof(double));
+	return true;
+}
+
+bool JSON::Tape::get_integer(this const JSON::Tape& self, int64_t* out_integer) {
+	if (self.type != Value::Type::Number || (tape_read_u32(self.data, self.offset) >> 8 & 1) == 0) {
+		return false;
+	}
+	std::memcpy(out_integer, &self.data.buf[self.offset + 12], sizeof(int64_t));
+	return true;
+}
+
+bool JSON::Tape::get_bool(this const JSON::Tape& self, bool* out_boolean) {
+	if (self.type != Value::Type::Bool) {
+		return false;
+	}
+	*out_boolean = (tape_read_u32(self.data, self.offset) >> 8 & 1) != 0;
+	return true;
+}
+
+JSON::Lazy JSON::parse_lazy(ctk::ar<const u8> data) {
+	return Lazy::make(data, 0);
+}
+
+JSON::Value JSON::parse(ctk::ar<const u8> data) {
+	return parse(data, Options());
+}
+
+JSON::Value JSON::parse(ctk::ar<const u8> data, JSON::Options options) {
+	Parser parser;
+	parser.create();
+	Value value = parser.parse(data, nullptr, options);
+	parser.destroy();
+	return value;
+}
+
+JSON::Document JSON::parse_document(ctk::ar<const u8> data) {
+	return parse_document(data, Options());
+}
+
+JSON::Document JSON::parse_document(ctk::ar<const u8> data, JSON::Options options) {
+	Document document;
+	document.arena.create(data.len * 2);
+	Parser parser;
+	parser.create();
+	document.root = parser.parse(data, &document.arena, options);
+	parser.destroy();
+	return document;
+}
+
+void JSON::Writer::create(this JSON::Writer& self, size_t headroom) {
+	self.buffer.create_auto();
+	self.comma_stack.create_auto();
+	self.headroom = headroom;
+	self.clear();
+}
+
+void JSON::Writer::destroy(this JSON::Writer& self) {
+	self.buffer.destroy();
+	self.comma_stack.destroy();
+}
+
+void JSON::Writer::clear(this JSON::Writer& self) {
+	self.buffer.len = 0;
+	for (size_t a = 0; a < self.headroom; ++a) {
+		self.buffer.push(0);
+	}
+	self.comma_stack.len = 0;
+	self.need_comma = false;
+}
+
+ctk::ar<const u8> JSON::Writer::to_ar(this const JSON::Writer& self) {
+	return ctk::ar<const u8>(self.buffer.buf + self.headroom, self.buffer.len - self.headroom);
+}
+
+void JSON::Writer::separate(this JSON::Writer& self) {
+	if (self.need_comma) {
+		self.buffer.push(',');
+	}
+	self.need_comma = true;
+}
+
+void JSON::Writer::begin_object(this JSON::Writer& self) {
+	self.separate();
+	self.buffer.push('{');
+	self.comma_stack.push(self.need_comma);
+	self.need_comma = false;
+}
+
+void JSON::Writer::end_object(this JSON::Writer& self) {
+	self.buffer.push('}');
+	self.need_comma = self.comma_stack.pop();
+}
+
+void JSON::Writer::begin_array(this JSON::Writer& self) {
+	self.separate();
+	self.buffer.push('[');
+	self.comma_stack.push(self.need_comma);
+	self.need_comma = false;
+}
+
+void JSON::Writer::end_array(this JSON::Writer& self) {
+	self.buffer.push(']');
+	self.need_comma = self.comma_stack.pop();
+}
+
+void JSON::Writer::key(this JSON::Writer& self, ctk::ar<const u8> name) {
+	self.separate();
+	self.push_escaped(name);
+	self.buffer.push(':');
+	self.need_comma = false;
+}
+
+void JSON::Writer::key(this JSON::Writer& self, const char* name) {
+	self.key(ctk::ar<const u8>((const u8*)name, std::strlen(name)));
+}
+
+void JSON::Writer::string(this JSON::Writer& self, ctk::ar<const u8> string) {
+	self.separate();
+	self.push_escaped(string);
+}
+
+void JSON::Writer::string(this JSON::Writer& self, const char* string) {
+	self.string(ctk::ar<const u8>((const u8*)string, std::strlen(string)));
+}
+
+void JSON::Writer::number(this JSON::Writer& self, double number) {
+	self.separate();
+	if (!std::isfinite(number)) {
+		self.buffer.push_many((const u8*)"null", 4);
+		return;
+	}
+	// shortest representation that parses back to the same double
+	char temp[32];
+	std::to_chars_result result = std::to_chars(temp, temp + sizeof(temp), number);
+	self.buffer.push_many((const u8*)temp, result.ptr - temp);
+}
+
+void JSON::Writer::integer(this JSON::Writer& self, int64_t integer) {
+	self.separate();
+	char temp[24];
+	std::to_chars_result result = std::to_chars(temp, temp + sizeof(temp), integer);
+	self.buffer.push_many((const u8*)temp, result.ptr - temp);
+}
+
+void JSON::Writer::boolean(this JSON::Writer& self, bool boolean) {
+	self.separate();
+	if (boolean) {
+		self.buffer.push_many((const u8*)"true", 4);
+	} else {
+		self.buffer.push_many((const u8*)"false", 5);
+	}
+}
+
+void JSON::Writer::null(this JSON::Writer& self) {
+	self.separate();
+	self.buffer.push_many((const u8*)"null", 4);
+}
+
+void JSON::Writer::value(this JSON::Writer& self, const JSON::Value& value) {
+	switch (value.type) {
+		case Value::Type::Object: {
+			self.begin_object();
+			for (size_t a = 0; a < value.fields.len; ++a) {
+				const Field& field = value.fields[a];
+				self.key(ctk::ar<const u8>(field.name.buf, field.name.len));
+				self.value(field.value);
+			}
+			self.end_object();
+			break;
+		}
+		case Value::Type::Array: {
+			self.begin_array();
+			for (size_t a = 0; a < value.array.len; ++a) {
+				self.value(value.array[a]);
+			}
+			self.end_array();
+			break;
+		}
+		case Value::Type::String: {
+			self.string(ctk::ar<const u8>(value.string.buf, value.string.len));
+			break;
+		}
+		case Value::Type::Number: {
+			if (value.is_integer) {
+				self.integer(value.integer);
+			} else {
+				self.number(value.number);
+			}
+			break;
+		}
+		case Value::Type::Bool: {
+			self.boolean(value.boolean);
+			break;
+		}
+		default: {
+			self.null();
+			break;
+		}
+	}
+}
+
+void JSON::Writer::push_escaped(this JSON::Writer& self, ctk::ar<const u8> string) {
+	constexpr const char* hex_digits = "0123456789abcdef";
+	self.buffer.push('"');
+	size_t a = 0;
+	while (a < string.len) {
+		size_t run_len = find_string_special(&string.buf[a], string.len - a);
+		self.buffer.push_many(&string.buf[a], run_len);
+		a += run_len;
+		if (a >= string.len) {
+			break;
+		}
+		u8 character = string.buf[a];
+		a += 1;
+		u8 escape[6] = { '\\', 0, 0, 0, 0, 0 };
+		size_t escape_len = 2;
+		switch (character) {
+			case '"': { escape[1] = '"'; break; }
+			case '\\': { escape[1] = '\\'; break; }
+			case '\b': { escape[1] = 'b'; break; }
+			case '\f': { escape[1] = 'f'; break; }
+			case '\n': { escape[1] = 'n'; break; }
+			case '\r': { escape[1] = 'r'; break; }
+			case '\t': { escape[1] = 't'; break; }
+			default: {
+				escape[1] = 'u';
+				escape[2] = '0';
+				escape[3] = '0';
+				escape[4] = hex_digits[character >> 4];
+				escape[5] = hex_digits[character & 0xf];
+				escape_len = 6;
+				break;
+			}
+		}
+		self.buffer.push_many(escape, escape_len);
+	}
+	self.buffer.push('"');
+}
+
+void JSON::StreamParser::create(this JSON::StreamParser& self, JSON::StreamParser::Handler handler) {
+	self.handler = handler;
+	self.parser.create();
+	self.arena.create(Arena::min_block_size);
+	self.token.create_auto();
+	self.stack.create_auto();
+	self.max_depth = default_max_depth;
+	self.max_size = 0;
+	self.reset();
+}
+
+void JSON::StreamParser::destroy(this JSON::StreamParser& self) {
+	self.parser.destroy();
+	self.arena.destroy();
+	self.token.destroy();
+	self.stack.destroy();
+}
+
+void JSON::StreamParser::reset(this JSON::StreamParser& self) {
+	self.token.len = 0;
+	self.stack.len = 0;
+	self.state = State::Value;
+	self.token_type = Token::None;
+	self.token_escape = false;
+	self.received = 0;
+}
+
+bool JSON::StreamParser::emit(this JSON::StreamParser& self, JSON::StreamParser::Event event, const JSON::Value* value) {
+	if (!self.handler.func(self.handler.user, event, value)) {
+		self.state = State::Error;
+		return false;
+	}
+	return true;
+}
+
+void JSON::StreamParser::after_value(this JSON::StreamParser& self) {
+	self.state = self.stack.len == 0 ? State::Done : State::Next;
+}
+
+bool JSON::StreamParser::begin_container(this JSON::StreamParser& self, bool is_object) {
+	if (self.stack.len >= self.max_depth) {
+		self.state = State::Error;
+		return false;
+	}
+	self.stack.push(is_object);
+	self.state = is_object ? State::FirstKey : State::FirstValue;
+	return self.emit(is_object ? Event::BeginObject : Event::BeginArray, nullptr);
+}
+
+bool JSON::StreamParser::end_container(this JSON::StreamParser& self, bool is_object) {
+	if (self.stack.len == 0 || self.stack[self.stack.len - 1] != is_object) {
+		self.state = State::Error;
+		return false;
+	}
+	self.stack.pop();
+	self.after_value();
+	return self.emit(is_object ? Event::EndObject : Event::EndArray, nullptr);
+}
+
+// token holds a whole number or literal, or a string after its opening quote
+bool JSON::StreamParser::finish_token(this JSON::StreamParser& self, ctk::ar<const u8> token) {
+	Parser& parser = self.parser;
+	parser.data = token;
+	parser.index = 0;
+	parser.arena = &self.arena;
+	parser.zero_copy = true;
+	Value value = Value::create_of_type(Value::Type::Error);
+	switch (self.token_type) {
+		case Token::String: {
+			value = Value::create_of_type(Value::Type::String);
+			if (!parser.parse_string(&value.string, &value.escaped)) {
+				value = Value::create_of_type(Value::Type::Error);
+			}
+			break;
+		}
+		case Token::Number: {
+			value = parse_number(parser.data, &parser.index);
+			break;
+		}
+		case Token::Literal: {
+			value = parser.parse_scalar();
+			break;
+		}
+		default: {}
+	}
+	bool is_key = self.state == State::FirstKey || self.state == State::Key;
+	self.token_type = Token::None;
+	self.token.len = 0;
+	if (value.type == Value::Type::Error || parser.index != token.len) {
+		self.state = State::Error;
+		return false;
+	}
+	if (is_key) {
+		self.state = State::Colon;
+	} else {
+		self.after_value();
+	}
+	bool result = self.emit(is_key ? Event::Key : Event::Scalar, &value);
+	self.arena.reset();
+	return result;
+}
+
+JSON::StreamParser::Result JSON::StreamParser::feed(this JSON::StreamParser& self, ctk::ar<const u8> chunk) {
+	self.received += chunk.len;
+	if (self.max_size != 0 && self.received > self.max_size && self.state != State::Done) {
+		self.state = State::Error;
+	}
+	size_t a = 0;
+	while (a < chunk.len) {
+		if (self.state == State::Done) {
+			return Result::Done;
+		}
+		if (self.state == State::Error) {
+			return Result::Error;
+		}
+		if (self.token_type != Token::None) {
+			size_t token_start = a;
+			bool complete = false;
+			switch (self.token_type) {
+				case Token::String: {
+					while (a < chunk.len) {
+						if (self.token_escape) {
+							self.token_escape = false;
+							a += 1;
+							continue;
+						}
+						a += find_string_special(&chunk.buf[a], chunk.len - a);
+						if (a >= chunk.len) {
+							break;
+						}
+						u8 character = chunk.buf[a];
+						a += 1;
+						if (character == '\\') {
+							self.token_escape = true;
+						} else if (character == '"') {
+							complete = true;
+							break;
+						}
+					}
+					break;
+				}
+				case Token::Number: {
+					while (a < chunk.len) {
+						u8 character = chunk.buf[a];
+						if ((character < '0' || character > '9') && character != '-' && character != '+' && character != '.' && character != 'e' && character != 'E') {
+							complete = true;
+							break;
+						}
+						a += 1;
+					}
+					break;
+				}
+				case Token::Literal: {
+					while (a < chunk.len && chunk.buf[a] >= 'a' && chunk.buf[a] <= 'z') {
+						a += 1;
+					}
+					complete = a < chunk.len;
+					break;
+				}
+				default: {}
+			}
+			if (!complete) {
+				self.token.push_many(&chunk.buf[token_start], a - token_start);
+				return Result::NeedMore;
+			}
+			bool ok;
+			if (self.token.len == 0) {
+				ok = self.finish_token(ctk::ar<const u8>(&chunk.buf[token_start], a - token_start));
+			} else {
+				self.token.push_many(&chunk.buf[token_start], a - token_start);
+				ok = self.finish_token(ctk::ar<const u8>(self.token.buf, self.token.len));
+			}
+			if (!ok) {
+				return Result::Error;
+			}
+			continue;
+		}
+		u8 character = chunk.buf[a];
+		if (character == ' ' || character == '\n' || character == '\r' || character == '\t') {
+			a += 1;
+			continue;
+		}
+		bool ok = true;
+		switch (self.state) {
+			case State::Value:
+			case State::FirstValue: {
+				if (character == ']' && self.state == State::FirstValue) {
+					ok = self.end_container(false);
+				} else if (character == '{' || character == '[') {
+					ok = self.begin_container(character == '{');
+				} else if (character == '"') {
+					self.token_type = Token::String;
+					self.token_escape = false;
+				} else if (character == '-' || (character >= '0' && character <= '9')) {
+					self.token_type = Token::Number;
+				} else if (character >= 'a' && character <= 'z') {
+					self.token_type = Token::Literal;
+				} else {
+					ok = false;
+				}
+				if (self.token_type == Token::Number || self.token_type == Token::Literal) {
+					// the token loop above consumes it, including this first character
+					continue;
+				}
+				break;
+			}
+			case State::FirstKey:
+			case State::Key: {
+				if (character == '}' && self.state == State::FirstKey) {
+					ok = self.end_container(true);
+				} else if (character == '"') {
+					self.token_type = Token::String;
+					self.token_escape = false;
+				} else {
+					ok = false;
+				}
+				break;
+			}
+			case State::Colon: {
+				ok = character == ':';
+				self.state = State::Value;
+				break;
+			}
+			case State::Next: {
+				bool is_object = self.stack[self.stack.len - 1];
+				if (character == ',') {
+					self.state = is_object ? State::Key : State::Value;
+				} else if (character == '}' || character == ']') {
+					ok = self.end_container(character == '}');
+				} else {
+					ok = false;
+				}
+				break;
+			}
+			default: {}
+		}
+		if (!ok) {
+			self.state = State::Error;
+			return Result::Error;
+		}
+		a += 1;
+	}
+	if (self.state == State::Done) {
+		return Result::Done;
+	}
+	return self.state == State::Error ? Result::Error : Result::NeedMore;
+}
+
+JSON::StreamParser::Result JSON::StreamParser::finish(this JSON::StreamParser& self) {
+	if (self.state != State::Done && self.state != State::Error && (self.token_type == Token::Number || self.token_type == Token::Literal)) {
+		if (!self.finish_token(ctk::ar<const u8>(self.token.buf, self.token.len))) {
+			return Result::Error;
+		}
+	}
+	return self.state == State::Done ? Result::Done : Result::Error;
+}
+
+#ifdef CBS_LINUX
+bool JSON::map_file(const char* path, ctk::ar<const u8>* out_data) {
+	int fd = ::open(path, O_RDONLY);
+	if (fd == -1) {
+		WTK_LOG("::open failed (%i)", errno);
+		return false;
+	}
+	struct stat file_stat;
+	if (::fstat(fd, &file_stat) == -1) {
+		WTK_LOG("::fstat failed (%i)", errno);
+		::close(fd);
+		return false;
+	}
+	size_t len = file_stat.st_size;
+	if (len == 0) {
+		::close(fd);
+		*out_data = ctk::ar<const u8>(nullptr, 0);
+		return true;
+	}
+	void* mapping = ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (mapping == MAP_FAILED) {
+		WTK_LOG("::mmap failed (%i)", errno);
+		return false;
+	}
+	*out_data = ctk::ar<const u8>((const u8*)mapping, len);
+	return true;
+}
+
+void JSON::unmap_file(ctk::ar<const u8> data) {
+	if (data.buf != nullptr) {
+		::munmap((void*)data.buf, data.len);
+	}
+}
+#endif
\ No newline at end of file
@@ -1,36 +1,321 @@
 struct JSON {
 	struct Field;
 
+	// Lookup key with its hash computed once, so repeated lookups skip strlen and hashing.
+	struct Key {
+		ctk::ar<const u8> name;
+		u32 hash;
+
+		static u32 hash_of(ctk::ar<const u8> name);
+		static Key make(const char* name);
+		static Key make(ctk::ar<const u8> name);
+	};
+
+	// Open addressing table over the fields of an object, the slots (field index + 1, 0 if empty) follow it.
+	struct FieldIndex {
+		u32 mask;
+	};
+
+	struct Arena {
+		struct Block {
+			Block* next;
+			size_t cap;
+			size_t len;
+		};
+
+		constexpr static size_t min_block_size = 4096;
+
+		Block* head = nullptr;
+		size_t block_size = min_block_size;
+
+		void create(this Arena& self, size_t block_size);
+		void destroy(this Arena& self);
+		void reset(this Arena& self);
+		void* alloc(this Arena& self, size_t size, size_t align);
+
+		template <typename T>
+		T* alloc_many(this Arena& self, size_t count) {
+			return (T*)self.alloc(sizeof(T) * count, alignof(T));
+		}
+	};
+
 	struct Value {
 		enum class Type {
 			Error, Object, Array, String, Number, Bool, Null,
 		};
 		
+		constexpr static size_t index_min_fields = 16;
+
 		union {
-			ctk::gar<Field> fields = ctk::gar<Field>();
+			struct {
+				ctk::gar<Field> fields = ctk::gar<Field>();
+				FieldIndex* field_index = nullptr;
+			};
 			ctk::gar<Value> array;
 			ctk::gar<u8> string;
-			double number;
+			struct {
+				double number;
+				int64_t integer;
+			};
 			bool boolean;
 		};
 		Type type;
+		bool escaped = false;
+		// Set for numbers without fraction or exponent that fit in int64_t, integer then holds the exact value.
+		bool is_integer = false;
 
 		static Value create_of_type(Type type);
 		void destroy(this Value& self);
+		void build_index(this Value& self, Arena* arena);
 		Value get_value(this const Value& self, const char* name);
+		Value get_value(this const Value& self, ctk::ar<const u8> name);
+		Value get_value(this const Value& self, const Key& key);
 	};
 
 	struct Field {
 		ctk::gar<u8> name;
 		Value value;
+		bool name_escaped = false;
+		u32 name_hash = 0;
 
 		void destroy(this Field& self);
 	};
 
-	static ctk::gar<u8> parse_string(ctk::ar<const u8> data, size_t* index);
-	static Value parse_object(ctk::ar<const u8> data, size_t* index);
-	static Value parse_array(ctk::ar<const u8> data, size_t* index);
+	enum class Backend {
+		Auto, Recursive, Structural,
+	};
+
+	constexpr static size_t default_max_depth = 1024;
+
+	struct Options {
+		// Strings without escapes point into the parsed data, which must outlive the Document.
+		bool zero_copy = false;
+		Backend backend = Backend::Auto;
+		// deeper nesting or longer input is rejected as an Error value, max_size 0 means no limit
+		size_t max_depth = default_max_depth;
+		size_t max_size = 0;
+	};
+
+	// Stage 1 of the structural backend: offsets of every bracket, colon, comma, opening quote
+	// and scalar start outside of strings, followed by data.len.
+	struct StructuralIndex {
+		enum class Kernel {
+			Scalar, SSE2, AVX2,
+		};
+
+		ctk::gar<u32> positions;
+
+		static Kernel detect_kernel();
+		void create(this StructuralIndex& self);
+		void destroy(this StructuralIndex& self);
+		bool build(this StructuralIndex& self, ctk::ar<const u8> data, Kernel kernel);
+	};
+
+	// Values, field arrays and strings of a Document all live in its arena, destroy releases them at once.
+	struct Document {
+		Arena arena;
+		Value root;
+
+		void destroy(this Document& self);
+	};
+
+	struct Parser {
+		// an open container, object keys are pushed to field_stack as soon as they are parsed and
+		// receive their value when it is complete
+		struct Frame {
+			bool is_object;
+			size_t base;
+		};
+
+		constexpr static size_t structural_min_len = 1024;
+
+		ctk::ar<const u8> data;
+		size_t index;
+		Arena* arena;
+		bool zero_copy;
+		size_t max_depth;
+		ctk::gar<Value> value_stack;
+		ctk::gar<Field> field_stack;
+		ctk::gar<u8> string_stack;
+		ctk::gar<Frame> frame_stack;
+		StructuralIndex structural_index;
+
+		void create(this Parser& self);
+		void destroy(this Parser& self);
+		Value parse(this Parser& self, ctk::ar<const u8> data, Arena* arena, Options options);
+		bool parse_string(this Parser& self, ctk::gar<u8>* out_string, bool* out_escaped);
+		bool parse_key(this Parser& self);
+		Value parse_scalar(this Parser& self);
+		Value parse_value(this Parser& self);
+		Value finish_object(this Parser& self, size_t base);
+		Value finish_array(this Parser& self, size_t base);
+		Value parse_structural(this Parser& self);
+
+		template <typename T>
+		ctk::gar<T> store(this Parser& self, const T* buf, size_t len) {
+			ctk::gar<T> stored = ctk::gar<T>();
+			if (self.arena == nullptr) {
+				stored.create_auto();
+				stored.push_many(buf, len);
+			} else {
+				stored.buf = self.arena->alloc_many<T>(len);
+				stored.len = len;
+				if (len != 0) {
+					std::memcpy(stored.buf, buf, sizeof(T) * len);
+				}
+			}
+			return stored;
+		}
+	};
+
+	// On-demand cursor over unparsed data: values are classified by their first character, skipped
+	// subtrees are only scanned for brackets and quotes, and nothing is decoded until asked for.
+	struct Lazy {
+		ctk::ar<const u8> data;
+		size_t index;
+		Value::Type type;
+
+		static Lazy make(ctk::ar<const u8> data, size_t index);
+		size_t end(this const Lazy& self);
+		// cursor starts at 0, out_name (may be nullptr) receives object keys with escapes left in place
+		bool next(this const Lazy& self, size_t* cursor, Lazy* out_value, ctk::ar<const u8>* out_name);
+		Lazy get_value(this const Lazy& self, const char* name);
+		Lazy get_value(this const Lazy& self, const Key& key);
+		Lazy at(this const Lazy& self, size_t position);
+		// points into data when there are no escapes, otherwise decodes into scratch
+		bool get_string(this const Lazy& self, ctk::ar<const u8>* out_string, ctk::gar<u8>* scratch);
+		bool get_number(this const Lazy& self, double* out_number);
+		bool get_integer(this const Lazy& self, int64_t* out_integer);
+		bool get_bool(this const Lazy& self, bool* out_boolean);
+		Value parse(this const Lazy& self, Parser* parser, Arena* arena, Options options);
+	};
+
+	// Binary form of a Value for caching and IPC. Nodes are 4-byte aligned and refer to each other by
+	// offsets from the start of the tape, so a tape can be stored or memory mapped and used in place.
+	// Every offset is checked against the data, a damaged tape reads as Error values.
+	//
+	// header:  u32 magic, u32 version, u32 root offset, u32 tape length
+	// node:    u32 type | flag << 8, flag is the bool value or is_integer
+	// Number:  node, f64 number, i64 integer
+	// String:  node, u32 length, bytes padded to 4
+	// Array:   node, u32 count, count * u32 element offset
+	// Object:  node, u32 count, count * (u32 name hash, u32 name string offset, u32 value offset)
+	struct Tape {
+		constexpr static u32 magic = 0x4A4B5457;
+		constexpr static u32 version = 1;
+		constexpr static size_t header_len = 16;
+
+		ctk::ar<const u8> data;
+		size_t offset;
+		Value::Type type;
+
+		// appends the tape for value to out, false if it would not fit in u32 offsets
+		static bool write(const Value& value, ctk::gar<u8>* out);
+		static Tape make(ctk::ar<const u8> data);
+		static Tape make_node(ctk::ar<const u8> data, size_t offset);
+		size_t len(this const Tape& self);
+		// cursor starts at 0, out_name (may be nullptr) receives object keys
+		bool next(this const Tape& self, size_t* cursor, Tape* out_value, ctk::ar<const u8>* out_name);
+		Tape get_value(this const Tape& self, const char* name);
+		Tape get_value(this const Tape& self, ctk::ar<const u8> name);
+		Tape get_value(this const Tape& self, const Key& key);
+		Tape at(this const Tape& self, size_t position);
+		bool get_string(this const Tape& self, ctk::ar<const u8>* out_string);
+		bool get_number(this const Tape& self, double* out_number);
+		bool get_integer(this const Tape& self, int64_t* out_integer);
+		bool get_bool(this const Tape& self, bool* out_boolean);
+	};
+
+	// Resumable SAX parser, the document can be fed in chunks of any size as they arrive.
+	// Values passed to the handler (keys and scalars) are only valid during the call.
+	struct StreamParser {
+		enum class Event {
+			BeginObject, EndObject, BeginArray, EndArray, Key, Scalar,
+		};
+
+		enum class Result {
+			NeedMore, Done, Error,
+		};
+
+		enum class State {
+			Value, FirstValue, FirstKey, Key, Colon, Next, Done, Error,
+		};
+
+		enum class Token {
+			None, String, Number, Literal,
+		};
+
+		struct Handler {
+			void* user;
+			// returning false stops parsing with Result::Error
+			bool (*func)(void* user, Event event, const Value* value);
+		};
+
+		Handler handler;
+		Parser parser;
+		Arena arena;
+		ctk::gar<u8> token;
+		ctk::gar<bool> stack;
+		size_t max_depth;
+		// total bytes fed before the document is rejected, 0 means no limit
+		size_t max_size;
+		size_t received;
+		State state;
+		Token token_type;
+		bool token_escape;
+
+		void create(this StreamParser& self, Handler handler);
+		void destroy(this StreamParser& self);
+		void reset(this StreamParser& self);
+		Result feed(this StreamParser& self, ctk::ar<const u8> chunk);
+		Result finish(this StreamParser& self);
+		bool emit(this StreamParser& self, Event event, const Value* value);
+		bool begin_container(this StreamParser& self, bool is_object);
+		bool end_container(this StreamParser& self, bool is_object);
+		bool finish_token(this StreamParser& self, ctk::ar<const u8> token);
+		void after_value(this StreamParser& self);
+	};
+
+	// Appends JSON text to a reusable buffer. The first headroom bytes of the buffer are left free so
+	// a transport can prepend its framing in place (see WebsocketClient::send_json).
+	struct Writer {
+		ctk::gar<u8> buffer;
+		ctk::gar<bool> comma_stack;
+		size_t headroom;
+		bool need_comma;
+
+		void create(this Writer& self, size_t headroom);
+		void destroy(this Writer& self);
+		void clear(this Writer& self);
+		ctk::ar<const u8> to_ar(this const Writer& self);
+		void begin_object(this Writer& self);
+		void end_object(this Writer& self);
+		void begin_array(this Writer& self);
+		void end_array(this Writer& self);
+		void key(this Writer& self, ctk::ar<const u8> name);
+		void key(this Writer& self, const char* name);
+		void string(this Writer& self, ctk::ar<const u8> string);
+		void string(this Writer& self, const char* string);
+		void number(this Writer& self, double number);
+		void integer(this Writer& self, int64_t integer);
+		void boolean(this Writer& self, bool boolean);
+		void null(this Writer& self);
+		void value(this Writer& self, const Value& value);
+		void separate(this Writer& self);
+		void push_escaped(this Writer& self, ctk::ar<const u8> string);
+	};
+
+	// Appends the string starting after its opening quote to out_string, leaves index after the closing quote.
+	static bool decode_string(ctk::ar<const u8> data, size_t* index, ctk::gar<u8>* out_string);
 	static Value parse_number(ctk::ar<const u8> data, size_t* index);
-	static Value parse_value(ctk::ar<const u8> data, size_t* index);
+	static Lazy parse_lazy(ctk::ar<const u8> data);
 	static Value parse(ctk::ar<const u8> data);
+	static Value parse(ctk::ar<const u8> data, Options options);
+	static Document parse_document(ctk::ar<const u8> data);
+	static Document parse_document(ctk::ar<const u8> data, Options options);
+#ifdef CBS_LINUX
+	// read-only private mapping of a whole file, empty files give an empty ar
+	static bool map_file(const char* path, ctk::ar<const u8>* out_data);
+	static void unmap_file(ctk::ar<const u8> data);
+#endif
 };
\ No newline at end of file
@@ -0,0 +1,206 @@
+// Newline-delimited JSON: a buffer is split on line boundaries into one chunk per worker, the
+// workers parse their lines into their own reused arena and the records are joined in order.
+struct NDJSON {
+	struct Record {
+		size_t line;
+		ctk::ar<const u8> text;
+		JSON::Value value;
+	};
+
+	struct Worker {
+		NDJSON* pool;
+		JSON::Parser parser;
+		JSON::Arena arena;
+		ctk::gar<Record> records;
+		ctk::ar<const u8> chunk;
+		size_t line_count;
+		ctk::Thread thread;
+		// the thread's last access to the pool, destroy waits for it before freeing anything
+		bool stopped;
+
+		void parse_chunk(this auto& self, JSON::Options options) {
+			self.arena.reset();
+			self.records.len = 0;
+			self.line_count = 0;
+			size_t index = 0;
+			while (index < self.chunk.len) {
+				const u8* newline = (const u8*)std::memchr(&self.chunk.buf[index], '\n', self.chunk.len - index);
+				size_t line_end = newline != nullptr ? newline - self.chunk.buf : self.chunk.len;
+				ctk::ar<const u8> line = ctk::ar<const u8>(&self.chunk.buf[index], line_end - index);
+				index = newline != nullptr ? line_end + 1 : self.chunk.len;
+				self.line_count += 1;
+				size_t first = 0;
+				skip_whitespace(line, &first);
+				if (first == line.len) {
+					continue;
+				}
+				JSON::Value value = self.parser.parse(line, &self.arena, options);
+				// one value per line, anything after it makes the line an error
+				skip_whitespace(line, &self.parser.index);
+				if (self.parser.index != line.len) {
+					value = JSON::Value::create_of_type(JSON::Value::Type::Error);
+				}
+				self.records.push(Record(self.line_count, line, value));
+			}
+		}
+	};
+
+	ctk::gar<Worker*> workers;
+	JSON::Options options;
+	ctk::gar<Record> records;
+	// shared with the workers through std::atomic_ref
+	u64 generation;
+	size_t remaining;
+	bool stopping;
+	ctk::ar<const u8> mapping;
+
+	static void worker_func(Worker* worker) {
+		NDJSON* pool = worker->pool;
+		u64 seen_generation = 0;
+		while (true) {
+			std::atomic_ref<u64> generation = std::atomic_ref<u64>(pool->generation);
+			generation.wait(seen_generation);
+			seen_generation = generation.load();
+			if (pool->stopping) {
+				break;
+			}
+			worker->parse_chunk(pool->options);
+			pool->finish_worker();
+		}
+		std::atomic_ref<bool>(worker->stopped).store(true, std::memory_order_release);
+	}
+
+	// thread_count 0 uses one worker per online CPU
+	static NDJSON* make(size_t thread_count, JSON::Options options) {
+		if (thread_count == 0) {
+			long cpu_count = ::sysconf(_SC_NPROCESSORS_ONLN);
+			thread_count = cpu_count > 0 ? cpu_count : 1;
+		}
+		NDJSON* pool = ctk::alloc<NDJSON>(NDJSON());
+		pool->workers.create_auto();
+		pool->options = options;
+		pool->records.create_auto();
+		pool->generation = 0;
+		pool->remaining = 0;
+		pool->stopping = false;
+		pool->mapping = ctk::ar<const u8>(nullptr, 0);
+		for (size_t a = 0; a < thread_count; ++a) {
+			Worker* worker = ctk::alloc<Worker>(Worker());
+			worker->pool = pool;
+			worker->parser.create();
+			worker->arena.create(JSON::Arena::min_block_size);
+			worker->records.create_auto();
+			worker->chunk = ctk::ar<const u8>(nullptr, 0);
+			worker->line_count = 0;
+			worker->stopped = false;
+			worker->thread.create<Worker>(worker_func, worker);
+			if (worker->thread.exists == false) {
+				worker->parser.destroy();
+				worker->arena.destroy();
+				worker->records.destroy();
+				std::free(worker);
+				break;
+			}
+			pool->workers.push(worker);
+		}
+		if (pool->workers.len == 0) {
+			pool->workers.destroy();
+			pool->records.destroy();
+			std::free(pool);
+			return nullptr;
+		}
+		return pool;
+	}
+
+	void destroy(this auto& self) {
+		self.stopping = true;
+		std::atomic_ref<u64> generation = std::atomic_ref<u64>(self.generation);
+		generation.fetch_add(1);
+		generation.notify_all();
+		for (size_t a = 0; a < self.workers.len; ++a) {
+			Worker* worker = self.workers[a];
+			while (std::atomic_ref<bool>(worker->stopped).load(std::memory_order_acquire) == false) {
+				::sched_yield();
+			}
+			worker->parser.destroy();
+			worker->arena.destroy();
+			worker->records.destroy();
+			std::free(worker);
+		}
+		self.workers.destroy();
+		self.records.destroy();
+		self.unmap();
+	}
+
+	void finish_worker(this auto& self) {
+		std::atomic_ref<size_t> remaining = std::atomic_ref<size_t>(self.remaining);
+		if (remaining.fetch_sub(1) == 1) {
+			remaining.notify_all();
+		}
+	}
+
+	void run_workers(this auto& self) {
+		std::atomic_ref<size_t> remaining = std::atomic_ref<size_t>(self.remaining);
+		std::atomic_ref<u64> generation = std::atomic_ref<u64>(self.generation);
+		remaining.store(self.workers.len);
+		generation.fetch_add(1);
+		generation.notify_all();
+		while (true) {
+			size_t left = remaining.load();
+			if (left == 0) {
+				break;
+			}
+			remaining.wait(left);
+		}
+	}
+
+	void unmap(this auto& self) {
+		JSON::unmap_file(self.mapping);
+		self.mapping = ctk::ar<const u8>(nullptr, 0);
+	}
+
+	// Parses every non-blank line of data into records (value type Error for lines that fail).
+	// Records and their values stay valid until the next parse or destroy.
+	void parse(this auto& self, ctk::ar<const u8> data) {
+		size_t chunk_len = data.len / self.workers.len + 1;
+		size_t start = 0;
+		for (size_t a = 0; a < self.workers.len; ++a) {
+			size_t end = start + chunk_len;
+			if (end >= data.len) {
+				end = data.len;
+			} else {
+				const u8* newline = (const u8*)std::memchr(&data.buf[end], '\n', data.len - end);
+				end = newline != nullptr ? newline - data.buf + 1 : data.len;
+			}
+			self.workers[a]->chunk = ctk::ar<const u8>(data.buf + start, end - start);
+			start = end;
+		}
+		self.run_workers();
+		self.records.len = 0;
+		size_t line_offset = 0;
+		for (size_t a = 0; a < self.workers.len; ++a) {
+			Worker* worker = self.workers[a];
+			for (size_t b = 0; b < worker->records.len; ++b) {
+				Record record = worker->records[b];
+				record.line += line_offset;
+				self.records.push(record);
+			}
+			line_offset += worker->line_count;
+		}
+	}
+
+	// Like parse, reading the file through a private read-only mapping kept until the next parse.
+	bool parse_file(this auto& self, const char* path) {
+		self.unmap();
+		ctk::ar<const u8> data;
+		if (!JSON::map_file(path, &data)) {
+			return false;
+		}
+		if (data.buf != nullptr) {
+			::madvise((void*)data.buf, data.len, MADV_SEQUENTIAL);
+		}
+		self.mapping = data;
+		self.parse(data);
+		return true;
+	}
+};
\ No newline at end of file
@@ -0,0 +1,265 @@
+// Counters and HDR style histograms, kept per thread so recording is a relaxed load and store on a
+// cache line no other thread writes. Nothing is shared until snapshot sums the shards up, which
+// any thread can do at any time. Shards of exited threads are reused with their counts kept.
+struct Metrics {
+	enum class Counter {
+		ServerAccepts,
+		// turned away by the IP filter
+		ServerRejects,
+		ServerTLSFailures,
+		ServerBytesIn,
+		ServerBytesOut,
+		ServerActiveClients,
+		HTTPRequests,
+		HTTPFailures,
+		HTTPInFlight,
+		WebsocketFramesIn,
+		WebsocketFramesOut,
+		Count,
+	};
+
+	enum class Histogram {
+		ServerTLSHandshakeUs,
+		// from push_request to connected, resolving included
+		HTTPConnectUs,
+		HTTPTLSHandshakeUs,
+		HTTPFirstByteUs,
+		HTTPTotalUs,
+		WebsocketMessageBytes,
+		Count,
+	};
+
+	struct CounterInfo {
+		const char* name;
+		const char* help;
+		// gauges go up and down, the rest only up
+		bool is_gauge;
+	};
+
+	struct HistogramInfo {
+		const char* name;
+		const char* help;
+		// recorded values are multiplied by this for export, microseconds become seconds
+		double scale;
+	};
+
+	constexpr static size_t counter_count = (size_t)Counter::Count;
+	constexpr static size_t histogram_count = (size_t)Histogram::Count;
+
+	constexpr static CounterInfo counter_infos[counter_count] = {
+		{"wtk_server_accepts_total", "Connections accepted by SocketServer.", false},
+		{"wtk_server_rejects_total", "Connections refused by the IP filter.", false},
+		{"wtk_server_tls_failures_total", "Failed TLS handshakes on SocketServer.", false},
+		{"wtk_server_received_bytes_total", "Bytes read from SocketServer clients.", false},
+		{"wtk_server_sent_bytes_total", "Bytes sent to SocketServer clients.", false},
+		{"wtk_server_active_clients", "SocketServer clients not released yet.", true},
+		{"wtk_http_requests_total", "Requests pushed to HTTP.", false},
+		{"wtk_http_failures_total", "HTTP requests that ended without a response.", false},
+		{"wtk_http_in_flight", "HTTP requests pushed and not done yet.", true},
+		{"wtk_websocket_frames_received_total", "WebSocket frames received.", false},
+		{"wtk_websocket_frames_sent_total", "WebSocket frames sent.", false},
+	};
+
+	constexpr static HistogramInfo histogram_infos[histogram_count] = {
+		{"wtk_server_tls_handshake_seconds", "TLS handshake time on SocketServer.", 1e-6},
+		{"wtk_http_connect_seconds", "Time from push_request to a connected socket.", 1e-6},
+		{"wtk_http_tls_handshake_seconds", "TLS handshake time of HTTP requests.", 1e-6},
+		{"wtk_http_first_byte_seconds", "Time from push_request to the first response byte.", 1e-6},
+		{"wtk_http_total_seconds", "Time from push_request to the end of the request.", 1e-6},
+		{"wtk_websocket_message_bytes", "Size of received WebSocket messages.", 1},
+	};
+
+	// Buckets are powers of two split into 16 linear steps, so a value is known within 1/16 (6%).
+	// Values below 16 have a bucket each, values from 2^40 on share the last one.
+	constexpr static u32 sub_bucket_bits = 4;
+	constexpr static u32 sub_bucket_count = 1 << sub_bucket_bits;
+	constexpr static u32 max_value_bits = 40;
+	constexpr static size_t bucket_count = (max_value_bits - sub_bucket_bits + 1) * sub_bucket_count;
+
+	struct alignas(64) Shard {
+		i64 counters[counter_count];
+		u64 histogram_sums[histogram_count];
+		u64 histogram_counts[histogram_count][bucket_count];
+		// the list of every shard, only ever pushed to
+		Shard* next;
+		// owned by a running thread, cleared by the key destructor when it exits
+		bool in_use;
+	};
+
+	// What snapshot adds up, large enough (~30 KiB) to be better off on the heap.
+	struct Snapshot {
+		i64 counters[counter_count];
+		u64 histogram_sums[histogram_count];
+		u64 histogram_counts[histogram_count][bucket_count];
+
+		i64 get(this const auto& self, Counter counter) {
+			return self.counters[(size_t)counter];
+		}
+
+		u64 get_count(this const auto& self, Histogram histogram) {
+			u64 count = 0;
+			for (size_t a = 0; a < bucket_count; ++a) {
+				count += self.histogram_counts[(size_t)histogram][a];
+			}
+			return count;
+		}
+
+		// The middle of the bucket holding the given quantile (0.99 for p99), 0 when nothing was recorded.
+		u64 get_quantile(this const auto& self, Histogram histogram, double quantile) {
+			u64 count = self.get_count(histogram);
+			if (count == 0) {
+				return 0;
+			}
+			u64 rank = (u64)std::ceil(quantile * (double)count);
+			rank = std::max<u64>(rank, 1);
+			u64 seen = 0;
+			for (size_t a = 0; a < bucket_count; ++a) {
+				seen += self.histogram_counts[(size_t)histogram][a];
+				if (seen >= rank) {
+					u64 low = get_bucket_low(a);
+					u64 high = a + 1 < bucket_count ? get_bucket_low(a + 1) - 1 : low;
+					return low + (high - low) / 2;
+				}
+			}
+			return get_bucket_low(bucket_count - 1);
+		}
+	};
+
+	static inline Shard* shards = nullptr;
+	static inline thread_local Shard* thread_shard = nullptr;
+	static inline pthread_key_t thread_key;
+
+	static void release_shard(void* shard) {
+		std::atomic_ref<bool>(((Shard*)shard)->in_use).store(false, std::memory_order_release);
+	}
+
+	// Called by wtk::init.
+	static void init() {
+		if (::pthread_key_create(&thread_key, release_shard) != 0) {
+			WTK_PANIC("::pthread_key_create failed");
+		}
+	}
+
+	static u64 now_us() {
+		struct timespec time;
+		::clock_gettime(CLOCK_MONOTONIC, &time);
+		return (u64)time.tv_sec * 1000000 + time.tv_nsec / 1000;
+	}
+
+	static size_t get_bucket(u64 value) {
+		if (value < sub_bucket_count) {
+			return value;
+		}
+		u32 exponent = 63 - __builtin_clzll(value);
+		if (exponent >= max_value_bits) {
+			return bucket_count - 1;
+		}
+		size_t sub_bucket = (value >> (exponent - sub_bucket_bits)) & (sub_bucket_count - 1);
+		return (exponent - sub_bucket_bits + 1) * sub_bucket_count + sub_bucket;
+	}
+
+	static u64 get_bucket_low(size_t bucket) {
+		if (bucket < sub_bucket_count) {
+			return bucket;
+		}
+		u32 exponent = bucket / sub_bucket_count + sub_bucket_bits - 1;
+		u64 sub_bucket = bucket % sub_bucket_count;
+		return (sub_bucket_count + sub_bucket) << (exponent - sub_bucket_bits);
+	}
+
+	// Takes over the shard of an exited thread, or pushes a new one.
+	static Shard* get_shard() {
+		if (thread_shard != nullptr) {
+			return thread_shard;
+		}
+		Shard* shard = std::atomic_ref<Shard*>(shards).load(std::memory_order_acquire);
+		for (; shard != nullptr; shard = shard->next) {
+			if (std::atomic_ref<bool>(shard->in_use).exchange(true, std::memory_order_acquire) == false) {
+				break;
+			}
+		}
+		if (shard == nullptr) {
+			shard = (Shard*)std::aligned_alloc(alignof(Shard), sizeof(Shard));
+			if (shard == nullptr) {
+				WTK_PANIC("std::aligned_alloc failed");
+			}
+			std::memset((void*)shard, 0, sizeof(Shard));
+			shard->in_use = true;
+			std::atomic_ref<Shard*> head(shards);
+			shard->next = head.load(std::memory_order_relaxed);
+			while (head.compare_exchange_weak(shard->next, shard, std::memory_order_release, std::memory_order_relaxed) == false) {
+			}
+		}
+		::pthread_setspecific(thread_key, shard);
+		thread_shard = shard;
+		return shard;
+	}
+
+	// Only the owning thread writes, so there's no read-modify-write, snapshot reads through atomic_ref.
+	static void add_u64(u64* value, u64 amount) {
+		std::atomic_ref<u64> ref(*value);
+		ref.store(ref.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+	}
+
+	static void add(Counter counter, i64 amount) {
+		std::atomic_ref<i64> ref(get_shard()->counters[(size_t)counter]);
+		ref.store(ref.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+	}
+
+	static void record(Histogram histogram, u64 value) {
+		Shard* shard = get_shard();
+		add_u64(&shard->histogram_counts[(size_t)histogram][get_bucket(value)], 1);
+		add_u64(&shard->histogram_sums[(size_t)histogram], value);
+	}
+
+	static void snapshot(Snapshot* out_snapshot) {
+		std::memset((void*)out_snapshot, 0, sizeof(Snapshot));
+		Shard* shard = std::atomic_ref<Shard*>(shards).load(std::memory_order_acquire);
+		for (; shard != nullptr; shard = shard->next) {
+			for (size_t a = 0; a < counter_count; ++a) {
+				out_snapshot->counters[a] += std::atomic_ref<i64>(shard->counters[a]).load(std::memory_order_relaxed);
+			}
+			for (size_t a = 0; a < histogram_count; ++a) {
+				out_snapshot->histogram_sums[a] += std::atomic_ref<u64>(shard->histogram_sums[a]).load(std::memory_order_relaxed);
+				for (size_t b = 0; b < bucket_count; ++b) {
+					out_snapshot->histogram_counts[a][b] += std::atomic_ref<u64>(shard->histogram_counts[a][b]).load(std::memory_order_relaxed);
+				}
+			}
+		}
+	}
+
+	static void push_format(ctk::gar<u8>* out, const char* format, ...) {
+		char line[256];
+		va_list args;
+		va_start(args, format);
+		int line_len = std::vsnprintf(line, sizeof(line), format, args);
+		va_end(args);
+		if (line_len > 0) {
+			out->push_many((const u8*)line, std::min<size_t>(line_len, sizeof(line) - 1));
+		}
+	}
+
+	// Prometheus text format 0.0.4. Histograms go out as summaries with a few quantiles, a
+	// bucket line for each of the ~600 buckets would be too much for a scrape.
+	static void write_prometheus(ctk::gar<u8>* out) {
+		constexpr double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+		Snapshot* snapshot = (Snapshot*)std::malloc(sizeof(Snapshot));
+		Metrics::snapshot(snapshot);
+		for (size_t a = 0; a < counter_count; ++a) {
+			const CounterInfo& info = counter_infos[a];
+			push_format(out, "# HELP %s %s\n# TYPE %s %s\n", info.name, info.help, info.name, info.is_gauge ? "gauge" : "counter");
+			push_format(out, "%s %lli\n", info.name, (long long)snapshot->counters[a]);
+		}
+		for (size_t a = 0; a < histogram_count; ++a) {
+			const HistogramInfo& info = histogram_infos[a];
+			Histogram histogram = (Histogram)a;
+			push_format(out, "# HELP %s %s\n# TYPE %s summary\n", info.name, info.help, info.name);
+			for (double quantile : quantiles) {
+				push_format(out, "%s{quantile=\"%g\"} %.9g\n", info.name, quantile, (double)snapshot->get_quantile(histogram, quantile) * info.scale);
+			}
+			push_format(out, "%s_sum %.9g\n", info.name, (double)snapshot->histogram_sums[a] * info.scale);
+			push_format(out, "%s_count %llu\n", info.name, (unsigned long long)snapshot->get_count(histogram));
+		}
+		std::free(snapshot);
+	}
+};
\ No newline at end of file
@@ -0,0 +1,50 @@
+// Serves Metrics to Prometheus from a SocketServer of its own, GET /metrics answers with the text
+// format and any other request with 404. One request per connection.
+struct PrometheusExporter {
+	constexpr static u64 request_timeout_ms = 5000;
+	constexpr static size_t max_request_len = 8 * 1024;
+
+	static bool has_request_end(ctk::ar<const u8> buffer) {
+		for (size_t a = 3; a < buffer.len; ++a) {
+			if (std::memcmp(&buffer[a - 3], "\r\n\r\n", 4) == 0) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static void client_thread_func(SocketServer::Client* client) {
+		u64 deadline_ms = Resolver::now_ms() + request_timeout_ms;
+		while (has_request_end(ctk::ar<const u8>(client->buffer.buf, client->buffer.len)) == false) {
+			if (client->read() == SocketServer::Client::Result::Fail || client->buffer.len > max_request_len || Resolver::now_ms() > deadline_ms) {
+				client->release();
+				return;
+			}
+			struct pollfd pfd = {
+				.fd = client->socket_fd,
+				.events = POLLIN,
+			};
+			::poll(&pfd, 1, 100);
+		}
+		constexpr const char* metrics_request = "GET /metrics ";
+		constexpr const char* metrics_request_with_query = "GET /metrics?";
+		bool is_metrics = client->buffer.len > std::strlen(metrics_request) && (std::memcmp(client->buffer.buf, metrics_request, std::strlen(metrics_request)) == 0 || std::memcmp(client->buffer.buf, metrics_request_with_query, std::strlen(metrics_request_with_query)) == 0);
+		ctk::gar<u8> body;
+		body.create_auto();
+		if (is_metrics) {
+			Metrics::write_prometheus(&body);
+		}
+		char head[160];
+		int head_len = std::snprintf(head, sizeof(head), "HTTP/1.1 %s\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", is_metrics ? "200 OK" : "404 Not Found", body.len);
+		if (client->send(ctk::ar<const u8>((const u8*)head, head_len)) == SocketServer::Client::Result::Ok) {
+			client->send(ctk::ar<const u8>(body.buf, body.len));
+		}
+		body.destroy();
+		client->release();
+	}
+
+	// tls and ip_filter as for SocketServer::make.
+	static SocketServer* make(Addr addr, SocketServer::TLS* tls, IPFilter* ip_filter) {
+		return SocketServer::make(false, addr, tls, client_thread_func, ip_filter, false);
+	}
+};
\ No newline at end of file
@@ -1,10 +1,39 @@
 #include "ctk-0.40/mod.hpp"
 
+#include <atomic>
+#include <charconv>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
 #ifdef CBS_LINUX
 #include <netdb.h>
+#include <netinet/tcp.h>
 #include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
+#include <openssl/rand.h>
+#include <zlib.h>
+// define WTK_NO_BROTLI to build without brotli response decoding
+#if __has_include(<brotli/decode.h>) && !defined(WTK_NO_BROTLI)
+#define WTK_BROTLI
+#include <brotli/decode.h>
+#endif
+// define WTK_NO_IO_URING to build without the io_uring backend
+#if __has_include(<linux/io_uring.h>) && !defined(WTK_NO_IO_URING)
+#include <linux/io_uring.h>
+// headers older than 6.0 lack the multishot flags and opcodes the backend names
+#if defined(IORING_RECV_MULTISHOT) && defined(IORING_ACCEPT_MULTISHOT) && defined(IORING_ASYNC_CANCEL_ALL)
+#define WTK_IO_URING
+#include <sys/syscall.h>
+#endif
+#endif
 #endif
 
 #include "mod.hpp"
@@ -23,15 +52,37 @@ namespace wtk {
 		}
 	}
 
+	// Small writes go out at once instead of waiting on Nagle for the previous ones to be acked.
+	void set_socket_nodelay(int socket_fd) {
+		int opt = 1;
+		if (::setsockopt(socket_fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt)) == -1) {
+			WTK_LOG("::setsockopt(TCP_NODELAY) failed (%i)", errno);
+		}
+	}
+
 	#include "addr/addr.cpp"
+	#include "resolver/resolver.cpp"
+	#include "ip_filter/ip_filter.cpp"
+	#include "metrics/metrics.cpp"
+#ifdef WTK_IO_URING
+	#include "uring/uring.cpp"
+#endif
 	#include "socket/server/server.cpp"
 	#include "socket/client/client.cpp"
+	#include "http/content_decoder.cpp"
 	#include "http/http.cpp"
+	#include "http/threaded.cpp"
+	#include "http/hpack.cpp"
+	#include "http/http2.cpp"
 	#include "websocket/websocket.cpp"
+	#include "websocket/outbound.cpp"
+	#include "metrics/prometheus.cpp"
+	#include "json/ndjson.cpp"
 	void init() {
 		::SSL_library_init();
 		::OpenSSL_add_all_algorithms();
 		::SSL_load_error_strings();
+		Metrics::init();
 	}
 #endif
 }
\ No newline at end of file
@@ -2,11 +2,22 @@ namespace wtk {
 	void make_socket_nonblocking(int socket_fd);
 
 	#include "addr/addr.hpp"
+	#include "resolver/resolver.hpp"
+	#include "ip_filter/ip_filter.hpp"
+	#include "metrics/metrics.hpp"
+	#include "uring/uring.hpp"
 	#include "socket/server/server.hpp"
 	#include "socket/client/client.hpp"
+	#include "http/content_decoder.hpp"
 	#include "http/http.hpp"
+	#include "http/threaded.hpp"
+	#include "http/hpack.hpp"
+	#include "http/http2.hpp"
 	#include "websocket/websocket.hpp"
+	#include "websocket/outbound.hpp"
+	#include "metrics/prometheus.hpp"
 	#include "json/json.hpp"
+	#include "json/ndjson.hpp"
 
 	void init();
 }
\ No newline at end of file
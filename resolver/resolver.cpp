@@ -0,0 +1,195 @@
+// Asynchronous getaddrinfo on a small pool of worker threads. Finished lookups are signalled on
+// event_fd so the owner can wait for them in its epoll loop. The cache is only used by the owner.
+struct Resolver {
+	struct Job {
+		size_t id;
+		char* name;
+		u16 port;
+		Addr addr;
+	};
+
+	struct Entry {
+		char* name;
+		Addr addr;
+		u64 expires_at_ms;
+	};
+
+	constexpr static size_t default_thread_count = 2;
+	constexpr static size_t max_cache_entries = 1024;
+	// getaddrinfo does not report record TTLs, answers are kept for a fixed time
+	constexpr static u64 default_ttl_ms = 60 * 1000;
+	constexpr static u64 default_negative_ttl_ms = 5 * 1000;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	ctk::gar<Job> jobs;
+	ctk::gar<Job> results;
+	ctk::gar<Entry> cache;
+	int event_fd;
+	size_t running;
+	bool stopping;
+	u64 ttl_ms;
+	u64 negative_ttl_ms;
+
+	static u64 now_ms() {
+		struct timespec time;
+		::clock_gettime(CLOCK_MONOTONIC, &time);
+		return (u64)time.tv_sec * 1000 + time.tv_nsec / 1000000;
+	}
+
+	static void thread_func(Resolver* resolver) {
+		::pthread_mutex_lock(&resolver->mutex);
+		while (true) {
+			while (resolver->jobs.len == 0 && resolver->stopping == false) {
+				::pthread_cond_wait(&resolver->cond, &resolver->mutex);
+			}
+			if (resolver->stopping) {
+				break;
+			}
+			Job job = resolver->jobs[0];
+			resolver->jobs.remove(0);
+			::pthread_mutex_unlock(&resolver->mutex);
+			job.addr = Addr::resolve(job.name, job.port);
+			::pthread_mutex_lock(&resolver->mutex);
+			resolver->results.push(job);
+			u64 count = 1;
+			if (::write(resolver->event_fd, &count, sizeof(count)) == -1) {
+				WTK_LOG("::write(eventfd) failed (%i)", errno);
+			}
+		}
+		resolver->running -= 1;
+		::pthread_cond_broadcast(&resolver->cond);
+		::pthread_mutex_unlock(&resolver->mutex);
+	}
+
+	static Resolver* make(size_t thread_count) {
+		int event_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (event_fd == -1) {
+			WTK_LOG("::eventfd failed (%i)", errno);
+			return nullptr;
+		}
+		Resolver* resolver = ctk::alloc<Resolver>(Resolver());
+		::pthread_mutex_init(&resolver->mutex, nullptr);
+		::pthread_cond_init(&resolver->cond, nullptr);
+		resolver->jobs.create_auto();
+		resolver->results.create_auto();
+		resolver->cache.create_auto();
+		resolver->event_fd = event_fd;
+		resolver->running = 0;
+		resolver->stopping = false;
+		resolver->ttl_ms = default_ttl_ms;
+		resolver->negative_ttl_ms = default_negative_ttl_ms;
+		::pthread_mutex_lock(&resolver->mutex);
+		for (size_t a = 0; a < thread_count; ++a) {
+			ctk::Thread thread;
+			thread.create<Resolver>(thread_func, resolver);
+			if (thread.exists) {
+				resolver->running += 1;
+			}
+		}
+		size_t running = resolver->running;
+		::pthread_mutex_unlock(&resolver->mutex);
+		if (running == 0) {
+			WTK_LOG("Resolver::make failed to start threads");
+			resolver->destroy();
+			std::free(resolver);
+			return nullptr;
+		}
+		return resolver;
+	}
+
+	// Waits for lookups already inside getaddrinfo to return.
+	void destroy(this auto& self) {
+		::pthread_mutex_lock(&self.mutex);
+		self.stopping = true;
+		::pthread_cond_broadcast(&self.cond);
+		while (self.running > 0) {
+			::pthread_cond_wait(&self.cond, &self.mutex);
+		}
+		::pthread_mutex_unlock(&self.mutex);
+		for (size_t a = 0; a < self.jobs.len; ++a) {
+			std::free(self.jobs[a].name);
+		}
+		for (size_t a = 0; a < self.results.len; ++a) {
+			std::free(self.results[a].name);
+		}
+		for (size_t a = 0; a < self.cache.len; ++a) {
+			std::free(self.cache[a].name);
+		}
+		self.jobs.destroy();
+		self.results.destroy();
+		self.cache.destroy();
+		::close(self.event_fd);
+		::pthread_cond_destroy(&self.cond);
+		::pthread_mutex_destroy(&self.mutex);
+	}
+
+	// Answers from the cache when possible (out_addr has type Error for a cached failure), otherwise
+	// queues the lookup and returns false, the answer is then delivered by try_pop under id.
+	bool resolve(this auto& self, size_t id, const char* name, u16 port, Addr* out_addr) {
+		u64 now = now_ms();
+		for (size_t a = 0; a < self.cache.len; ++a) {
+			Entry& entry = self.cache[a];
+			if (std::strcmp(entry.name, name) != 0) {
+				continue;
+			}
+			if (entry.expires_at_ms <= now) {
+				std::free(entry.name);
+				self.cache.remove(a);
+				break;
+			}
+			*out_addr = entry.addr;
+			out_addr->name = entry.addr.type == Addr::Type::Error ? nullptr : name;
+			out_addr->port = port;
+			return true;
+		}
+		::pthread_mutex_lock(&self.mutex);
+		self.jobs.push(Job(id, ::strdup(name), port, Addr()));
+		::pthread_cond_signal(&self.cond);
+		::pthread_mutex_unlock(&self.mutex);
+		return false;
+	}
+
+	// Call once when event_fd is readable, before draining with try_pop.
+	void clear_event(this auto& self) {
+		u64 count;
+		if (::read(self.event_fd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+			WTK_LOG("::read(eventfd) failed (%i)", errno);
+		}
+	}
+
+	// The returned address has no name, the caller owns the one it asked for.
+	bool try_pop(this auto& self, size_t* out_id, Addr* out_addr) {
+		::pthread_mutex_lock(&self.mutex);
+		if (self.results.len == 0) {
+			::pthread_mutex_unlock(&self.mutex);
+			return false;
+		}
+		Job job = self.results[0];
+		self.results.remove(0);
+		::pthread_mutex_unlock(&self.mutex);
+		job.addr.name = nullptr;
+		self.cache_answer(job.name, job.addr);
+		*out_id = job.id;
+		*out_addr = job.addr;
+		return true;
+	}
+
+	// Takes ownership of name.
+	void cache_answer(this auto& self, char* name, Addr addr) {
+		u64 ttl_ms = addr.type == Addr::Type::Error ? self.negative_ttl_ms : self.ttl_ms;
+		Entry entry = Entry(name, addr, now_ms() + ttl_ms);
+		for (size_t a = 0; a < self.cache.len; ++a) {
+			if (std::strcmp(self.cache[a].name, name) == 0) {
+				std::free(self.cache[a].name);
+				self.cache[a] = entry;
+				return;
+			}
+		}
+		if (self.cache.len >= max_cache_entries) {
+			std::free(self.cache[0].name);
+			self.cache.remove(0);
+		}
+		self.cache.push(entry);
+	}
+};
\ No newline at end of file
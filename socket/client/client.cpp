@@ -1,3 +1,756 @@
+// A nonblocking TCP/TLS connection. Any number of them share one Loop (one epoll instance), which
+// connects them, runs the TLS handshake, fills buffer and flushes queued writes. The buffer/send/
+// Result API matches SocketServer::Client so protocol code can run over either side.
+// A Loop made with create_io_uring moves connected plain TCP clients onto io_uring.
 struct SocketClient {
-	
+	enum class State {
+		Connecting,
+		Handshake,
+		Ready,
+		Closed,
+	};
+
+	enum class SSL_State {
+		NoUse,
+		Initial,
+		Handshake,
+		Ready,
+	};
+
+	enum class Result {
+		Fail,
+		Ok,
+	};
+
+	struct Event {
+		enum class Type {
+			// connected, and the TLS handshake is done when TLS is used
+			Connected,
+			// buffer has new bytes
+			Data,
+			// queued writes dropped below max_pending_bytes after send was refused room
+			Writable,
+			// the connection failed or ended, destroy the client
+			Closed,
+		};
+
+		SocketClient* client;
+		Type type;
+	};
+
+	struct Loop {
+		// A send buffer of a destroyed client that the kernel may still be reading.
+		struct Orphan {
+			u64 id;
+			ctk::gar<u8> data;
+		};
+
+		// the low bits of io_uring user_data, the client id is above them
+		enum UringOp : u64 {
+			Epoll = 1,
+			Recv = 2,
+			Send = 3,
+			Cancel = 4,
+		};
+
+		constexpr static size_t max_epoll_events = 1024;
+		constexpr static u64 uring_op_bits = 3;
+		constexpr static u32 uring_entries = 256;
+		constexpr static u32 uring_buffer_count = 256;
+		constexpr static u32 uring_buffer_size = 16 * 1024;
+
+		int epoll_fd;
+		// in make order, so sorted by id
+		ctk::gar<SocketClient*> clients;
+		// indexed by socket fd, nullptr for fds no client owns
+		ctk::gar<SocketClient*> clients_by_fd;
+		// popped oldest first, the ones before events_head are gone already
+		ctk::gar<Event> events;
+		size_t events_head;
+		u64 next_id;
+		ctk::gar<Orphan> orphans;
+#ifdef WTK_IO_URING
+		// nullptr when running on epoll alone
+		IOUring* uring;
+#endif
+
+		void create(this auto& self) {
+			self.epoll_fd = ::epoll_create1(0);
+			if (self.epoll_fd == -1) {
+				WTK_PANIC("::epoll_create1 failed");
+			}
+			self.clients.create_auto();
+			self.clients_by_fd.create_auto();
+			self.events.create_auto();
+			self.events_head = 0;
+			self.next_id = 1;
+			self.orphans.create_auto();
+#ifdef WTK_IO_URING
+			self.uring = nullptr;
+#endif
+		}
+
+		// Connected plain TCP clients then receive through a multishot recv into a provided buffer ring
+		// and send through io_uring, with all queued sends going out in one submit per update. Connects
+		// and TLS stay on epoll, whose fd is watched through the ring. Returns false and runs on epoll
+		// alone when io_uring is unavailable at build or run time.
+		bool create_io_uring(this auto& self) {
+			self.create();
+#ifdef WTK_IO_URING
+			self.uring = IOUring::make(uring_entries, uring_buffer_count, uring_buffer_size);
+			if (self.uring != nullptr) {
+				self.uring->push_poll_multishot(self.epoll_fd, POLLIN, UringOp::Epoll);
+				return true;
+			}
+#endif
+			return false;
+		}
+
+		// Destroys the clients that are still open too.
+		void destroy(this auto& self) {
+			while (self.clients.len > 0) {
+				SocketClient* client = self.clients[self.clients.len - 1];
+				client->destroy();
+				std::free(client);
+			}
+			self.clients.destroy();
+			self.clients_by_fd.destroy();
+			self.events.destroy();
+#ifdef WTK_IO_URING
+			if (self.uring != nullptr) {
+				self.uring->destroy();
+				std::free(self.uring);
+			}
+#endif
+			for (size_t a = 0; a < self.orphans.len; ++a) {
+				self.orphans[a].data.destroy();
+			}
+			self.orphans.destroy();
+			::close(self.epoll_fd);
+		}
+
+		void push_event(this auto& self, SocketClient* client, Event::Type type) {
+			if (type == Event::Type::Data && self.events.len > self.events_head) {
+				Event last = self.events[self.events.len - 1];
+				if (last.client == client && last.type == type) {
+					return;
+				}
+			}
+			self.events.push(Event(client, type));
+		}
+
+		bool try_pop_event(this auto& self, Event* out_event) {
+			if (self.events_head == self.events.len) {
+				return false;
+			}
+			*out_event = self.events[self.events_head];
+			self.events_head += 1;
+			if (self.events_head == self.events.len) {
+				self.events.len = 0;
+				self.events_head = 0;
+			}
+			return true;
+		}
+
+		void set_client(this auto& self, int socket_fd, SocketClient* client) {
+			while (self.clients_by_fd.len <= (size_t)socket_fd) {
+				self.clients_by_fd.push(nullptr);
+			}
+			self.clients_by_fd[socket_fd] = client;
+		}
+
+		SocketClient* get_client(this auto& self, int socket_fd) {
+			if ((size_t)socket_fd >= self.clients_by_fd.len) {
+				return nullptr;
+			}
+			return self.clients_by_fd[socket_fd];
+		}
+
+		// Binary search, ids only grow and clients keeps make order.
+		SocketClient* get_client_by_id(this auto& self, u64 id) {
+			size_t low = 0;
+			size_t high = self.clients.len;
+			while (low < high) {
+				size_t middle = low + (high - low) / 2;
+				if (self.clients[middle]->id < id) {
+					low = middle + 1;
+				} else {
+					high = middle;
+				}
+			}
+			if (low < self.clients.len && self.clients[low]->id == id) {
+				return self.clients[low];
+			}
+			return nullptr;
+		}
+
+		// timeout_ms is how long to wait for events, 0 polls and -1 waits without a timeout.
+		void update(this auto& self, int timeout_ms) {
+			for (size_t a = 0; a < self.clients.len; ++a) {
+				SocketClient* client = self.clients[a];
+				if (client->read_paused && client->buffer.len < client->max_buffer_len) {
+					client->resume_read();
+				}
+			}
+#ifdef WTK_IO_URING
+			if (self.uring != nullptr) {
+				// also submits everything queued since the last update
+				self.uring->submit(1, timeout_ms);
+				IOUring::Completion completion;
+				while (self.uring->try_pop_completion(&completion)) {
+					self.handle_completion(completion);
+				}
+				return;
+			}
+#endif
+			self.update_epoll(timeout_ms);
+		}
+
+		// Returns the number of events handled.
+		int update_epoll(this auto& self, int timeout_ms) {
+			struct epoll_event events[max_epoll_events];
+			int epoll_fd_count = ::epoll_wait(self.epoll_fd, events, max_epoll_events, timeout_ms);
+			if (epoll_fd_count == -1) {
+				if (errno != EINTR) {
+					WTK_LOG("::epoll_wait failed (%i)", errno);
+				}
+				return 0;
+			}
+			for (int a = 0; a < epoll_fd_count; ++a) {
+				SocketClient* client = self.get_client(events[a].data.fd);
+				if (client == nullptr) {
+					continue;
+				}
+				client->update(events[a].events);
+			}
+			return epoll_fd_count;
+		}
+
+#ifdef WTK_IO_URING
+		void handle_completion(this auto& self, IOUring::Completion completion) {
+			u64 op = completion.user_data & ((1 << uring_op_bits) - 1);
+			u64 id = completion.user_data >> uring_op_bits;
+			if (op == UringOp::Epoll) {
+				// the ring is only woken when the epoll ready list changes, so drain it completely
+				while (self.update_epoll(0) == max_epoll_events) {
+				}
+				if (completion.has_more() == false) {
+					self.uring->push_poll_multishot(self.epoll_fd, POLLIN, UringOp::Epoll);
+				}
+				return;
+			}
+			SocketClient* client = self.get_client_by_id(id);
+			if (op == UringOp::Recv) {
+				if (client != nullptr) {
+					client->recv_done(completion);
+				}
+				if (completion.has_buffer()) {
+					self.uring->recycle_buffer(completion.get_buffer_id());
+				}
+			} else if (op == UringOp::Send) {
+				if (client != nullptr) {
+					client->send_done(completion.res);
+					return;
+				}
+				for (size_t a = 0; a < self.orphans.len; ++a) {
+					if (self.orphans[a].id == id) {
+						self.orphans[a].data.destroy();
+						self.orphans.remove(a);
+						break;
+					}
+				}
+			}
+		}
+#endif
+	};
+
+	constexpr static size_t default_max_buffer_len = 1024 * 1024;
+	constexpr static size_t default_max_pending_bytes = 1024 * 1024;
+
+	Loop* loop;
+	Addr addr;
+	size_t next_endpoint;
+	State state;
+	int socket_fd;
+	SSL_State ssl_state;
+	SSL_CTX* ssl_ctx;
+	SSL* ssl;
+	// protocols offered through ALPN in wire format (length prefixed), set right after make
+	ctk::ar<const u8> alpn;
+	// received bytes, drop them with consume once handled
+	ctk::gar<u8> buffer;
+	// reading stops while buffer holds this much and resumes in Loop::update after consume
+	size_t max_buffer_len;
+	bool read_paused;
+	ctk::gar<u8> pending;
+	size_t pending_offset;
+	// send refuses data that would grow pending past this
+	size_t max_pending_bytes;
+	bool send_refused;
+	// for the owner, e.g. to find its own object from a Loop event
+	void* user;
+	// names the client in io_uring completions, which may arrive after it is destroyed
+	u64 id;
+	// connected plain TCP on an io_uring Loop, the socket is no longer in epoll
+	bool uses_uring;
+	bool recv_armed;
+	// pending keeps growing while the kernel reads an io_uring send, so that send has its own buffer
+	ctk::gar<u8> in_flight;
+	size_t in_flight_offset;
+	bool send_in_flight;
+
+	static SocketClient* make(Loop* loop, Addr addr, bool use_tls) {
+		if (addr.endpoint_count == 0) {
+			WTK_LOG("SocketClient::make needs a resolved Addr (host:%s)", addr.name);
+			return nullptr;
+		}
+		SocketClient* client = ctk::alloc<SocketClient>(SocketClient());
+		client->loop = loop;
+		client->addr = addr;
+		client->next_endpoint = 0;
+		client->state = State::Connecting;
+		client->socket_fd = -1;
+		client->ssl_state = use_tls ? SSL_State::Initial : SSL_State::NoUse;
+		client->ssl_ctx = nullptr;
+		client->ssl = nullptr;
+		client->alpn = ctk::ar<const u8>(nullptr, 0);
+		client->buffer.create_auto();
+		client->max_buffer_len = default_max_buffer_len;
+		client->read_paused = false;
+		client->pending.create_auto();
+		client->pending_offset = 0;
+		client->max_pending_bytes = default_max_pending_bytes;
+		client->send_refused = false;
+		client->user = nullptr;
+		client->id = loop->next_id;
+		loop->next_id += 1;
+		client->uses_uring = false;
+		client->recv_armed = false;
+		client->in_flight.create_auto();
+		client->in_flight_offset = 0;
+		client->send_in_flight = false;
+		loop->clients.push(client);
+		if (client->connect_next() == false) {
+			client->close();
+		}
+		return client;
+	}
+
+	void destroy(this auto& self) {
+		self.close_socket();
+		self.buffer.destroy();
+		self.pending.destroy();
+		if (self.send_in_flight) {
+			self.loop->orphans.push(Loop::Orphan(self.id, self.in_flight));
+		} else {
+			self.in_flight.destroy();
+		}
+		for (size_t a = 0; a < self.loop->clients.len; ++a) {
+			if (self.loop->clients[a] == &self) {
+				self.loop->clients.remove(a);
+				break;
+			}
+		}
+		for (size_t a = self.loop->events.len; a > self.loop->events_head; --a) {
+			if (self.loop->events[a - 1].client == &self) {
+				self.loop->events.remove(a - 1);
+			}
+		}
+		if (self.loop->events_head == self.loop->events.len) {
+			self.loop->events.len = 0;
+			self.loop->events_head = 0;
+		}
+	}
+
+	void close_socket(this auto& self) {
+		if (self.ssl != nullptr) {
+			::SSL_free(self.ssl);
+			::SSL_CTX_free(self.ssl_ctx);
+			self.ssl = nullptr;
+			self.ssl_ctx = nullptr;
+		}
+		if (self.socket_fd == -1) {
+			return;
+		}
+#ifdef WTK_IO_URING
+		if (self.uses_uring) {
+			// ends the multishot recv, the ring holds its own reference to the socket
+			::shutdown(self.socket_fd, SHUT_RDWR);
+			if (self.recv_armed) {
+				self.loop->uring->push_cancel(self.get_user_data(Loop::UringOp::Recv), self.get_user_data(Loop::UringOp::Cancel));
+			}
+		}
+#endif
+		::epoll_ctl(self.loop->epoll_fd, EPOLL_CTL_DEL, self.socket_fd, nullptr);
+		::close(self.socket_fd);
+		self.loop->set_client(self.socket_fd, nullptr);
+		self.socket_fd = -1;
+	}
+
+	u64 get_user_data(this const auto& self, Loop::UringOp op) {
+		return (self.id << Loop::uring_op_bits) | op;
+	}
+
+	void close(this auto& self) {
+		if (self.state == State::Closed) {
+			return;
+		}
+		self.close_socket();
+		self.state = State::Closed;
+		self.loop->push_event(&self, Event::Type::Closed);
+	}
+
+	// Tries the remaining endpoints in order until a connect is in progress.
+	bool connect_next(this auto& self) {
+		while (self.next_endpoint < self.addr.endpoint_count) {
+			Addr addr = self.addr.get_endpoint(self.next_endpoint);
+			self.next_endpoint += 1;
+			int address_family = addr.type == Addr::Type::IPv4 ? AF_INET : AF_INET6;
+			int socket_fd = ::socket(address_family, SOCK_STREAM, 0);
+			if (socket_fd < 0) {
+				WTK_LOG("::socket failed (host:%s)", addr.name);
+				continue;
+			}
+			wtk::make_socket_nonblocking(socket_fd);
+			wtk::set_socket_nodelay(socket_fd);
+			int connect_result;
+			if (addr.type == Addr::Type::IPv4) {
+				struct sockaddr_in server_addr = {};
+				server_addr.sin_family = AF_INET;
+				server_addr.sin_port = ::htons(addr.port);
+				server_addr.sin_addr = addr.ip.v4;
+				connect_result = ::connect(socket_fd, (struct sockaddr*)&server_addr, sizeof(server_addr));
+			} else {
+				struct sockaddr_in6 server_addr = {};
+				server_addr.sin6_family = AF_INET6;
+				server_addr.sin6_port = ::htons(addr.port);
+				server_addr.sin6_addr = addr.ip.v6;
+				connect_result = ::connect(socket_fd, (struct sockaddr*)&server_addr, sizeof(server_addr));
+			}
+			if (connect_result == -1 && errno != EINPROGRESS) {
+				WTK_LOG("::connect failed (host:%s)", addr.name);
+				::close(socket_fd);
+				continue;
+			}
+			// edge triggered on both directions, so neither needs re-arming when TLS wants the other one
+			struct epoll_event ev = {};
+			ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+			ev.data.fd = socket_fd;
+			if (::epoll_ctl(self.loop->epoll_fd, EPOLL_CTL_ADD, socket_fd, &ev) == -1) {
+				WTK_PANIC("::epoll_ctl failed");
+			}
+			self.socket_fd = socket_fd;
+			self.loop->set_client(socket_fd, &self);
+			return true;
+		}
+		return false;
+	}
+
+	void update(this auto& self, u32 events) {
+		if (self.state == State::Connecting) {
+			int err = 0;
+			socklen_t len = sizeof(err);
+			if (::getsockopt(self.socket_fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+				self.close_socket();
+				if (self.connect_next() == false) {
+					self.close();
+				}
+				return;
+			}
+			if ((events & EPOLLOUT) == 0) {
+				return;
+			}
+			if (self.ssl_state == SSL_State::NoUse) {
+				self.state = State::Ready;
+				self.loop->push_event(&self, Event::Type::Connected);
+#ifdef WTK_IO_URING
+				if (self.loop->uring != nullptr) {
+					self.start_uring();
+				}
+#endif
+			} else {
+				self.state = State::Handshake;
+			}
+		}
+		if (events & EPOLLERR) {
+			self.close();
+			return;
+		}
+		if (self.state == State::Handshake) {
+			if (self.update_ssl() == Result::Fail) {
+				self.close();
+				return;
+			}
+			if (self.state != State::Ready) {
+				return;
+			}
+		}
+		self.update_ready();
+	}
+
+	Result update_ssl(this auto& self) {
+		if (self.ssl_state == SSL_State::Initial) {
+			self.ssl_ctx = ::SSL_CTX_new(::TLS_client_method());
+			if (self.ssl_ctx == nullptr) {
+				WTK_PANIC("::SSL_CTX_new failed");
+			}
+			self.ssl = ::SSL_new(self.ssl_ctx);
+			::SSL_set_fd(self.ssl, self.socket_fd);
+			::SSL_set_connect_state(self.ssl);
+			// pending may be reallocated between a write that wants a retry and the retry
+			::SSL_set_mode(self.ssl, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+			if (self.addr.name != nullptr) {
+				::SSL_set_tlsext_host_name(self.ssl, self.addr.name);
+			}
+			if (self.alpn.len > 0 && ::SSL_set_alpn_protos(self.ssl, self.alpn.buf, self.alpn.len) != 0) {
+				WTK_PANIC("::SSL_set_alpn_protos failed");
+			}
+			self.ssl_state = SSL_State::Handshake;
+		}
+		int ret = ::SSL_connect(self.ssl);
+		if (ret == 1) {
+			self.ssl_state = SSL_State::Ready;
+			self.state = State::Ready;
+			self.loop->push_event(&self, Event::Type::Connected);
+			return Result::Ok;
+		}
+		int err = ::SSL_get_error(self.ssl, ret);
+		if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+			return Result::Ok;
+		}
+		return Result::Fail;
+	}
+
+	// The protocol the server picked through ALPN, empty when it picked none or TLS isn't used.
+	ctk::ar<const u8> get_alpn_protocol(this const auto& self) {
+		const u8* protocol = nullptr;
+		u32 protocol_len = 0;
+		if (self.ssl != nullptr) {
+			::SSL_get0_alpn_selected(self.ssl, &protocol, &protocol_len);
+		}
+		return ctk::ar<const u8>(protocol, protocol_len);
+	}
+
+	void update_ready(this auto& self) {
+		if (self.state != State::Ready) {
+			return;
+		}
+		if (self.flush() == Result::Fail || (self.uses_uring == false && self.read() == Result::Fail)) {
+			self.close();
+		}
+	}
+
+	void resume_read(this auto& self) {
+		if (self.uses_uring == false) {
+			self.read_paused = false;
+			self.update_ready();
+			return;
+		}
+#ifdef WTK_IO_URING
+		// a cancelled recv may still be delivering, wait for its last completion
+		if (self.recv_armed == false && self.state == State::Ready) {
+			self.read_paused = false;
+			self.recv_armed = true;
+			self.loop->uring->push_recv(self.socket_fd, self.get_user_data(Loop::UringOp::Recv));
+		}
+#endif
+	}
+
+#ifdef WTK_IO_URING
+	void start_uring(this auto& self) {
+		::epoll_ctl(self.loop->epoll_fd, EPOLL_CTL_DEL, self.socket_fd, nullptr);
+		// io_uring waits for the socket itself, O_NONBLOCK would only hand -EAGAIN back
+		int flags = ::fcntl(self.socket_fd, F_GETFL, 0);
+		::fcntl(self.socket_fd, F_SETFL, flags & ~O_NONBLOCK);
+		self.uses_uring = true;
+		self.recv_armed = true;
+		self.loop->uring->push_recv(self.socket_fd, self.get_user_data(Loop::UringOp::Recv));
+	}
+
+	void recv_done(this auto& self, IOUring::Completion completion) {
+		if (completion.has_more() == false) {
+			self.recv_armed = false;
+		}
+		if (self.state != State::Ready) {
+			return;
+		}
+		if (completion.res > 0) {
+			ctk::ar<const u8> data = self.loop->uring->get_buffer(completion.get_buffer_id(), completion.res);
+			self.buffer.push_many(data.buf, data.len);
+			self.loop->push_event(&self, Event::Type::Data);
+			if (self.buffer.len >= self.max_buffer_len) {
+				self.read_paused = true;
+				if (self.recv_armed) {
+					self.loop->uring->push_cancel(self.get_user_data(Loop::UringOp::Recv), self.get_user_data(Loop::UringOp::Cancel));
+				}
+			}
+		} else if (completion.res == -EINVAL && self.loop->uring->has_multishot_recv) {
+			// the probe guessed wrong, the kernel takes recv but not its multishot flag
+			WTK_LOG("io_uring refused multishot recv, arming one recv at a time");
+			self.loop->uring->has_multishot_recv = false;
+		} else if (completion.res != -ENOBUFS && completion.res != -ECANCELED) {
+			// 0 is the peer closing
+			self.close();
+			return;
+		}
+		// -ENOBUFS ends the multishot when the buffer ring ran dry, recycling refills it
+		if (self.recv_armed == false && self.read_paused == false) {
+			self.recv_armed = true;
+			self.loop->uring->push_recv(self.socket_fd, self.get_user_data(Loop::UringOp::Recv));
+		}
+	}
+
+	void submit_send(this auto& self) {
+		if (self.send_in_flight) {
+			return;
+		}
+		if (self.in_flight_offset == self.in_flight.len) {
+			if (self.pending_offset == self.pending.len) {
+				return;
+			}
+			ctk::gar<u8> in_flight = self.in_flight;
+			self.in_flight = self.pending;
+			self.in_flight_offset = self.pending_offset;
+			self.pending = in_flight;
+			self.pending.len = 0;
+			self.pending_offset = 0;
+		}
+		self.loop->uring->push_send(self.socket_fd, &self.in_flight.buf[self.in_flight_offset], self.in_flight.len - self.in_flight_offset, self.get_user_data(Loop::UringOp::Send));
+		self.send_in_flight = true;
+	}
+
+	void send_done(this auto& self, int res) {
+		self.send_in_flight = false;
+		if (self.state != State::Ready) {
+			return;
+		}
+		if (res < 0) {
+			self.close();
+			return;
+		}
+		self.in_flight_offset += res;
+		if (self.in_flight_offset == self.in_flight.len) {
+			self.in_flight.len = 0;
+			self.in_flight_offset = 0;
+		}
+		self.submit_send();
+		self.notify_writable();
+	}
+#endif
+
+	// Reads until the socket would block or buffer is full, queues a Data event when bytes arrived.
+	Result read(this auto& self) {
+		constexpr size_t temp_buffer_size = 4096;
+		u8 temp_buffer[temp_buffer_size];
+		size_t start_len = self.buffer.len;
+		Result result = Result::Ok;
+		while (true) {
+			if (self.buffer.len >= self.max_buffer_len) {
+				self.read_paused = true;
+				break;
+			}
+			ssize_t bytes_read;
+			if (self.ssl == nullptr) {
+				bytes_read = ::recv(self.socket_fd, temp_buffer, temp_buffer_size, 0);
+				if (bytes_read == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+					break;
+				}
+			} else {
+				bytes_read = ::SSL_read(self.ssl, temp_buffer, temp_buffer_size);
+				if (bytes_read <= 0) {
+					int err = ::SSL_get_error(self.ssl, bytes_read);
+					if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+						break;
+					}
+				}
+			}
+			if (bytes_read <= 0) {
+				result = Result::Fail;
+				break;
+			}
+			self.buffer.push_many(temp_buffer, bytes_read);
+		}
+		if (self.buffer.len > start_len) {
+			self.loop->push_event(&self, Event::Type::Data);
+		}
+		return result;
+	}
+
+	// Drops handled bytes from the front of buffer.
+	void consume(this auto& self, size_t len) {
+		self.buffer.remove_many(0, len);
+	}
+
+	// Queues data and writes as much as the socket takes right now. Fails when the connection is
+	// closed or when data doesn't fit under max_pending_bytes, wait for a Writable event then.
+	Result send(this auto& self, ctk::ar<const u8> data) {
+		if (self.state == State::Closed) {
+			return Result::Fail;
+		}
+		if (self.get_pending_bytes() + data.len > self.max_pending_bytes) {
+			self.send_refused = true;
+			return Result::Fail;
+		}
+		self.pending.push_many(data.buf, data.len);
+		if (self.state == State::Ready && self.flush() == Result::Fail) {
+			self.close();
+			return Result::Fail;
+		}
+		return Result::Ok;
+	}
+
+	size_t get_pending_bytes(this const auto& self) {
+		return self.pending.len - self.pending_offset + self.in_flight.len - self.in_flight_offset;
+	}
+
+	void notify_writable(this auto& self) {
+		if (self.send_refused && self.get_pending_bytes() < self.max_pending_bytes) {
+			self.send_refused = false;
+			self.loop->push_event(&self, Event::Type::Writable);
+		}
+	}
+
+	Result flush(this auto& self) {
+#ifdef WTK_IO_URING
+		if (self.uses_uring) {
+			// goes out with the next submit
+			self.submit_send();
+			return Result::Ok;
+		}
+#endif
+		while (self.pending_offset < self.pending.len) {
+			const u8* buf = &self.pending.buf[self.pending_offset];
+			size_t len = self.pending.len - self.pending_offset;
+			ssize_t sent;
+			if (self.ssl == nullptr) {
+				sent = ::send(self.socket_fd, buf, len, MSG_NOSIGNAL);
+				if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+					break;
+				}
+			} else {
+				sent = ::SSL_write(self.ssl, buf, len);
+				if (sent <= 0) {
+					int err = ::SSL_get_error(self.ssl, sent);
+					if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+						break;
+					}
+				}
+			}
+			if (sent <= 0) {
+				return Result::Fail;
+			}
+			self.pending_offset += sent;
+		}
+		if (self.pending_offset == self.pending.len) {
+			self.pending.len = 0;
+			self.pending_offset = 0;
+		} else if (self.pending_offset >= self.pending.len / 2) {
+			// under steady backpressure pending is never fully drained, move the unsent bytes down
+			// once they are at most half of it so the buffer stays within about twice max_pending_bytes
+			self.pending.remove_many(0, self.pending_offset);
+			self.pending_offset = 0;
+		}
+		self.notify_writable();
+		return Result::Ok;
+	}
 };
\ No newline at end of file
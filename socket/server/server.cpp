@@ -4,20 +4,53 @@ struct SocketServer {
 		ctk::ar<u8> key;
 	};
 
+	struct Pool;
+
+	// Owned by the server's pool, hand it back with release when the connection is done.
 	struct Client {
+		// only holds memory while it has unconsumed bytes, idle clients give it back to the pool
 		ctk::gar<u8> buffer;
+		bool has_buffer;
+		// the most buffer held since it was taken, picks the pool class it goes back to
+		size_t buffer_peak_len;
 		int socket_fd;
+		// kept across connections and reset with SSL_clear, nullptr on a plain server
 		SSL* ssl;
+		Addr peer;
+		Pool* pool;
+		// next in the pool's free list
+		Client* next_free;
 
-		void create(this auto& self) {
-			self.buffer.create_auto();
+		// Closes the connection and gives the client back to the pool, it must not be used after.
+		void release(this auto& self) {
+			self.release_buffer();
+			if (self.socket_fd != -1) {
+				::shutdown(self.socket_fd, SHUT_WR);
+				::close(self.socket_fd);
+				self.socket_fd = -1;
+			}
+			if (self.ssl != nullptr && ::SSL_clear(self.ssl) != 1) {
+				::SSL_free(self.ssl);
+				self.ssl = nullptr;
+			}
+			Metrics::add(Metrics::Counter::ServerActiveClients, -1);
+			self.pool->release_client(&self);
 		}
 
-		void destroy(this auto& self) {
-			self.buffer.destroy();
-			::shutdown(self.socket_fd, SHUT_WR);
-			::close(self.socket_fd);
-			::SSL_free(self.ssl);
+		void take_buffer(this auto& self) {
+			if (self.has_buffer == false) {
+				self.buffer = self.pool->take_buffer();
+				self.has_buffer = true;
+				self.buffer_peak_len = 0;
+			}
+		}
+
+		void release_buffer(this auto& self) {
+			if (self.has_buffer) {
+				self.pool->release_buffer(self.buffer, self.buffer_peak_len);
+				self.buffer.create_empty();
+				self.has_buffer = false;
+			}
 		}
 
 		enum class Result {
@@ -39,11 +72,17 @@ struct SocketServer {
 				return Result::Fail;
 			}
 			if (bytes_read > 0) {
+				Metrics::add(Metrics::Counter::ServerBytesIn, bytes_read);
+				self.take_buffer();
 				self.buffer.push_many(temp_buffer, bytes_read);
+				self.buffer_peak_len = std::max(self.buffer_peak_len, self.buffer.len);
 				if (bytes_read == temp_buffer_size) {
 					goto start;
 				}
 			}
+			if (self.buffer.len == 0) {
+				self.release_buffer();
+			}
 			return Result::Ok;
 		}
 
@@ -74,67 +113,240 @@ struct SocketServer {
 				}
 				total_sent += sent;
 			}
+			Metrics::add(Metrics::Counter::ServerBytesOut, total_sent);
 			return Result::Ok;
 		}
 	};
 
+	// Recycles clients and receive buffers so a reconnect storm doesn't go through the allocator. The
+	// accept thread is the only one taking clients, any client thread releases them. Receive buffers
+	// are shared by all client threads and kept in classes by how big they grew.
+	struct Pool {
+		constexpr static size_t clients_per_slab = 64;
+		// buffers that grew past the last class are freed instead of kept
+		constexpr static size_t buffer_class_max_lens[] = {16 * 1024, 256 * 1024};
+		constexpr static size_t buffer_class_count = sizeof(buffer_class_max_lens) / sizeof(buffer_class_max_lens[0]);
+		constexpr static size_t max_idle_buffers = 256;
+
+		struct BufferClass {
+			ctk::gar<ctk::gar<u8>> idle;
+			bool locked;
+
+			void lock(this auto& self) {
+				while (std::atomic_ref<bool>(self.locked).exchange(true, std::memory_order_acquire)) {
+					::sched_yield();
+				}
+			}
+
+			void unlock(this auto& self) {
+				std::atomic_ref<bool>(self.locked).store(false, std::memory_order_release);
+			}
+		};
+
+		// a stack pushed by any thread, popped by the accept thread only, so a popped node can't come
+		// back in between and compare_exchange needs no ABA tag
+		Client* free_clients;
+		BufferClass buffer_classes[buffer_class_count];
+
+		void create(this auto& self) {
+			self.free_clients = nullptr;
+			for (size_t a = 0; a < buffer_class_count; ++a) {
+				self.buffer_classes[a].idle.create_auto();
+				self.buffer_classes[a].locked = false;
+			}
+		}
+
+		// Clients come in slabs that stay allocated for the life of the server.
+		Client* take_client(this auto& self) {
+			std::atomic_ref<Client*> head(self.free_clients);
+			Client* client = head.load(std::memory_order_acquire);
+			while (client != nullptr && head.compare_exchange_weak(client, client->next_free, std::memory_order_acquire, std::memory_order_acquire) == false) {
+			}
+			if (client == nullptr) {
+				Client* slab = (Client*)std::calloc(clients_per_slab, sizeof(Client));
+				if (slab == nullptr) {
+					WTK_PANIC("std::calloc failed");
+				}
+				for (size_t a = 1; a < clients_per_slab; ++a) {
+					slab[a].pool = &self;
+					slab[a].socket_fd = -1;
+					slab[a].ssl = nullptr;
+					self.release_client(&slab[a]);
+				}
+				client = &slab[0];
+				client->pool = &self;
+				client->ssl = nullptr;
+			}
+			client->buffer.create_empty();
+			client->has_buffer = false;
+			client->buffer_peak_len = 0;
+			client->socket_fd = -1;
+			return client;
+		}
+
+		void release_client(this auto& self, Client* client) {
+			std::atomic_ref<Client*> head(self.free_clients);
+			Client* next = head.load(std::memory_order_relaxed);
+			do {
+				client->next_free = next;
+			} while (head.compare_exchange_weak(next, client, std::memory_order_release, std::memory_order_relaxed) == false);
+		}
+
+		// Smaller classes first, most clients only ever see small messages.
+		ctk::gar<u8> take_buffer(this auto& self) {
+			for (size_t a = 0; a < buffer_class_count; ++a) {
+				BufferClass& buffer_class = self.buffer_classes[a];
+				buffer_class.lock();
+				if (buffer_class.idle.len > 0) {
+					ctk::gar<u8> buffer = buffer_class.idle[buffer_class.idle.len - 1];
+					buffer_class.idle.len -= 1;
+					buffer_class.unlock();
+					return buffer;
+				}
+				buffer_class.unlock();
+			}
+			ctk::gar<u8> buffer;
+			buffer.create_auto();
+			return buffer;
+		}
+
+		void release_buffer(this auto& self, ctk::gar<u8> buffer, size_t peak_len) {
+			buffer.len = 0;
+			for (size_t a = 0; a < buffer_class_count; ++a) {
+				if (peak_len <= buffer_class_max_lens[a]) {
+					BufferClass& buffer_class = self.buffer_classes[a];
+					buffer_class.lock();
+					if (buffer_class.idle.len < max_idle_buffers) {
+						buffer_class.idle.push(buffer);
+						buffer_class.unlock();
+						return;
+					}
+					buffer_class.unlock();
+					break;
+				}
+			}
+			buffer.destroy();
+		}
+	};
+
 	Addr addr;
 	SSL_CTX* ssl_ctx;
 	int socket_fd;
 	void (*client_thread_func)(Client*);
-	const ctk::ar<const u32>* disallowed_ips;
+	// read by the accept thread, replaced with swap_ip_filter, nullptr accepts everyone
+	IPFilter* ip_filter;
+	// accept threads currently looking at ip_filter
+	size_t ip_filter_readers;
+#ifdef WTK_IO_URING
+	// one multishot accept for the life of the server, nullptr accepts with ::accept
+	IOUring* uring;
+#endif
+	Pool pool;
 	ctk::Thread thread;
 
+	// Blocks until the next client connects.
+	int accept_client(this auto& self, struct sockaddr_storage* out_address) {
+		socklen_t addrlen = sizeof(*out_address);
+#ifdef WTK_IO_URING
+		if (self.uring != nullptr) {
+			IOUring::Completion completion;
+			while (self.uring->try_pop_completion(&completion) == false) {
+				self.uring->submit(1, -1);
+			}
+			if (completion.res == -EINVAL && completion.has_more() == false) {
+				// the kernel takes accept but not its multishot flag, ::accept from here on
+				WTK_LOG("io_uring refused multishot accept, using ::accept");
+				self.uring->destroy();
+				std::free(self.uring);
+				self.uring = nullptr;
+				return ::accept(self.socket_fd, (struct sockaddr*)out_address, &addrlen);
+			}
+			if (completion.has_more() == false) {
+				self.uring->push_accept_multishot(self.socket_fd, 0);
+			}
+			if (completion.res < 0) {
+				errno = -completion.res;
+				return -1;
+			}
+			if (::getpeername(completion.res, (struct sockaddr*)out_address, &addrlen) != 0) {
+				out_address->ss_family = AF_UNSPEC;
+			}
+			return completion.res;
+		}
+#endif
+		return ::accept(self.socket_fd, (struct sockaddr*)out_address, &addrlen);
+	}
+
 	static void thread_func(SocketServer* server) {
-		struct sockaddr_in address;
-		socklen_t addrlen = sizeof(address);
 		bool use_tls = server->ssl_ctx != nullptr;
 		while (server->thread.exists) {
-			int client_socket_fd = ::accept(server->socket_fd, (struct sockaddr*)&address, &addrlen);
+			struct sockaddr_storage address;
+			int client_socket_fd = server->accept_client(&address);
 			if (client_socket_fd < 0) {
 				WTK_LOG("accept failed (%x)", errno);
 				continue;
 			}
-			u32 ip_address = address.sin_addr.s_addr;
-			ctk::ar<const u32> disallowed_ips = *server->disallowed_ips;
-			for (size_t a = 0; a < disallowed_ips.len; ++a) {
-				if (disallowed_ips[a] == ip_address) {
-					::close(client_socket_fd);
-					continue;
-				}
+			Addr peer = Addr::make_sockaddr(&address);
+			if (server->allows(peer) == false) {
+				Metrics::add(Metrics::Counter::ServerRejects, 1);
+				::close(client_socket_fd);
+				continue;
 			}
 			
-			SSL* ssl = nullptr;
+			Metrics::add(Metrics::Counter::ServerAccepts, 1);
+			Metrics::add(Metrics::Counter::ServerActiveClients, 1);
+			wtk::set_socket_nodelay(client_socket_fd);
+			Client* client = server->pool.take_client();
+			client->socket_fd = client_socket_fd;
+			client->peer = peer;
 			if (use_tls) {
-				ssl = ::SSL_new(server->ssl_ctx);
-				::SSL_set_fd(ssl, client_socket_fd);
-				if (::SSL_accept(ssl) <= 0) {
-					::close(client_socket_fd);
-					::SSL_free(ssl);
+				if (client->ssl == nullptr) {
+					client->ssl = ::SSL_new(server->ssl_ctx);
+				}
+				::SSL_set_fd(client->ssl, client_socket_fd);
+				u64 handshake_start_us = Metrics::now_us();
+				if (::SSL_accept(client->ssl) <= 0) {
+					Metrics::add(Metrics::Counter::ServerTLSFailures, 1);
+					client->release();
 					continue;
 				}
+				Metrics::record(Metrics::Histogram::ServerTLSHandshakeUs, Metrics::now_us() - handshake_start_us);
 			}
 
 			int flags = ::fcntl(client_socket_fd, F_GETFL, 0);
 			::fcntl(client_socket_fd, F_SETFL, flags | O_NONBLOCK);
 
-			Client client;
-			client.create();
-			client.socket_fd = client_socket_fd;
-			client.ssl = ssl;
 			ctk::Thread client_thread;
-			Client* client_ptr = ctk::alloc<Client>(client);
-			client_thread.create(server->client_thread_func, client_ptr);
+			client_thread.create(server->client_thread_func, client);
 			if (client_thread.exists == false) {
-				client_ptr->destroy();
-				std::free(client_ptr);
+				client->release();
 				continue;
 			}
 		}
 		::close(server->socket_fd);
 	}
 
-	static SocketServer* make(bool is_async, Addr addr, TLS* tls, void (*client_thread_func)(Client*), const ctk::ar<const u32>* disallowed_ips) {
+	bool allows(this auto& self, const Addr& peer) {
+		std::atomic_ref<size_t> readers(self.ip_filter_readers);
+		readers.fetch_add(1);
+		IPFilter* ip_filter = std::atomic_ref<IPFilter*>(self.ip_filter).load();
+		bool allowed = ip_filter == nullptr || ip_filter->allows(peer);
+		readers.fetch_sub(1);
+		return allowed;
+	}
+
+	// Takes effect for the next accepted client without stopping the accept thread. Returns the old
+	// filter once the accept thread can no longer be reading it, the caller destroys it.
+	IPFilter* swap_ip_filter(this auto& self, IPFilter* ip_filter) {
+		IPFilter* old_ip_filter = std::atomic_ref<IPFilter*>(self.ip_filter).exchange(ip_filter);
+		while (std::atomic_ref<size_t>(self.ip_filter_readers).load() != 0) {
+			::sched_yield();
+		}
+		return old_ip_filter;
+	}
+
+	// use_io_uring accepts through a multishot io_uring accept when the kernel supports it.
+	static SocketServer* make(bool is_async, Addr addr, TLS* tls, void (*client_thread_func)(Client*), IPFilter* ip_filter, bool use_io_uring) {
 		SSL_CTX* ssl_ctx = nullptr;
 		if (tls != nullptr) {
 			BIO* cert_bio = ::BIO_new_mem_buf(tls->cert.buf, tls->cert.len);
@@ -168,11 +380,19 @@ struct SocketServer {
 			::BIO_free(key_bio);
 		}
 
-		int socket_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+		int socket_fd = ::socket(addr.type == Addr::Type::IPv6 ? AF_INET6 : AF_INET, SOCK_STREAM, 0);
 		if (socket_fd == -1) {
 			WTK_PANIC("::socket failed");
 		}
 
+		if (addr.type == Addr::Type::IPv6) {
+			// dual-stack, binding in6addr_any also accepts IPv4 clients as IPv4-mapped addresses
+			int v6_only = 0;
+			if (::setsockopt(socket_fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6_only, sizeof(v6_only)) == -1) {
+				WTK_PANIC("::setsockopt(IPV6_V6ONLY) failed");
+			}
+		}
+
 		int opt = 1;
 		if (::setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
 			WTK_PANIC("::setsockopt(SO_REUSEADDR) failed");
@@ -213,7 +433,23 @@ struct SocketServer {
 		server->ssl_ctx = ssl_ctx;
 		server->socket_fd = socket_fd;
 		server->client_thread_func = client_thread_func;
-		server->disallowed_ips = disallowed_ips;
+		server->ip_filter = ip_filter;
+		server->ip_filter_readers = 0;
+		server->pool.create();
+#ifdef WTK_IO_URING
+		server->uring = nullptr;
+		if (use_io_uring) {
+			server->uring = IOUring::make(64, 0, 0);
+			if (server->uring != nullptr && server->uring->has_multishot_accept == false) {
+				server->uring->destroy();
+				std::free(server->uring);
+				server->uring = nullptr;
+			}
+			if (server->uring != nullptr) {
+				server->uring->push_accept_multishot(socket_fd, 0);
+			}
+		}
+#endif
 		server->thread.create<SocketServer>(thread_func, server);
 		if (server->thread.exists == false) {
 			return nullptr;
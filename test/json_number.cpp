@@ -0,0 +1,227 @@
+// Round-trip and edge case checks for JSON::parse_number, built by hand like the benchmarks:
+// g++ -std=c++23 -O2 -DCBS_LINUX test/json_number.cpp -o wtk_test_json_number -lssl -lcrypto -lz -lbrotlidec
+// Prints every failed check and exits with 1 if there was one.
+
+#include "../mod.cpp"
+
+#include <random>
+
+using namespace wtk;
+
+size_t failures = 0;
+
+void fail(const char* text, const char* reason) {
+	std::printf("FAIL %s: %s\n", text, reason);
+	failures += 1;
+}
+
+// Parses text from a buffer of exactly its length, so reading past the end trips ASAN.
+JSON::Value parse_exact(const char* text, size_t* out_index) {
+	size_t len = std::strlen(text);
+	u8* buf = (u8*)std::malloc(len == 0 ? 1 : len);
+	std::memcpy(buf, text, len);
+	*out_index = 0;
+	JSON::Value value = JSON::parse_number(ctk::ar<const u8>(buf, len), out_index);
+	std::free(buf);
+	return value;
+}
+
+void check_integer(const char* text, int64_t expected) {
+	size_t index;
+	JSON::Value value = parse_exact(text, &index);
+	if (value.type != JSON::Value::Type::Number || value.is_integer == false) {
+		fail(text, "not an integer");
+	} else if (value.integer != expected || value.number != (double)expected) {
+		fail(text, "wrong value");
+	} else if (index != std::strlen(text)) {
+		fail(text, "not fully consumed");
+	}
+}
+
+// expected is compared bit for bit, so -0.0 and 0.0 differ
+void check_double(const char* text, double expected) {
+	size_t index;
+	JSON::Value value = parse_exact(text, &index);
+	if (value.type != JSON::Value::Type::Number || value.is_integer) {
+		fail(text, "not a double");
+	} else if (std::memcmp(&value.number, &expected, sizeof(double)) != 0) {
+		std::printf("     got %.17g, expected %.17g\n", value.number, expected);
+		fail(text, "wrong value");
+	} else if (index != std::strlen(text)) {
+		fail(text, "not fully consumed");
+	}
+}
+
+void check_strtod(const char* text) {
+	check_double(text, std::strtod(text, nullptr));
+}
+
+void check_error(const char* text) {
+	size_t index;
+	JSON::Value value = parse_exact(text, &index);
+	if (value.type != JSON::Value::Type::Error) {
+		fail(text, "accepted");
+	}
+}
+
+// the number ends where the valid prefix ends, the caller sees the rest
+void check_prefix(const char* text, size_t expected_index) {
+	size_t index;
+	JSON::Value value = parse_exact(text, &index);
+	if (value.type != JSON::Value::Type::Number || index != expected_index) {
+		fail(text, "wrong prefix");
+	}
+}
+
+void check_document_error(const char* text) {
+	JSON::Value value = JSON::parse(ctk::ar<const u8>((const u8*)text, std::strlen(text)));
+	if (value.type != JSON::Value::Type::Error) {
+		fail(text, "document accepted");
+	}
+	value.destroy();
+}
+
+void test_integers() {
+	check_integer("0", 0);
+	check_integer("-0", 0);
+	check_integer("7", 7);
+	check_integer("-7", -7);
+	check_integer("9007199254740993", 9007199254740993);
+	check_integer("9223372036854775807", INT64_MAX);
+	check_integer("-9223372036854775807", -INT64_MAX);
+	check_integer("-9223372036854775808", INT64_MIN);
+	// past int64_t they become doubles
+	check_double("9223372036854775808", 9223372036854775808.0);
+	check_double("-9223372036854775809", -9223372036854775809.0);
+	check_double("18446744073709551615", 18446744073709551615.0);
+	check_double("18446744073709551616", 18446744073709551616.0);
+	check_strtod("123456789012345678901234567890");
+	check_strtod("-123456789012345678901234567890");
+	// a fraction or exponent makes a double even when the value is whole
+	check_double("1.0", 1.0);
+	check_double("1e2", 100.0);
+	check_double("-0.0", -0.0);
+	check_double("-0e5", -0.0);
+}
+
+void test_fast_path_boundaries() {
+	// mantissa up to 2^53 and powers of ten up to 1e22 take the exact fast path
+	check_strtod("9007199254740992e22");
+	check_strtod("9007199254740992e-22");
+	check_strtod("9007199254740993e22");
+	check_strtod("9007199254740993e-22");
+	check_strtod("1e22");
+	check_strtod("1e23");
+	check_strtod("1e-22");
+	check_strtod("1e-23");
+	check_strtod("4.35679e-10");
+	check_strtod("0.1");
+	check_strtod("0.3");
+	check_strtod("123.456e-7");
+	check_strtod("-2.2250738585072014e-308");
+	check_strtod("0.0000000000000000000000000000000000001");
+	check_strtod("1.00000000000000000000000000000000001");
+}
+
+void test_slow_path() {
+	check_strtod("2.2250738585072011e-308");
+	check_strtod("4.9406564584124654e-324");
+	check_strtod("1.7976931348623157e308");
+	check_strtod("9007199254740993.0000000000000000001");
+	check_strtod("7.038531e-26");
+	check_strtod("1e300");
+	check_strtod("1e-320");
+	check_strtod("89255.0e-22");
+	check_double("1e400", HUGE_VAL);
+	check_double("-1e400", -HUGE_VAL);
+	check_double("1e-400", 0.0);
+	check_double("-1e-400", -0.0);
+	check_double("1e99999999999", HUGE_VAL);
+	check_double("1e-99999999999", 0.0);
+}
+
+void test_malformed() {
+	check_error("");
+	check_error("-");
+	check_error("+1");
+	check_error(".5");
+	check_error("1.");
+	check_error("1.e5");
+	check_error("1e");
+	check_error("1e+");
+	check_error("1e-");
+	check_error("-.5");
+	check_error("- 1");
+	check_error("Infinity");
+	check_error("NaN");
+	check_prefix("01", 1);
+	check_prefix("-01", 2);
+	check_prefix("1x", 1);
+	check_prefix("1.5.5", 3);
+	check_document_error("[01]");
+	check_document_error("[1.]");
+	check_document_error("[-]");
+	check_document_error("{\"a\":1e}");
+}
+
+// A number that ends where the data ends is parsed without reading past it, and a number that
+// continues past data.len is cut there.
+void test_end_of_buffer() {
+	const char* text = "12345e10";
+	for (size_t len = 1; len <= 5; ++len) {
+		size_t index = 0;
+		JSON::Value value = JSON::parse_number(ctk::ar<const u8>((const u8*)text, len), &index);
+		if (value.type != JSON::Value::Type::Number || value.is_integer == false || index != len) {
+			fail(text, "cut at data.len");
+		}
+	}
+	check_error("12345e");
+	check_integer("5", 5);
+	check_double("5e0", 5.0);
+	check_double("0.5", 0.5);
+}
+
+void test_round_trip() {
+	std::mt19937_64 random(42);
+	char text[64];
+	for (size_t a = 0; a < 1000000; ++a) {
+		u64 bits = random();
+		double number;
+		std::memcpy(&number, &bits, sizeof(double));
+		if (std::isfinite(number) == false) {
+			continue;
+		}
+		std::snprintf(text, sizeof(text), "%.17g", number);
+		if (std::strchr(text, '.') == nullptr && std::strchr(text, 'e') == nullptr) {
+			// whole numbers print without a fraction and may come back as integers
+			continue;
+		}
+		check_double(text, number);
+		if (failures > 20) {
+			return;
+		}
+	}
+	for (size_t a = 0; a < 1000000; ++a) {
+		int64_t integer = (int64_t)random();
+		std::snprintf(text, sizeof(text), "%lld", (long long)integer);
+		check_integer(text, integer);
+		if (failures > 20) {
+			return;
+		}
+	}
+}
+
+int main() {
+	test_integers();
+	test_fast_path_boundaries();
+	test_slow_path();
+	test_malformed();
+	test_end_of_buffer();
+	test_round_trip();
+	if (failures > 0) {
+		std::printf("%zu failed\n", failures);
+		return 1;
+	}
+	std::printf("ok\n");
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,298 @@
+// A minimal io_uring on raw syscalls. Operations are queued with the push_* methods and handed to
+// the kernel together by submit, so a batch of sends/receives costs one syscall. Multishot recv
+// picks its memory from a provided buffer ring: the completion names the buffer, hand it back
+// with recycle_buffer once the bytes are copied out.
+struct IOUring {
+	struct Completion {
+		u64 user_data;
+		int res;
+		u32 flags;
+
+		bool has_more(this const auto& self) {
+			return (self.flags & IORING_CQE_F_MORE) != 0;
+		}
+
+		bool has_buffer(this const auto& self) {
+			return (self.flags & IORING_CQE_F_BUFFER) != 0;
+		}
+
+		u16 get_buffer_id(this const auto& self) {
+			return self.flags >> IORING_CQE_BUFFER_SHIFT;
+		}
+	};
+
+	constexpr static u16 buffer_group = 0;
+
+	int ring_fd;
+	u8* sq_ring;
+	size_t sq_ring_size;
+	u8* cq_ring;
+	size_t cq_ring_size;
+	struct io_uring_sqe* sqes;
+	size_t sqes_size;
+	u32* sq_head;
+	u32* sq_tail;
+	u32 sq_mask;
+	u32 sq_entries;
+	u32* sq_array;
+	// sqes filled in but not handed to the kernel yet
+	u32 sq_local_tail;
+	u32 sq_submitted_tail;
+	u32* cq_head;
+	u32* cq_tail;
+	u32 cq_mask;
+	struct io_uring_cqe* cqes;
+	struct io_uring_buf_ring* buffer_ring;
+	size_t buffer_ring_size;
+	u8* buffer_memory;
+	u32 buffer_count;
+	u32 buffer_size;
+	// set by probe, without them accepts go through ::accept and recvs are armed one at a time
+	bool has_multishot_accept;
+	bool has_multishot_recv;
+
+	static int sys_setup(u32 entries, struct io_uring_params* params) {
+		return (int)::syscall(__NR_io_uring_setup, entries, params);
+	}
+
+	static int sys_enter(int ring_fd, u32 to_submit, u32 min_complete, u32 flags, const void* arg, size_t arg_size) {
+		return (int)::syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, arg, arg_size);
+	}
+
+	static int sys_register(int ring_fd, u32 opcode, const void* arg, u32 nr_args) {
+		return (int)::syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+	}
+
+	// Returns nullptr when the kernel has no usable io_uring (too old, disabled, or seccomp), the
+	// caller falls back to epoll then. buffer_count is a power of two, 0 skips the buffer ring.
+	static IOUring* make(u32 entries, u32 buffer_count, u32 buffer_size) {
+		struct io_uring_params params = {};
+		int ring_fd = sys_setup(entries, &params);
+		if (ring_fd < 0) {
+			return nullptr;
+		}
+		// single mmap rings (5.4) and timed waits (5.11) are assumed by the rest of the code
+		if ((params.features & IORING_FEAT_SINGLE_MMAP) == 0 || (params.features & IORING_FEAT_EXT_ARG) == 0) {
+			::close(ring_fd);
+			return nullptr;
+		}
+		IOUring* uring = ctk::alloc<IOUring>(IOUring());
+		uring->ring_fd = ring_fd;
+		uring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+		uring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+		size_t ring_size = std::max(uring->sq_ring_size, uring->cq_ring_size);
+		void* ring = ::mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+		if (ring == MAP_FAILED) {
+			WTK_PANIC("::mmap(IORING_OFF_SQ_RING) failed");
+		}
+		uring->sq_ring = (u8*)ring;
+		uring->cq_ring = (u8*)ring;
+		uring->sq_ring_size = ring_size;
+		uring->cq_ring_size = ring_size;
+		uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+		void* sqes = ::mmap(nullptr, uring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+		if (sqes == MAP_FAILED) {
+			WTK_PANIC("::mmap(IORING_OFF_SQES) failed");
+		}
+		uring->sqes = (struct io_uring_sqe*)sqes;
+		uring->sq_head = (u32*)(uring->sq_ring + params.sq_off.head);
+		uring->sq_tail = (u32*)(uring->sq_ring + params.sq_off.tail);
+		uring->sq_mask = *(u32*)(uring->sq_ring + params.sq_off.ring_mask);
+		uring->sq_entries = params.sq_entries;
+		uring->sq_array = (u32*)(uring->sq_ring + params.sq_off.array);
+		uring->sq_local_tail = *uring->sq_tail;
+		uring->sq_submitted_tail = uring->sq_local_tail;
+		uring->cq_head = (u32*)(uring->cq_ring + params.cq_off.head);
+		uring->cq_tail = (u32*)(uring->cq_ring + params.cq_off.tail);
+		uring->cq_mask = *(u32*)(uring->cq_ring + params.cq_off.ring_mask);
+		uring->cqes = (struct io_uring_cqe*)(uring->cq_ring + params.cq_off.cqes);
+		uring->buffer_ring = nullptr;
+		uring->buffer_memory = nullptr;
+		uring->buffer_count = buffer_count;
+		uring->buffer_size = buffer_size;
+		if (uring->probe() == false) {
+			uring->destroy();
+			std::free(uring);
+			return nullptr;
+		}
+		if (buffer_count > 0 && uring->register_buffer_ring() == false) {
+			uring->destroy();
+			std::free(uring);
+			return nullptr;
+		}
+		return uring;
+	}
+
+	// Fails when an opcode the backend always uses is missing. Multishot accept (5.19) and recv (6.0)
+	// are flags, not opcodes, so they are told apart by opcodes that came with the same release.
+	bool probe(this auto& self) {
+		constexpr size_t op_count = 256;
+		size_t probe_size = sizeof(struct io_uring_probe) + op_count * sizeof(struct io_uring_probe_op);
+		struct io_uring_probe* probe = (struct io_uring_probe*)std::calloc(1, probe_size);
+		// IORING_REGISTER_PROBE needs 5.6
+		if (sys_register(self.ring_fd, IORING_REGISTER_PROBE, probe, op_count) != 0) {
+			std::free(probe);
+			return false;
+		}
+		auto is_supported = [&](u8 op) {
+			return op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED) != 0;
+		};
+		bool usable = is_supported(IORING_OP_ACCEPT) && is_supported(IORING_OP_RECV) && is_supported(IORING_OP_SEND) && is_supported(IORING_OP_POLL_ADD) && is_supported(IORING_OP_ASYNC_CANCEL);
+		self.has_multishot_accept = is_supported(IORING_OP_SOCKET);
+		self.has_multishot_recv = is_supported(IORING_OP_SEND_ZC);
+		std::free(probe);
+		return usable;
+	}
+
+	bool register_buffer_ring(this auto& self) {
+		self.buffer_ring_size = self.buffer_count * sizeof(struct io_uring_buf);
+		void* ring = ::mmap(nullptr, self.buffer_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ring == MAP_FAILED) {
+			WTK_PANIC("::mmap failed");
+		}
+		self.buffer_ring = (struct io_uring_buf_ring*)ring;
+		self.buffer_memory = (u8*)std::malloc((size_t)self.buffer_count * self.buffer_size);
+		struct io_uring_buf_reg reg = {};
+		reg.ring_addr = (u64)self.buffer_ring;
+		reg.ring_entries = self.buffer_count;
+		reg.bgid = buffer_group;
+		// provided buffer rings need 5.19
+		if (sys_register(self.ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+			return false;
+		}
+		for (u32 a = 0; a < self.buffer_count; ++a) {
+			self.recycle_buffer((u16)a);
+		}
+		return true;
+	}
+
+	void destroy(this auto& self) {
+		if (self.buffer_ring != nullptr) {
+			::munmap(self.buffer_ring, self.buffer_ring_size);
+		}
+		std::free(self.buffer_memory);
+		::munmap(self.sqes, self.sqes_size);
+		::munmap(self.sq_ring, self.sq_ring_size);
+		::close(self.ring_fd);
+	}
+
+	// Submits queued work first when the submission queue is full.
+	struct io_uring_sqe* get_sqe(this auto& self) {
+		while (self.sq_local_tail - std::atomic_ref<u32>(*self.sq_head).load(std::memory_order_acquire) >= self.sq_entries) {
+			self.submit(0, 0);
+		}
+		u32 index = self.sq_local_tail & self.sq_mask;
+		struct io_uring_sqe* sqe = &self.sqes[index];
+		std::memset(sqe, 0, sizeof(*sqe));
+		self.sq_array[index] = index;
+		self.sq_local_tail += 1;
+		return sqe;
+	}
+
+	// Every completion carries a new socket until one arrives without IORING_CQE_F_MORE.
+	void push_accept_multishot(this auto& self, int socket_fd, u64 user_data) {
+		struct io_uring_sqe* sqe = self.get_sqe();
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->fd = socket_fd;
+		sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+		sqe->user_data = user_data;
+	}
+
+	// Every completion carries one provided buffer, res is its length and 0 means the peer closed.
+	// Without has_multishot_recv it completes once, arm it again after each completion then.
+	void push_recv(this auto& self, int socket_fd, u64 user_data) {
+		struct io_uring_sqe* sqe = self.get_sqe();
+		sqe->opcode = IORING_OP_RECV;
+		sqe->fd = socket_fd;
+		sqe->ioprio = self.has_multishot_recv ? IORING_RECV_MULTISHOT : 0;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = buffer_group;
+		sqe->user_data = user_data;
+	}
+
+	// buf has to stay valid until the completion arrives.
+	void push_send(this auto& self, int socket_fd, const u8* buf, size_t len, u64 user_data) {
+		struct io_uring_sqe* sqe = self.get_sqe();
+		sqe->opcode = IORING_OP_SEND;
+		sqe->fd = socket_fd;
+		sqe->addr = (u64)buf;
+		sqe->len = (u32)std::min<size_t>(len, UINT32_MAX);
+		sqe->msg_flags = MSG_NOSIGNAL;
+		sqe->user_data = user_data;
+	}
+
+	void push_poll_multishot(this auto& self, int fd, u32 poll_events, u64 user_data) {
+		struct io_uring_sqe* sqe = self.get_sqe();
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = fd;
+		sqe->poll32_events = poll_events;
+		sqe->len = IORING_POLL_ADD_MULTI;
+		sqe->user_data = user_data;
+	}
+
+	// Cancels every request submitted with target_user_data.
+	void push_cancel(this auto& self, u64 target_user_data, u64 user_data) {
+		struct io_uring_sqe* sqe = self.get_sqe();
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = target_user_data;
+		sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL;
+		sqe->user_data = user_data;
+	}
+
+	// Hands queued sqes to the kernel and, when wait_nr > 0, waits for that many completions or
+	// timeout_ms (-1 waits without a timeout).
+	void submit(this auto& self, u32 wait_nr, int timeout_ms) {
+		std::atomic_ref<u32>(*self.sq_tail).store(self.sq_local_tail, std::memory_order_release);
+		u32 to_submit = self.sq_local_tail - self.sq_submitted_tail;
+		if (to_submit == 0 && wait_nr == 0) {
+			return;
+		}
+		u32 flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+		struct __kernel_timespec timeout = {};
+		struct io_uring_getevents_arg arg = {};
+		const void* arg_ptr = nullptr;
+		size_t arg_size = 0;
+		if (wait_nr > 0 && timeout_ms >= 0) {
+			timeout.tv_sec = timeout_ms / 1000;
+			timeout.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+			arg.ts = (u64)&timeout;
+			flags |= IORING_ENTER_EXT_ARG;
+			arg_ptr = &arg;
+			arg_size = sizeof(arg);
+		}
+		int result = sys_enter(self.ring_fd, to_submit, wait_nr, flags, arg_ptr, arg_size);
+		if (result < 0) {
+			if (errno != EINTR && errno != ETIME && errno != EBUSY && errno != EAGAIN) {
+				WTK_LOG("io_uring_enter failed (%i)", errno);
+			}
+			return;
+		}
+		self.sq_submitted_tail += (u32)result;
+	}
+
+	bool try_pop_completion(this auto& self, Completion* out_completion) {
+		u32 head = *self.cq_head;
+		if (head == std::atomic_ref<u32>(*self.cq_tail).load(std::memory_order_acquire)) {
+			return false;
+		}
+		struct io_uring_cqe* cqe = &self.cqes[head & self.cq_mask];
+		*out_completion = Completion(cqe->user_data, cqe->res, cqe->flags);
+		std::atomic_ref<u32>(*self.cq_head).store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	ctk::ar<const u8> get_buffer(this const auto& self, u16 buffer_id, size_t len) {
+		return ctk::ar<const u8>(&self.buffer_memory[(size_t)buffer_id * self.buffer_size], len);
+	}
+
+	void recycle_buffer(this auto& self, u16 buffer_id) {
+		u16 tail = self.buffer_ring->tail;
+		// not buffer_ring->bufs, its empty struct wrapper takes a byte in C++ and moves the array
+		struct io_uring_buf* buf = (struct io_uring_buf*)self.buffer_ring + (tail & (self.buffer_count - 1));
+		buf->addr = (u64)&self.buffer_memory[(size_t)buffer_id * self.buffer_size];
+		buf->len = self.buffer_size;
+		buf->bid = buffer_id;
+		std::atomic_ref<u16>(self.buffer_ring->tail).store(tail + 1, std::memory_order_release);
+	}
+};
\ No newline at end of file
@@ -0,0 +1,241 @@
+// A WebSocket this side connects out to. It runs on a SocketClient::Loop, so any number of feeds
+// share one epoll instance; use one Loop per thread to spread them over a few threads.
+// Forward every Loop event for its client (client->user points back here) to handle_event.
+struct OutboundWebsocket {
+	enum class State {
+		Upgrading,
+		Open,
+		Closed,
+	};
+
+	constexpr static size_t sec_websocket_key_len = WebsocketClient::sec_websocket_key_len;
+	constexpr static size_t accept_key_len = 28; // base64(sha1())
+	constexpr static size_t default_max_message_len = 16 * 1024 * 1024;
+	constexpr static u16 close_message_too_big = 1009;
+
+	SocketClient* client;
+	State state;
+	char accept_key[accept_key_len];
+	// header and masked payload of the frame being sent
+	ctk::gar<u8> frame_buffer;
+	ctk::gar<u8> payload_buffer;
+	bool payload_ready;
+	// a longer message closes the connection with 1009, set right after make
+	size_t max_message_len;
+
+	static OutboundWebsocket* make(SocketClient::Loop* loop, Addr addr, bool use_tls, const char* path) {
+		SocketClient* client = SocketClient::make(loop, addr, use_tls);
+		if (client == nullptr) {
+			return nullptr;
+		}
+		u8 key_bytes[16];
+		if (::RAND_bytes(key_bytes, sizeof(key_bytes)) != 1) {
+			WTK_PANIC("::RAND_bytes failed");
+		}
+		char key[sec_websocket_key_len + 1];
+		WebsocketClient::base64_encode(key_bytes, sizeof(key_bytes), key);
+		key[sec_websocket_key_len] = '\0';
+
+		OutboundWebsocket* websocket = ctk::alloc<OutboundWebsocket>(OutboundWebsocket());
+		websocket->client = client;
+		websocket->state = State::Upgrading;
+		WebsocketClient::websocket_generate_accept_key(ctk::ar<const u8>((const u8*)key, sec_websocket_key_len), websocket->accept_key);
+		websocket->frame_buffer.create_auto();
+		websocket->payload_buffer.create_auto();
+		websocket->payload_ready = false;
+		websocket->max_message_len = default_max_message_len;
+		client->user = websocket;
+
+		// queued until the connection (and TLS handshake) is up
+		ctk::ar<u8> request = ctk::alloc_format("GET %s HTTP/1.1\r\nHost: %s\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: %s\r\nSec-WebSocket-Version: 13\r\n\r\n", path, addr.name, key);
+		client->send(ctk::ar<const u8>(request.buf, request.len));
+		request.destroy();
+		return websocket;
+	}
+
+	void destroy(this auto& self) {
+		self.client->destroy();
+		std::free(self.client);
+		self.frame_buffer.destroy();
+		self.payload_buffer.destroy();
+	}
+
+	bool consume_payload(this auto& self) {
+		if (self.payload_ready) {
+			self.payload_ready = false;
+			return true;
+		}
+		return false;
+	}
+
+	// Fail means the connection is done, destroy the websocket once the Closed event arrives.
+	SocketClient::Result handle_event(this auto& self, SocketClient::Event::Type type) {
+		if (type == SocketClient::Event::Type::Closed) {
+			self.state = State::Closed;
+			return SocketClient::Result::Fail;
+		}
+		if (type != SocketClient::Event::Type::Data) {
+			return SocketClient::Result::Ok;
+		}
+		if (self.state == State::Upgrading) {
+			SocketClient::Result result = self.handle_upgrade();
+			if (result == SocketClient::Result::Fail) {
+				self.client->close();
+				return result;
+			}
+		}
+		if (self.state == State::Open) {
+			SocketClient::Result result = self.handle_frame();
+			if (result == SocketClient::Result::Fail) {
+				self.client->close();
+				return result;
+			}
+		}
+		return SocketClient::Result::Ok;
+	}
+
+	SocketClient::Result handle_upgrade(this auto& self) {
+		ctk::gar<u8>& buffer = self.client->buffer;
+		size_t header_end = 0;
+		for (size_t a = 3; a < buffer.len; ++a) {
+			if (buffer[a - 3] == '\r' && buffer[a - 2] == '\n' && buffer[a - 1] == '\r' && buffer[a] == '\n') {
+				header_end = a + 1;
+				break;
+			}
+		}
+		if (header_end == 0) {
+			return SocketClient::Result::Ok;
+		}
+		constexpr const char* status_line = "HTTP/1.1 101";
+		constexpr size_t status_line_len = std::strlen(status_line);
+		if (header_end < status_line_len || std::memcmp(buffer.buf, status_line, status_line_len) != 0) {
+			WTK_LOG("websocket upgrade refused (host:%s)", self.client->addr.name);
+			return SocketClient::Result::Fail;
+		}
+		constexpr const char* accept_header = "\r\nsec-websocket-accept: ";
+		constexpr size_t accept_header_len = std::strlen(accept_header);
+		bool accepted = false;
+		for (size_t a = 0; a + accept_header_len + accept_key_len <= header_end; ++a) {
+			if (ctk::astr_nocase_cmp(&buffer[a], accept_header, accept_header_len)) {
+				accepted = std::memcmp(&buffer[a + accept_header_len], self.accept_key, accept_key_len) == 0;
+				break;
+			}
+		}
+		if (accepted == false) {
+			WTK_LOG("websocket upgrade has a wrong Sec-WebSocket-Accept (host:%s)", self.client->addr.name);
+			return SocketClient::Result::Fail;
+		}
+		self.client->consume(header_end);
+		self.state = State::Open;
+		return SocketClient::Result::Ok;
+	}
+
+	// Handles every complete frame in the buffer.
+	SocketClient::Result handle_frame(this auto& self) {
+		ctk::gar<u8>& buffer = self.client->buffer;
+		while (buffer.len >= 2) {
+			u8 fin = (buffer[0] & 0x80) >> 7;
+			u8 opcode = buffer[0] & 0x0f;
+			// servers never mask their frames
+			if (buffer[1] & 0x80) {
+				return SocketClient::Result::Fail;
+			}
+			u64 payload_len = buffer[1] & 0x7f;
+			size_t offset = 2;
+			if (payload_len == 126) {
+				if (buffer.len < offset + 2) {
+					return SocketClient::Result::Ok;
+				}
+				payload_len = (buffer[offset] << 8) | buffer[offset + 1];
+				offset += 2;
+			} else if (payload_len == 127) {
+				if (buffer.len < offset + 8) {
+					return SocketClient::Result::Ok;
+				}
+				payload_len = 0;
+				for (size_t a = 0; a < 8; ++a) {
+					payload_len = (payload_len << 8) | buffer[offset + a];
+				}
+				offset += 8;
+			}
+			// control frames are short and not part of the message
+			size_t message_len = (opcode & 0x8) ? 0 : self.payload_buffer.len;
+			if (payload_len > self.max_message_len - std::min(message_len, self.max_message_len) || payload_len > SIZE_MAX - offset) {
+				WTK_LOG("websocket message is over %zu bytes (host:%s)", self.max_message_len, self.client->addr.name);
+				u8 status[2] = { (u8)(close_message_too_big >> 8), (u8)(close_message_too_big & 0xFF) };
+				self.send_frame(0x88, ctk::ar<const u8>(status, 2));
+				self.state = State::Closed;
+				return SocketClient::Result::Fail;
+			}
+			if (buffer.len < offset + payload_len) {
+				// the read loop stops at max_buffer_len, make room for the whole frame
+				if (offset + payload_len > self.client->max_buffer_len) {
+					self.client->max_buffer_len = offset + payload_len;
+				}
+				return SocketClient::Result::Ok;
+			}
+			ctk::ar<const u8> payload(&buffer.buf[offset], payload_len);
+			Metrics::add(Metrics::Counter::WebsocketFramesIn, 1);
+			if (opcode == 0x8) {
+				self.send_frame(0x88, payload);
+				self.state = State::Closed;
+				return SocketClient::Result::Fail;
+			}
+			if (opcode == 0x9) {
+				if (self.send_frame(0x8a, payload) == SocketClient::Result::Fail) {
+					return SocketClient::Result::Fail;
+				}
+			} else if (opcode == 0x0 || opcode == 0x1 || opcode == 0x2) {
+				self.payload_buffer.push_many(payload.buf, payload.len);
+				if (fin == 1) {
+					self.payload_ready = true;
+					Metrics::record(Metrics::Histogram::WebsocketMessageBytes, self.payload_buffer.len);
+				}
+			} else if (opcode != 0xa) {
+				return SocketClient::Result::Fail;
+			}
+			self.client->consume(offset + payload_len);
+		}
+		return SocketClient::Result::Ok;
+	}
+
+	SocketClient::Result send_frame(this auto& self, u8 byte1, ctk::ar<const u8> data) {
+		u8 header[14];
+		size_t header_len;
+		header[0] = byte1;
+		if (data.len > 65535) {
+			header[1] = 0x80 | 127;
+			for (size_t a = 0; a < 8; ++a) {
+				header[2 + a] = (data.len >> ((7 - a) * 8)) & 0xFF;
+			}
+			header_len = 10;
+		} else if (data.len > 125) {
+			header[1] = 0x80 | 126;
+			header[2] = (data.len >> 8) & 0xFF;
+			header[3] = data.len & 0xFF;
+			header_len = 4;
+		} else {
+			header[1] = 0x80 | data.len;
+			header_len = 2;
+		}
+		u8* masking_key = &header[header_len];
+		if (::RAND_bytes(masking_key, 4) != 1) {
+			WTK_PANIC("::RAND_bytes failed");
+		}
+		header_len += 4;
+		self.frame_buffer.len = 0;
+		self.frame_buffer.push_many(header, header_len);
+		self.frame_buffer.push_many(data.buf, data.len);
+		WebsocketClient::mask_payload(&self.frame_buffer.buf[header_len], data.len, masking_key);
+		Metrics::add(Metrics::Counter::WebsocketFramesOut, 1);
+		return self.client->send(ctk::ar<const u8>(self.frame_buffer.buf, self.frame_buffer.len));
+	}
+
+	SocketClient::Result send(this auto& self, ctk::ar<const u8> data) {
+		return self.send_frame(0x82, data);
+	}
+
+	SocketClient::Result send_text(this auto& self, ctk::ar<const u8> data) {
+		return self.send_frame(0x81, data);
+	}
+};
\ No newline at end of file
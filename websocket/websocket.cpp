@@ -1,5 +1,6 @@
 struct WebsocketClient {
 	constexpr static size_t sec_websocket_key_len = 24;
+	constexpr static size_t max_frame_header_len = 10;
 
 	SocketServer::Client* client;
 	ctk::gar<u8> payload_buffer;
@@ -13,8 +14,7 @@ struct WebsocketClient {
 	
 	void destroy(this auto& self) {
 		if (self.is_valid()) {
-			self.client->destroy();
-			std::free(self.client);
+			self.client->release();
 		}
 		self.payload_buffer.destroy();
 	}
@@ -100,6 +100,33 @@ struct WebsocketClient {
 		base64_encode(hash, SHA_DIGEST_LENGTH, accept_key);
 	}
 
+	// XORs buf with the repeating 4-byte masking key, 16 bytes at a time.
+	static void mask_payload(u8* buf, size_t len, const u8* masking_key) {
+		size_t a = 0;
+#ifdef __SSE2__
+		u32 key;
+		std::memcpy(&key, masking_key, 4);
+		const __m128i key_vector = _mm_set1_epi32((int)key);
+		for (; a + 16 <= len; a += 16) {
+			__m128i chunk = _mm_loadu_si128((const __m128i*)&buf[a]);
+			_mm_storeu_si128((__m128i*)&buf[a], _mm_xor_si128(chunk, key_vector));
+		}
+#else
+		u64 key;
+		std::memcpy(&key, masking_key, 4);
+		std::memcpy((u8*)&key + 4, masking_key, 4);
+		for (; a + 8 <= len; a += 8) {
+			u64 chunk;
+			std::memcpy(&chunk, &buf[a], 8);
+			chunk ^= key;
+			std::memcpy(&buf[a], &chunk, 8);
+		}
+#endif
+		for (; a < len; ++a) {
+			buf[a] ^= masking_key[a & 3];
+		}
+	}
+
 	SocketServer::Client::Result handle_frame(this auto& self) {
 		if (self.client->buffer.len < 2) {
 			return SocketServer::Client::Result::Ok;
@@ -149,15 +176,9 @@ struct WebsocketClient {
 		}
 
 		if (mask) {
-			size_t mask_index = 0;
-			for (uint64_t a = 0; a < payload_len; ++a) {
-				self.client->buffer[offset + a] ^= masking_key[mask_index];
-				mask_index += 1;
-				if (mask_index >= 4) {
-					mask_index = 0;
-				}
-			}
+			mask_payload(&self.client->buffer[offset], payload_len, masking_key);
 		}
+		Metrics::add(Metrics::Counter::WebsocketFramesIn, 1);
 
 		if (opcode == 0x9) {
 			self.client->buffer[0] = 0x8a;
@@ -172,11 +193,13 @@ struct WebsocketClient {
 		self.client->buffer.remove_many(0, offset + payload_len);
 		if (fin == 1) {
 			self.payload_ready = true;
+			Metrics::record(Metrics::Histogram::WebsocketMessageBytes, self.payload_buffer.len);
 		}
 		return SocketServer::Client::Result::Ok;
 	}
 
 	SocketServer::Client::Result send(this const auto& self, ctk::ar<const u8> data) {
+		Metrics::add(Metrics::Counter::WebsocketFramesOut, 1);
 		if (data.len > 65535) {
 			WTK_PANIC("data.len is too big");
 			return SocketServer::Client::Result::Fail;
@@ -197,4 +220,37 @@ struct WebsocketClient {
 			return self.client->send(ctk::ar<const u8>(temp, 2 + data.len));
 		}
 	}
+
+	// Sends the writer's text as one frame, the header is written into the writer's headroom so the payload is not copied.
+	SocketServer::Client::Result send_json(this const auto& self, JSON::Writer* writer) {
+		if (writer->headroom < max_frame_header_len) {
+			WTK_PANIC("writer->headroom is too small");
+			return SocketServer::Client::Result::Fail;
+		}
+		Metrics::add(Metrics::Counter::WebsocketFramesOut, 1);
+		ctk::ar<const u8> payload = writer->to_ar();
+		size_t header_len;
+		if (payload.len > 65535) {
+			header_len = 10;
+		} else if (payload.len > 125) {
+			header_len = 4;
+		} else {
+			header_len = 2;
+		}
+		u8* frame = &writer->buffer.buf[writer->headroom - header_len];
+		frame[0] = 0x82;
+		if (header_len == 10) {
+			frame[1] = 127;
+			for (size_t a = 0; a < 8; ++a) {
+				frame[2 + a] = (payload.len >> ((7 - a) * 8)) & 0xFF;
+			}
+		} else if (header_len == 4) {
+			frame[1] = 126;
+			frame[2] = (payload.len >> 8) & 0xFF;
+			frame[3] = payload.len & 0xFF;
+		} else {
+			frame[1] = payload.len;
+		}
+		return self.client->send(ctk::ar<const u8>(frame, header_len + payload.len));
+	}
 };
\ No newline at end of file